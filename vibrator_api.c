@@ -21,16 +21,42 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netpacket/rpmsg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 #include "vibrator_internal.h"
 
+/****************************************************************************
+ * @brief Pre-processor Definitions
+ ****************************************************************************/
+
+#define VIBRATOR_BUSY_RETRY_MAX 3
+#define VIBRATOR_BUSY_WAIT_MAX 500
+#define VIBRATOR_DGRAM_TIMEOUT_MS 1000
+
+/****************************************************************************
+ * @brief Private Data
+ ****************************************************************************/
+
+static vibrator_busy_policy_e g_busy_policy = VIBRATOR_BUSY_DROP;
+static vibrator_priority_e g_priority = VIBRATOR_PRIORITY_NORMAL;
+static vibrator_category_e g_category = VIBRATOR_CATEGORY_UNKNOWN;
+static uint16_t g_deadline;
+static uint8_t g_device;
+static uint32_t g_app;
+static atomic_uint g_token;
+#ifdef CONFIG_VIBRATOR_SERVER
+static uint32_t g_dgram_seq;
+#endif
+
 /****************************************************************************
  * @brief Private Functions
  ****************************************************************************/
@@ -38,64 +64,92 @@
 /**
  * @brief Fill the vibrator message header
  *
- * @details This function fills the vibrator message header using the specified type.
+ * @details This function fills the vibrator message header using the specified type,
+ *          the lengths come from the operation table in vibrator_internal.h.
  *
  * @param buffer The buffer of the vibrator_msg_tS.
  */
 static void vibrator_msg_packet(vibrator_msg_t* buffer)
 {
-    switch (buffer->type) {
-    case VIBRATION_WAVEFORM:
-    case VIBRATION_INTERVAL:
-        buffer->request_len = VIBRATOR_MSG_HEADER + sizeof(vibrator_waveform_t);
-        buffer->response_len = VIBRATOR_MSG_RESULT;
-        break;
-    case VIBRATION_EFFECT:
-        buffer->request_len = VIBRATOR_MSG_HEADER + sizeof(vibrator_effect_t);
-        buffer->response_len = VIBRATOR_MSG_HEADER + sizeof(vibrator_effect_t);
-        break;
-    case VIBRATION_START:
-        buffer->request_len = VIBRATOR_MSG_HEADER + sizeof(uint32_t);
-        buffer->response_len = VIBRATOR_MSG_RESULT;
-        break;
-    case VIBRATION_STOP:
-        buffer->request_len = VIBRATOR_MSG_HEADER;
-        buffer->response_len = VIBRATOR_MSG_RESULT;
-        break;
-    case VIBRATION_SET_AMPLITUDE:
-        buffer->request_len = VIBRATOR_MSG_HEADER + sizeof(uint8_t);
-        buffer->response_len = VIBRATOR_MSG_RESULT;
-        break;
-    case VIBRATION_GET_CAPABLITY:
-        buffer->request_len = VIBRATOR_MSG_HEADER;
-        buffer->response_len = VIBRATOR_MSG_HEADER + sizeof(int32_t);
-        break;
-    case VIBRATION_GET_INTENSITY:
-        buffer->request_len = VIBRATOR_MSG_HEADER;
-        buffer->response_len = VIBRATOR_MSG_HEADER + sizeof(int32_t);
-        break;
-    case VIBRATION_SET_INTENSITY:
-        buffer->request_len = sizeof(vibrator_intensity_e) + VIBRATOR_MSG_HEADER;
-        buffer->response_len = VIBRATOR_MSG_RESULT;
-        break;
-    default:
+    if (buffer->type < VIBRATION_OP_COUNT
+        && g_vibrator_op_len[buffer->type].request_len > 0) {
+        buffer->request_len = g_vibrator_op_len[buffer->type].request_len;
+        buffer->response_len = g_vibrator_op_len[buffer->type].response_len;
+    } else {
         VIBRATORERR("unknown message type %d", buffer->type);
         buffer->request_len = sizeof(vibrator_msg_t);
         buffer->response_len = sizeof(vibrator_msg_t);
-        break;
     }
+
+    buffer->flags = 0;
+    if (g_busy_policy == VIBRATOR_BUSY_COALESCE)
+        buffer->flags |= VIBRATOR_FLAG_COALESCE;
+
+    buffer->status = 0;
+    buffer->depth = 0;
+    buffer->retry_after = 0;
+    buffer->priority = g_priority;
+    buffer->device = g_device;
+    buffer->app = g_app;
+    buffer->category = g_category;
+    buffer->version = VIBRATOR_MSG_VERSION;
+    memset(buffer->reserved, 0, sizeof(buffer->reserved));
+    buffer->deadline = g_deadline;
+    buffer->token = 0;
 }
 
 /**
- * @brief Open message queue
+ * @brief Fill a waveform request
  *
- * @details This function opens the message queue for vibrator messages.
+ * @param buffer The buffer of the vibrator_msg_t.
+ * @param timings The timings array.
+ * @param amplitudes The amplitudes array.
+ * @param repeat The index into the timings array at which to repeat.
+ * @param length The length of timings and amplitudes pairs.
  *
- * @param buffer The type of the vibrator_msg_t.
+ * @return Returns 0 on success, -EINVAL if the waveform is invalid.
+ */
+static int vibrator_waveform_fill(vibrator_msg_t* buffer,
+    const uint32_t timings[], const uint8_t amplitudes[], int8_t repeat,
+    uint8_t length)
+{
+    if (repeat < -1 || repeat >= length || length > WAVEFORM_MAXNUM)
+        return -EINVAL;
+
+    buffer->type = VIBRATION_WAVEFORM;
+    buffer->wave.length = length;
+    buffer->wave.repeat = repeat;
+    memcpy(buffer->wave.timings, timings, sizeof(uint32_t) * length);
+    memcpy(buffer->wave.amplitudes, amplitudes, sizeof(uint8_t) * length);
+    return 0;
+}
+
+/**
+ * @brief Fill a waveform request from a prepared pattern
  *
- * @return Returns a flag indicating whether the vibration is sent.
+ * @param buffer The buffer of the vibrator_msg_t.
+ * @param pattern The wire form of the pattern.
+ * @param size The size of the wire form.
+ *
+ * @return Returns 0 on success, -EINVAL if the size does not match.
  */
-static int vibrator_commit(vibrator_msg_t* buffer)
+static int vibrator_pattern_fill(vibrator_msg_t* buffer, const void* pattern,
+    size_t size)
+{
+    if (pattern == NULL || size != sizeof(vibrator_waveform_t))
+        return -EINVAL;
+
+    buffer->type = VIBRATION_WAVEFORM;
+    memcpy(&buffer->wave, pattern, size);
+    return 0;
+}
+
+/**
+ * @brief Connect to the server
+ *
+ * @return Returns the connected socket, or a negative errno on failure.
+ */
+static int vibrator_connect(void)
 {
     int fd;
     int ret;
@@ -120,47 +174,271 @@ static int vibrator_commit(vibrator_msg_t* buffer)
 #endif
     if (fd < 0) {
         VIBRATORERR("socket fail, errno = %d", errno);
-        return fd;
+        return -errno;
     }
 
     ret = connect(fd, (const struct sockaddr*)&addr, sizeof(addr));
     if (ret < 0) {
         VIBRATORERR("client: connect failure, errno = %d", errno);
         ret = -errno;
-        goto errout;
+        close(fd);
+        return ret;
     }
 
-    vibrator_msg_packet(buffer);
+    return fd;
+}
+
+/**
+ * @brief Exchange one request on a connected socket
+ *
+ * @details This function sends the packed request and, unless the request
+ *          carries VIBRATOR_FLAG_NOREPLY, waits for the complete reply.
+ *
+ * @param fd The connected socket.
+ * @param buffer The type of the vibrator_msg_t.
+ *
+ * @return Returns the result of the request, or a negative errno on failure.
+ */
+static int vibrator_exchange(int fd, vibrator_msg_t* buffer)
+{
+    size_t len = 0;
+    int ret;
 
     ret = send(fd, buffer, buffer->request_len, 0);
     if (ret < 0) {
         VIBRATORERR("send fail, errno = %d", errno);
-        ret = -errno;
-        goto errout;
+        return -errno;
+    }
+
+    if (buffer->flags & VIBRATOR_FLAG_NOREPLY)
+        return 0;
+
+    while (len < buffer->response_len) {
+        ret = recv(fd, (uint8_t*)buffer + len, buffer->response_len - len, 0);
+        if (ret <= 0) {
+            VIBRATORERR("recv fail, errno = %d", errno);
+            return ret < 0 ? -errno : -EINVAL;
+        }
+
+        len += ret;
+    }
+
+    VIBRATORINFO("recv len = %zu, result = %" PRIi32, len, buffer->result);
+    return buffer->result;
+}
+
+#ifdef CONFIG_VIBRATOR_SERVER
+/**
+ * @brief Exchange one request on the local datagram endpoint
+ *
+ * @details The request is sent with one sendto(). Unless it carries
+ *          VIBRATOR_FLAG_NOREPLY, the socket is first bound to an abstract
+ *          address of its own, which the server replies to.
+ *
+ * @param buffer The type of the vibrator_msg_t.
+ *
+ * @return Returns the result of the request, or a negative errno on failure,
+ *         -ETIMEDOUT if no reply arrived in VIBRATOR_DGRAM_TIMEOUT_MS.
+ */
+static int vibrator_dgram_transfer(vibrator_msg_t* buffer)
+{
+    const struct sockaddr_un server = {
+        .sun_family = AF_UNIX,
+        .sun_path = PROP_DGRAM_PATH,
+    };
+
+    const struct timeval timeout = {
+        .tv_sec = VIBRATOR_DGRAM_TIMEOUT_MS / 1000,
+        .tv_usec = VIBRATOR_DGRAM_TIMEOUT_MS % 1000 * 1000,
+    };
+
+    struct sockaddr_un addr;
+    int fd;
+    int ret;
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -errno;
+
+    /* a datagram carries no credentials, the process names itself */
+
+    if (buffer->app == VIBRATOR_APP_UNKNOWN)
+        buffer->app = VIBRATOR_APP_PID | getpid();
+
+    if (!(buffer->flags & VIBRATOR_FLAG_NOREPLY)) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+            PROP_DGRAM_PATH ".%d.%" PRIu32, getpid(), ++g_dgram_seq);
+        ret = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+        if (ret < 0)
+            goto errout;
+
+        /* a lost reply must not block the caller forever */
+
+        ret = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+            sizeof(timeout));
+        if (ret < 0)
+            goto errout;
     }
 
-    ret = recv(fd, buffer, sizeof(vibrator_msg_t), 0);
-    if (ret < buffer->response_len) {
-        VIBRATORERR("recv fail, errno = %d", errno);
-        ret = ret < 0 ? -errno : -EINVAL;
+    ret = sendto(fd, buffer, buffer->request_len, 0,
+        (const struct sockaddr*)&server, sizeof(server));
+    if (ret < 0)
         goto errout;
+
+    if (buffer->flags & VIBRATOR_FLAG_NOREPLY) {
+        close(fd);
+        return 0;
+    }
+
+    ret = recv(fd, buffer, buffer->response_len, 0);
+    if (ret < 0) {
+        ret = errno == EAGAIN || errno == EWOULDBLOCK ? -ETIMEDOUT : -errno;
+        close(fd);
+        return ret;
     }
+
+    close(fd);
+    if (ret < VIBRATOR_MSG_RESULT)
+        return -EINVAL;
+
     VIBRATORINFO("recv len = %d, result = %" PRIi32, ret, buffer->result);
-    ret = buffer->result;
+    return buffer->result;
 
 errout:
+    ret = -errno;
+    close(fd);
+    return ret;
+}
+#endif
+
+/**
+ * @brief Send one request to the server
+ *
+ * @details On the core of the server the request is one datagram exchange.
+ *          Otherwise, or if the datagram endpoint is not available, this
+ *          function connects to the server, exchanges the packed request
+ *          and closes the connection.
+ *
+ * @param buffer The type of the vibrator_msg_t.
+ *
+ * @return Returns a flag indicating whether the vibration is sent.
+ */
+static int vibrator_transfer(vibrator_msg_t* buffer)
+{
+    int fd;
+    int ret;
+
+#ifdef CONFIG_VIBRATOR_SERVER
+    ret = vibrator_dgram_transfer(buffer);
+    if (ret != -ENOENT && ret != -ECONNREFUSED)
+        return ret;
+#endif
+
+    fd = vibrator_connect();
+    if (fd < 0)
+        return fd;
+
+    ret = vibrator_exchange(fd, buffer);
     close(fd);
     return ret;
 }
 
+/**
+ * @brief Commit a request to the server
+ *
+ * @details This function packs the request and sends it, applying the busy
+ *          policy when the server rejects it because the device is saturated.
+ *
+ * @param buffer The type of the vibrator_msg_t.
+ *
+ * @return Returns a flag indicating whether the vibration is sent.
+ */
+static int vibrator_commit(vibrator_msg_t* buffer)
+{
+    int retry = 0;
+    int ret;
+
+    vibrator_msg_packet(buffer);
+
+    for (;;) {
+        ret = vibrator_transfer(buffer);
+        if (ret != -EBUSY || g_busy_policy != VIBRATOR_BUSY_WAIT
+            || retry++ >= VIBRATOR_BUSY_RETRY_MAX)
+            break;
+
+        VIBRATORINFO("server busy, depth = %d, retry after %d ms",
+            buffer->depth, buffer->retry_after);
+        usleep(MIN(MAX(buffer->retry_after, 1), VIBRATOR_BUSY_WAIT_MAX) * 1000);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Commit a request on a session
+ *
+ * @param session The session descriptor.
+ * @param buffer The type of the vibrator_msg_t.
+ * @param flags The request flags, VIBRATOR_FLAG_*.
+ *
+ * @return Returns the result of the request, or 0 once an asynchronous
+ *         request is sent.
+ */
+static int vibrator_session_commit(int session, vibrator_msg_t* buffer,
+    uint8_t flags)
+{
+    if (session < 0)
+        return -EBADF;
+
+    vibrator_msg_packet(buffer);
+    buffer->flags |= flags;
+    return vibrator_exchange(session, buffer);
+}
+
+/**
+ * @brief Commit an asynchronous playback request on a session
+ *
+ * @param session The session descriptor.
+ * @param buffer The type of the vibrator_msg_t.
+ * @param flags The request flags, VIBRATOR_FLAG_*.
+ * @param token Returned playback token.
+ *
+ * @return Returns 0 once the request is sent.
+ */
+static int vibrator_session_start(int session, vibrator_msg_t* buffer,
+    uint8_t flags, uint32_t* token)
+{
+    if (session < 0)
+        return -EBADF;
+
+    vibrator_msg_packet(buffer);
+    buffer->flags |= VIBRATOR_FLAG_NOREPLY | flags;
+
+    /* the sessions of all threads draw from one counter, 0 is no token */
+
+    do {
+        buffer->token = atomic_fetch_add(&g_token, 1) + 1;
+    } while (buffer->token == 0);
+
+    if (token != NULL)
+        *token = buffer->token;
+
+    return vibrator_exchange(session, buffer);
+}
+
 /****************************************************************************
  * @brief Public Functions
  *
  * @details This file contains nine interfaces vibrator_play_waveform,
  *   vibrator_play_oneshot, vibrator_play_predefined, vibrator_get_intensity,
  *   vibrator_set_intensity, vibrator_cancel, vibrator_start,
- *   vibrator_set_amplitude, and vibrator_get_capabilities
- *   and the detailed information of each interface has been described
+ *   vibrator_set_amplitude, and vibrator_get_capabilities, together with
+ *   vibrator_get_status and vibrator_set_busy_policy for back-pressure,
+ *   and the vibrator_session_* interfaces that keep one connection open and
+ *   send playback requests asynchronously, and the detailed information of
+ *   each interface has been described
  *
  ****************************************************************************/
 
@@ -181,19 +459,12 @@ errout:
 int vibrator_play_waveform(uint32_t timings[], uint8_t amplitudes[],
     int8_t repeat, uint8_t length)
 {
-    vibrator_waveform_t wave;
     vibrator_msg_t buffer;
+    int ret;
 
-    if (repeat < -1 || repeat >= length)
-        return -EINVAL;
-
-    wave.length = length;
-    wave.repeat = repeat;
-    memcpy(wave.timings, timings, sizeof(uint32_t) * length);
-    memcpy(wave.amplitudes, amplitudes, sizeof(uint8_t) * length);
-
-    buffer.type = VIBRATION_WAVEFORM;
-    buffer.wave = wave;
+    ret = vibrator_waveform_fill(&buffer, timings, amplitudes, repeat, length);
+    if (ret < 0)
+        return ret;
 
     return vibrator_commit(&buffer);
 }
@@ -233,7 +504,77 @@ int vibrator_play_interval(int32_t duration, int32_t interval,
  */
 int vibrator_play_oneshot(uint32_t timing, uint8_t amplitude)
 {
-    return vibrator_play_waveform(&timing, &amplitude, -1, 1);
+    /* a zero timing stops the vibrator, only vibrator_start() keeps that */
+
+    if (timing == 0)
+        return -EINVAL;
+
+    return vibrator_start_amplitude(timing, amplitude);
+}
+
+/**
+ * @brief Play a rumble vibration on a device with two motors.
+ *
+ * @param timing The number of milliseconds to vibrate. Must be positive.
+ * @param strong The amplitude of the strong motor, [0, 255].
+ * @param weak The amplitude of the weak motor, [0, 255].
+ * @return Returns the flag that the vibrator is playing the rumble.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_play_rumble(uint32_t timing, uint8_t strong, uint8_t weak)
+{
+    vibrator_msg_t buffer;
+
+    if (timing == 0)
+        return -EINVAL;
+
+    buffer.type = VIBRATION_RUMBLE;
+    buffer.rumble.timeoutms = timing;
+    buffer.rumble.strong = strong;
+    buffer.rumble.weak = weak;
+
+    return vibrator_commit(&buffer);
+}
+
+/**
+ * @brief Arm a predefined effect on a hardware trigger of the driver.
+ *
+ * @param id The always-on id, [0, CONFIG_VIBRATOR_ALWAYS_ON).
+ * @param trigger The driver trigger, for example a button code.
+ * @param effect_id The ID of the predefined effect.
+ * @param es The vibration intensity.
+ * @return Returns the flag indicating whether the effect was armed.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_always_on_enable(uint8_t id, uint16_t trigger, uint8_t effect_id,
+    vibrator_effect_strength_e es)
+{
+    vibrator_msg_t buffer;
+
+    buffer.type = VIBRATION_ALWAYS_ON_ENABLE;
+    buffer.always_on.id = id;
+    buffer.always_on.trigger = trigger;
+    buffer.always_on.effect_id = effect_id;
+    buffer.always_on.es = es;
+
+    return vibrator_commit(&buffer);
+}
+
+/**
+ * @brief Disarm the effect of an always-on id.
+ *
+ * @param id The always-on id, [0, CONFIG_VIBRATOR_ALWAYS_ON).
+ * @return Returns the flag indicating whether the effect was disarmed.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_always_on_disable(uint8_t id)
+{
+    vibrator_msg_t buffer;
+
+    buffer.type = VIBRATION_ALWAYS_ON_DISABLE;
+    buffer.always_on.id = id;
+
+    return vibrator_commit(&buffer);
 }
 
 /**
@@ -362,11 +703,28 @@ int vibrator_cancel(void)
  *         Greater than or equal to 0 means success; otherwise, it means failure.
  */
 int vibrator_start(int32_t timeoutms)
+{
+    return vibrator_start_amplitude(timeoutms, VIBRATOR_AMPLITUDE_DEVICE);
+}
+
+/**
+ * @brief Start the vibrator with vibrate time and its own amplitude.
+ *
+ * @param timeoutms Number of milliseconds to vibrate.
+ * @param amplitude The amplitude of vibration, [0, 255], or VIBRATOR_AMPLITUDE_DEVICE.
+ * @return Returns the flag that the vibration has started.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_start_amplitude(uint32_t timeoutms, int16_t amplitude)
 {
     vibrator_msg_t buffer;
 
-    buffer.type = VIBRATION_START;
-    buffer.timeoutms = timeoutms;
+    if (amplitude < VIBRATOR_AMPLITUDE_DEVICE || amplitude > UINT8_MAX)
+        return -EINVAL;
+
+    buffer.type = VIBRATION_START_AMPLITUDE;
+    buffer.start.timeoutms = timeoutms;
+    buffer.start.amplitude = amplitude;
 
     return vibrator_commit(&buffer);
 }
@@ -409,3 +767,562 @@ int vibrator_get_capabilities(int32_t* capabilities)
 
     return ret;
 }
+
+/**
+ * @brief Get the current load of the vibrator device.
+ *
+ * @param status Buffer that stores the device status.
+ * @return Returns the flag indicating success in getting vibrator status.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_get_status(vibrator_status_t* status)
+{
+    vibrator_msg_t buffer;
+    int ret;
+
+    buffer.type = VIBRATION_GET_STATUS;
+
+    ret = vibrator_commit(&buffer);
+    if (ret >= 0) {
+        status->busy = !!(buffer.status & VIBRATOR_STATUS_BUSY);
+        status->queue_depth = buffer.depth;
+        status->retry_after_ms = buffer.retry_after;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Set how play requests behave when the server is saturated.
+ *
+ * @param policy The busy policy applied to subsequent requests of this process.
+ * @return Returns the flag indicating whether setting the policy was successful.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_busy_policy(vibrator_busy_policy_e policy)
+{
+    if (policy < VIBRATOR_BUSY_DROP || policy > VIBRATOR_BUSY_COALESCE)
+        return -EINVAL;
+
+    g_busy_policy = policy;
+    return 0;
+}
+
+/**
+ * @brief Set the scheduling priority of play requests.
+ *
+ * @param priority The priority applied to subsequent requests of this process.
+ * @return Returns the flag indicating whether setting the priority was successful.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_priority(vibrator_priority_e priority)
+{
+    if (priority < VIBRATOR_PRIORITY_LOW || priority > VIBRATOR_PRIORITY_URGENT)
+        return -EINVAL;
+
+    g_priority = priority;
+    return 0;
+}
+
+/**
+ * @brief Set how long a queued play request may wait before it is dropped.
+ *
+ * @param deadline_ms Milliseconds a request may wait, 0 means no limit.
+ * @return Returns the flag indicating whether setting the deadline was successful.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_deadline(uint16_t deadline_ms)
+{
+    g_deadline = deadline_ms;
+    return 0;
+}
+
+/**
+ * @brief Select the actuator that subsequent requests are sent to.
+ *
+ * @param device The index of the actuator, or VIBRATOR_DEVICE_ALL.
+ * @return Returns the flag indicating whether selecting the device was successful.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_device(uint8_t device)
+{
+    g_device = device;
+    return 0;
+}
+
+/**
+ * @brief Set the category of play requests.
+ *
+ * @param category The category applied to subsequent requests of this process.
+ * @return Returns the flag indicating whether setting the category was successful.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_category(vibrator_category_e category)
+{
+    if (category < VIBRATOR_CATEGORY_UNKNOWN
+        || category > VIBRATOR_CATEGORY_ACCESSIBILITY)
+        return -EINVAL;
+
+    g_category = category;
+    return 0;
+}
+
+/**
+ * @brief Get the scheduler statistics of the vibrator device.
+ *
+ * @param stats Buffer that stores the statistics.
+ * @return Returns the flag indicating success in getting vibrator statistics.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_get_stats(vibrator_stats_t* stats)
+{
+    vibrator_msg_t buffer;
+    int ret;
+
+    buffer.type = VIBRATION_GET_STATS;
+
+    ret = vibrator_commit(&buffer);
+    if (ret >= 0)
+        *stats = buffer.stats;
+
+    return ret;
+}
+
+/**
+ * @brief Get the requests last executed by the vibrator device.
+ *
+ * @details The records are read a page at a time, newest first.
+ *
+ * @param history Buffer that stores the records.
+ * @param count The number of records the buffer holds.
+ * @return Returns the number of records stored.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_get_history(vibrator_history_t* history, int count)
+{
+    vibrator_msg_t buffer;
+    int total = 0;
+    int ret;
+
+    if (history == NULL || count < 0)
+        return -EINVAL;
+
+    while (total < count) {
+        buffer.type = VIBRATION_GET_HISTORY;
+        buffer.history.start = total;
+
+        ret = vibrator_commit(&buffer);
+        if (ret < 0)
+            return ret;
+
+        for (uint32_t i = 0; i < buffer.history.count && total < count; i++)
+            history[total++] = buffer.history.entries[i];
+
+        if (buffer.history.count < VIBRATOR_HISTORY_PAGE)
+            break;
+    }
+
+    return total;
+}
+
+/**
+ * @brief Get the internal state of the vibrator device.
+ *
+ * @param state Buffer that stores the state.
+ * @return Returns the flag indicating success in getting the state.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_get_state(vibrator_state_t* state)
+{
+    vibrator_msg_t buffer;
+    int ret;
+
+    buffer.type = VIBRATION_GET_STATE;
+
+    ret = vibrator_commit(&buffer);
+    if (ret >= 0)
+        *state = buffer.state;
+
+    return ret;
+}
+
+/**
+ * @brief Declare the tag that the requests of this process are accounted to.
+ *
+ * @details The tag is keyed by its hash, which every following request
+ *          carries. The tag itself is sent once to every device.
+ *
+ * @param tag The tag, or NULL to go back to the peer credentials.
+ * @return Returns the flag indicating whether the tag was declared.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_app_tag(const char* tag)
+{
+    vibrator_msg_t buffer;
+    uint8_t device = g_device;
+    int ret;
+
+    if (tag == NULL) {
+        g_app = VIBRATOR_APP_UNKNOWN;
+        return 0;
+    }
+
+    if (tag[0] == '\0' || strlen(tag) >= VIBRATOR_APP_TAG_MAX)
+        return -EINVAL;
+
+    g_app = vibrator_app_key(tag);
+    buffer.type = VIBRATION_APP_TAG;
+    memset(buffer.app_tag, 0, sizeof(buffer.app_tag));
+    strlcpy(buffer.app_tag, tag, sizeof(buffer.app_tag));
+
+    g_device = VIBRATOR_DEVICE_ALL;
+    ret = vibrator_commit(&buffer);
+    g_device = device;
+    return ret;
+}
+
+/**
+ * @brief Get the haptic usage of the applications accounted by the server.
+ *
+ * @details The applications are read a page at a time.
+ *
+ * @param apps Buffer that stores the counters of the applications.
+ * @param count The number of applications the buffer holds.
+ * @return Returns the number of applications stored.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_get_app_stats(vibrator_app_stats_t* apps, int count)
+{
+    vibrator_msg_t buffer;
+    int total = 0;
+    int ret;
+
+    if (apps == NULL || count < 0)
+        return -EINVAL;
+
+    while (total < count) {
+        buffer.type = VIBRATION_GET_APPS;
+        buffer.apps.start = total;
+
+        ret = vibrator_commit(&buffer);
+        if (ret < 0)
+            return ret;
+
+        for (uint32_t i = 0; i < buffer.apps.count && total < count; i++)
+            apps[total++] = buffer.apps.entries[i];
+
+        if (buffer.apps.count < VIBRATOR_APP_PAGE)
+            break;
+    }
+
+    return total;
+}
+
+/**
+ * @brief Reset the haptic usage counters of all applications.
+ *
+ * @return Returns the flag indicating whether the counters were reset.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_reset_app_stats(void)
+{
+    vibrator_msg_t buffer;
+
+    buffer.type = VIBRATION_RESET_APPS;
+
+    return vibrator_commit(&buffer);
+}
+
+/**
+ * @brief Open a session.
+ *
+ * @return Returns the session descriptor.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_open(void)
+{
+    return vibrator_connect();
+}
+
+/**
+ * @brief Close a session.
+ *
+ * @param session The session descriptor.
+ * @return Returns the flag indicating whether the session was closed.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_close(int session)
+{
+    if (session < 0)
+        return -EBADF;
+
+    return close(session) < 0 ? -errno : 0;
+}
+
+/**
+ * @brief Register a waveform on a session.
+ *
+ * @param session The session descriptor.
+ * @param timings The pattern of alternating on-off timings, starting with off.
+ * @param amplitudes The amplitude values of the timing/amplitude pairs.
+ * @param repeat The index into the timings array at which to repeat, or -1.
+ * @param length The length of timings and amplitudes pairs.
+ * @return Returns the handle of the registered waveform.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_register_waveform(int session, const uint32_t timings[],
+    const uint8_t amplitudes[], int8_t repeat, uint8_t length)
+{
+    vibrator_msg_t buffer;
+    int ret;
+
+    ret = vibrator_waveform_fill(&buffer, timings, amplitudes, repeat, length);
+    if (ret < 0)
+        return ret;
+
+    return vibrator_session_commit(session, &buffer, VIBRATOR_FLAG_REGISTER);
+}
+
+/**
+ * @brief Register a predefined effect on a session.
+ *
+ * @param session The session descriptor.
+ * @param effect_id The ID of the effect.
+ * @param es The vibration intensity.
+ * @return Returns the handle of the registered effect.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_register_predefined(int session, uint8_t effect_id,
+    vibrator_effect_strength_e es)
+{
+    vibrator_msg_t buffer;
+
+    if (es < VIBRATION_LIGHT || es > VIBRATION_DEFAULTES)
+        return -EINVAL;
+
+    buffer.type = VIBRATION_EFFECT;
+    buffer.effect.effect_id = effect_id;
+    buffer.effect.es = es;
+
+    return vibrator_session_commit(session, &buffer, VIBRATOR_FLAG_REGISTER);
+}
+
+/**
+ * @brief Unregister an effect of a session, asynchronously.
+ *
+ * @param session The session descriptor.
+ * @param handle The handle of the registered effect.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_unregister(int session, int handle)
+{
+    vibrator_msg_t buffer;
+
+    buffer.type = VIBRATION_UNREGISTER;
+    buffer.handle = handle;
+
+    return vibrator_session_commit(session, &buffer, VIBRATOR_FLAG_NOREPLY);
+}
+
+/**
+ * @brief Play a registered effect, asynchronously.
+ *
+ * @param session The session descriptor.
+ * @param handle The handle of the registered effect.
+ * @param token Returned playback token, may be NULL.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_play(int session, int handle, uint32_t* token)
+{
+    vibrator_msg_t buffer;
+
+    buffer.type = VIBRATION_PLAY_HANDLE;
+    buffer.handle = handle;
+
+    return vibrator_session_start(session, &buffer, 0, token);
+}
+
+/**
+ * @brief Play a waveform on a session, asynchronously.
+ *
+ * @param session The session descriptor.
+ * @param timings The pattern of alternating on-off timings, starting with off.
+ * @param amplitudes The amplitude values of the timing/amplitude pairs.
+ * @param repeat The index into the timings array at which to repeat, or -1.
+ * @param length The length of timings and amplitudes pairs.
+ * @param token Returned playback token, may be NULL.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_play_waveform(int session, const uint32_t timings[],
+    const uint8_t amplitudes[], int8_t repeat, uint8_t length,
+    uint32_t* token)
+{
+    vibrator_msg_t buffer;
+    int ret;
+
+    ret = vibrator_waveform_fill(&buffer, timings, amplitudes, repeat, length);
+    if (ret < 0)
+        return ret;
+
+    return vibrator_session_start(session, &buffer, 0, token);
+}
+
+/**
+ * @brief Register a pattern prepared by vibrator::Pattern on a session.
+ *
+ * @param session The session descriptor.
+ * @param pattern The wire form of the pattern.
+ * @param size The size of the wire form.
+ * @return Returns the handle of the registered pattern.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_register_pattern(int session, const void* pattern,
+    size_t size)
+{
+    vibrator_msg_t buffer;
+    int ret;
+
+    ret = vibrator_pattern_fill(&buffer, pattern, size);
+    if (ret < 0)
+        return ret;
+
+    return vibrator_session_commit(session, &buffer,
+        VIBRATOR_FLAG_REGISTER | VIBRATOR_FLAG_PREVALIDATED);
+}
+
+/**
+ * @brief Play a pattern prepared by vibrator::Pattern, asynchronously.
+ *
+ * @param session The session descriptor.
+ * @param pattern The wire form of the pattern.
+ * @param size The size of the wire form.
+ * @param token Returned playback token, may be NULL.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_play_pattern(int session, const void* pattern,
+    size_t size, uint32_t* token)
+{
+    vibrator_msg_t buffer;
+    int ret;
+
+    ret = vibrator_pattern_fill(&buffer, pattern, size);
+    if (ret < 0)
+        return ret;
+
+    return vibrator_session_start(session, &buffer,
+        VIBRATOR_FLAG_PREVALIDATED, token);
+}
+
+/**
+ * @brief Cancel a playback of a session, asynchronously.
+ *
+ * @param session The session descriptor.
+ * @param token The playback token.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_cancel(int session, uint32_t token)
+{
+    vibrator_msg_t buffer;
+
+    buffer.type = VIBRATION_CANCEL_TOKEN;
+    vibrator_msg_packet(&buffer);
+    buffer.flags |= VIBRATOR_FLAG_NOREPLY;
+    buffer.token = token;
+
+    return session < 0 ? -EBADF : vibrator_exchange(session, &buffer);
+}
+
+/**
+ * @brief Register a shared memory region with the server.
+ *
+ * @param session The session descriptor.
+ * @param name The name of the shared memory object.
+ * @param size The size of the object in bytes, a multiple of vibrator_step_t.
+ * @return Returns the handle of the region.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_register_region(int session, const char* name,
+    size_t size)
+{
+    vibrator_msg_t buffer;
+
+    if (name == NULL || strlen(name) >= VIBRATOR_REGION_NAME_MAX || size == 0
+        || size % sizeof(vibrator_step_t) != 0 || size > UINT32_MAX)
+        return -EINVAL;
+
+    buffer.type = VIBRATION_REGISTER_REGION;
+    buffer.region.size = size;
+    strlcpy(buffer.region.name, name, sizeof(buffer.region.name));
+
+    return vibrator_session_commit(session, &buffer, 0);
+}
+
+/**
+ * @brief Release a shared memory region of a session.
+ *
+ * @param session The session descriptor.
+ * @param region The handle of the region.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_release_region(int session, int region)
+{
+    vibrator_msg_t buffer;
+
+    buffer.type = VIBRATION_RELEASE_REGION;
+    buffer.handle = region;
+
+    return vibrator_session_commit(session, &buffer, VIBRATOR_FLAG_NOREPLY);
+}
+
+/**
+ * @brief Play steps of a shared memory region on a session.
+ *
+ * @param session The session descriptor.
+ * @param region The handle of the region.
+ * @param offset The index of the first step.
+ * @param length The number of steps, at most INT16_MAX.
+ * @param repeat The index into the steps at which to repeat, or -1.
+ * @param token Returned playback token, may be NULL.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_play_region(int session, int region, uint32_t offset,
+    uint32_t length, int16_t repeat, uint32_t* token)
+{
+    vibrator_msg_t buffer;
+
+    if (length == 0 || length > INT16_MAX || repeat < -1 || repeat >= (int)length)
+        return -EINVAL;
+
+    buffer.type = VIBRATION_PLAY_REGION;
+    buffer.region_play.region = region;
+    buffer.region_play.offset = offset;
+    buffer.region_play.length = length;
+    buffer.region_play.repeat = repeat;
+
+    return vibrator_session_start(session, &buffer, 0, token);
+}
+
+/**
+ * @brief Change the amplitude of the playing vibration on a session.
+ *
+ * @param session The session descriptor.
+ * @param amplitude The amplitude of vibration, [0, 255].
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_update(int session, uint8_t amplitude)
+{
+    vibrator_msg_t buffer;
+
+    buffer.type = VIBRATION_UPDATE;
+    buffer.amplitude = amplitude;
+
+    return vibrator_session_commit(session, &buffer, VIBRATOR_FLAG_NOREPLY);
+}
@@ -19,12 +19,25 @@
 #define __INCLUDE_VIBRATOR_API_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/****************************************************************************
+ * @brief Pre-processor Definitions
+ ****************************************************************************/
+
+#define VIBRATOR_WAVEFORM_MAX 24 /**< Maximum number of steps of a waveform */
+#define VIBRATOR_REGION_NAME_MAX 32 /**< Size of a shared memory region name */
+#define VIBRATOR_REGION_PREFIX "/vibrator_" /**< Prefix of a region name */
+#define VIBRATOR_AMPLITUDE_DEVICE -1 /**< The amplitude set with vibrator_set_amplitude() */
+#define VIBRATOR_DEVICE_ALL 0xff /**< Every actuator, started together */
+#define VIBRATOR_STATE_SLOTS 2 /**< Number of double-buffered waveform slots */
+#define VIBRATOR_APP_TAG_MAX 16 /**< Size of an application tag */
+
 /****************************************************************************
  * @brief Public Types
  ****************************************************************************/
@@ -39,7 +52,8 @@ enum {
     CAP_EXTERNAL_CONTROL = 8, /**< External control capability */
     CAP_EXTERNAL_AMPLITUDE_CONTROL = 16, /**< External amplitude control capability */
     CAP_COMPOSE_EFFECTS = 32, /**< Compose effects capability */
-    CAP_ALWAYS_ON_CONTROL = 64 /**< Always on control capability */
+    CAP_ALWAYS_ON_CONTROL = 64, /**< Always on control capability */
+    CAP_RUMBLE = 128 /**< Strong and weak motors driven separately */
 };
 
 /**
@@ -74,6 +88,131 @@ typedef enum {
     VIBRATION_INTENSITY_OFF = 3 /**< No vibration (off) */
 } vibrator_intensity_e;
 
+/**
+ * @brief Client behaviour when the server reports it is saturated
+ */
+typedef enum {
+    VIBRATOR_BUSY_DROP = 0, /**< Fail the request with -EBUSY */
+    VIBRATOR_BUSY_WAIT = 1, /**< Sleep for the advertised retry-after, then retry */
+    VIBRATOR_BUSY_COALESCE = 2 /**< Let the server replace our own pending request */
+} vibrator_busy_policy_e;
+
+/**
+ * @brief Scheduling priority of playback requests
+ */
+typedef enum {
+    VIBRATOR_PRIORITY_LOW = 0, /**< Waits behind any other playback */
+    VIBRATOR_PRIORITY_NORMAL = 1, /**< Default priority */
+    VIBRATOR_PRIORITY_HIGH = 2, /**< Preempts normal and low playbacks */
+    VIBRATOR_PRIORITY_URGENT = 3 /**< Preempts every playback */
+} vibrator_priority_e;
+
+/**
+ * @brief Category of playback requests, checked against the server policy
+ */
+typedef enum {
+    VIBRATOR_CATEGORY_UNKNOWN = 0, /**< Default category */
+    VIBRATOR_CATEGORY_ALARM = 1, /**< Alarms and timers */
+    VIBRATOR_CATEGORY_RINGTONE = 2, /**< Incoming calls */
+    VIBRATOR_CATEGORY_NOTIFICATION = 3, /**< Notifications */
+    VIBRATOR_CATEGORY_COMMUNICATION = 4, /**< Messages of an ongoing conversation */
+    VIBRATOR_CATEGORY_TOUCH = 5, /**< Touch feedback */
+    VIBRATOR_CATEGORY_MEDIA = 6, /**< Games and media playback */
+    VIBRATOR_CATEGORY_ACCESSIBILITY = 7 /**< Accessibility feedback */
+} vibrator_category_e;
+
+/**
+ * @brief Load of the vibrator device as reported by the server
+ */
+typedef struct {
+    bool busy; /**< A vibration is currently playing */
+    uint8_t queue_depth; /**< Requests outstanding on the device */
+    uint16_t retry_after_ms; /**< Milliseconds until the device is expected to be idle */
+} vibrator_status_t;
+
+/**
+ * @brief Scheduler statistics of the vibrator device
+ */
+typedef struct {
+    uint32_t queue_depth; /**< Requests outstanding on the device */
+    uint32_t queue_peak; /**< Highest number of outstanding requests */
+    uint32_t queued; /**< Requests that had to wait in the queue */
+    uint32_t coalesced; /**< Queued requests replaced by a newer one */
+    uint32_t expired; /**< Queued requests dropped at their deadline */
+    uint32_t rejected; /**< Requests rejected because the queue was full */
+    uint32_t preempted; /**< Playbacks interrupted by another request */
+    uint32_t wakeups; /**< Readable events served on client connections */
+    uint32_t frames; /**< Requests received on client connections */
+    uint32_t batch_peak; /**< Most requests served in one wakeup */
+    uint32_t accept_peak; /**< Most connections accepted in one wakeup */
+    uint32_t updates; /**< Update requests received */
+    uint32_t update_writes; /**< Updates written to the device */
+} vibrator_stats_t;
+
+/**
+ * @brief A playback or stop request recorded by the server
+ */
+typedef struct {
+    uint32_t time_ms; /**< Server time the request was executed or dropped */
+    uint32_t client; /**< Identifier of the connection the request arrived on */
+    uint32_t hash; /**< Hash of the request parameters */
+    uint32_t latency_us; /**< Microseconds the device took to execute it */
+    uint16_t wait_ms; /**< Milliseconds it waited in the device queue */
+    int16_t result; /**< Result of the request */
+    uint8_t type; /**< Request type */
+    uint8_t priority; /**< Scheduling priority */
+    uint8_t preempted_by; /**< Type of the request that interrupted it, 0 if none */
+} vibrator_history_t;
+
+/**
+ * @brief Internal state of the vibrator device and its playback engine
+ */
+typedef struct {
+    int32_t capabilities; /**< Capabilities of the device */
+    uint32_t busy_ms; /**< Milliseconds until the device is expected to be idle */
+    uint32_t active_client; /**< Connection of the active playback, 0 if none */
+    uint32_t active_token; /**< Token of the active playback */
+    int32_t timeline_length; /**< Steps of the active timeline */
+    int32_t timeline_repeat; /**< Step the timeline repeats from, -1 if none */
+    int32_t timeline_count; /**< Step the timeline is at */
+    int16_t effect_id; /**< Driver id of the uploaded effect, -1 if none */
+    uint16_t effect_type; /**< Force feedback type of the uploaded effect */
+    int16_t magnitude; /**< Magnitude written as the device gain */
+    int16_t brake_id; /**< Driver id of the brake effect, -1 if none */
+    int16_t slot_id[VIBRATOR_STATE_SLOTS]; /**< Driver ids of the waveform slots */
+    int16_t slot_step[VIBRATOR_STATE_SLOTS]; /**< Steps uploaded to the waveform slots */
+    uint8_t slot_next; /**< Slot the next step is uploaded to */
+    uint8_t amplitude; /**< Amplitude set with vibrator_set_amplitude() */
+    uint8_t intensity; /**< Intensity set with vibrator_set_intensity() */
+    uint8_t queue_count; /**< Requests waiting in the device queue */
+    uint8_t active_priority; /**< Priority of the active playback */
+    bool double_buffer; /**< Waveform steps are double-buffered */
+    bool driving; /**< The waveform engine is driving the device */
+    bool brake_armed; /**< A brake follows the active playback */
+    bool updatable; /**< The active playback accepts vibrator_session_update() */
+    bool timeline_region; /**< The timeline is played from a shared memory region */
+} vibrator_state_t;
+
+/**
+ * @brief Haptic usage of one application as accounted by the server
+ */
+typedef struct {
+    char tag[VIBRATOR_APP_TAG_MAX]; /**< Declared tag, or "pid <n>", "remote" or "-" */
+    uint32_t requests; /**< Requests received */
+    uint32_t errors; /**< Requests that failed */
+    uint32_t on_ms; /**< Milliseconds the actuator was driven */
+    uint32_t energy; /**< On-time weighted by amplitude, in milliseconds at full scale */
+} vibrator_app_stats_t;
+
+/**
+ * @brief One step of a waveform kept in a shared memory region
+ */
+typedef struct {
+    uint32_t timing; /**< Milliseconds of the step, 0 skips the step */
+    uint8_t amplitude; /**< Amplitude of the step, 0 means the motor is off */
+    uint8_t reserved[3]; /**< Must be zero */
+} vibrator_step_t;
+
 /****************************************************************************
  * @brief Public Function Prototypes
  ****************************************************************************/
@@ -117,12 +256,53 @@ int vibrator_play_interval(int32_t duration, int32_t interval,
  */
 int vibrator_play_oneshot(uint32_t timing, uint8_t amplitude);
 
+/**
+ * @brief Play a rumble vibration on a device with two motors.
+ *
+ * @details The strong and weak motors are driven with their own amplitude
+ *          by one effect. Requires CAP_RUMBLE.
+ *
+ * @param timing The number of milliseconds to vibrate. Must be positive.
+ * @param strong The amplitude of the strong motor, [0, 255].
+ * @param weak The amplitude of the weak motor, [0, 255].
+ * @return Returns the flag that the vibrator is playing the rumble.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_play_rumble(uint32_t timing, uint8_t strong, uint8_t weak);
+
+/**
+ * @brief Arm a predefined effect on a hardware trigger of the driver.
+ *
+ * @details The effect stays loaded in the driver, which plays it when the
+ *          trigger fires, for example a button press, without waking the
+ *          AP. Enabling an id that is armed replaces its effect. Requires
+ *          CAP_ALWAYS_ON_CONTROL.
+ *
+ * @param id The always-on id, [0, CONFIG_VIBRATOR_ALWAYS_ON).
+ * @param trigger The driver trigger, for example a button code.
+ * @param effect_id The ID of the predefined effect.
+ * @param es The vibration intensity.
+ * @return Returns the flag indicating whether the effect was armed.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_always_on_enable(uint8_t id, uint16_t trigger, uint8_t effect_id,
+    vibrator_effect_strength_e es);
+
+/**
+ * @brief Disarm the effect of an always-on id.
+ *
+ * @param id The always-on id, [0, CONFIG_VIBRATOR_ALWAYS_ON).
+ * @return Returns the flag indicating whether the effect was disarmed.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_always_on_disable(uint8_t id);
+
 /**
  * @brief Play a predefined vibration effect.
  *
  * @param effect_id The ID of the effect to perform.
  * @param es The vibration intensity.
- * @param play_length Returned effect play duration.
+ * @param play_length Returned effect play duration, 0 if the request was queued.
  * @return Returns the flag that the vibrator is playing the predefined effect.
  *         Greater than or equal to 0 means success; otherwise, it means failure.
  */
@@ -134,7 +314,7 @@ int vibrator_play_predefined(uint8_t effect_id, vibrator_effect_strength_e es,
  *
  * @param effect_id The ID of the effect to perform.
  * @param amplitude Vibration amplitude (0.0~1.0).
- * @param play_length Returned effect play duration.
+ * @param play_length Returned effect play duration, 0 if the request was queued.
  * @return Returns the flag that the vibrator is playing the predefined effect.
  *         Greater than or equal to 0 means success; otherwise, it means failure.
  */
@@ -162,6 +342,10 @@ int vibrator_set_intensity(vibrator_intensity_e intensity);
 /**
  * @brief Cancel the vibration.
  *
+ * @details The playing vibration is stopped and the requests of the caller
+ *          waiting on the device are dropped. Those queued by other
+ *          applications play next.
+ *
  * @return Returns the flag that the vibration is stopped.
  *         Greater than or equal to 0 means success; otherwise, it means failure.
  */
@@ -176,6 +360,21 @@ int vibrator_cancel(void);
  */
 int vibrator_start(int32_t timeoutms);
 
+/**
+ * @brief Start the vibrator with vibrate time and its own amplitude.
+ *
+ * @details The amplitude is carried by the request, the amplitude set with
+ *          vibrator_set_amplitude() is neither used nor changed. One request
+ *          is enough, and other clients cannot change the amplitude between
+ *          setting it and starting.
+ *
+ * @param timeoutms Number of milliseconds to vibrate.
+ * @param amplitude The amplitude of vibration, [0, 255], or VIBRATOR_AMPLITUDE_DEVICE.
+ * @return Returns the flag that the vibration has started.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_start_amplitude(uint32_t timeoutms, int16_t amplitude);
+
 /**
  * @brief Set vibration amplitude.
  *
@@ -194,6 +393,339 @@ int vibrator_set_amplitude(uint8_t amplitude);
  */
 int vibrator_get_capabilities(int32_t* capabilities);
 
+/**
+ * @brief Get the current load of the vibrator device.
+ *
+ * @param status Buffer that stores the device status.
+ * @return Returns the flag indicating success in getting vibrator status.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_get_status(vibrator_status_t* status);
+
+/**
+ * @brief Set how play requests behave when the server is saturated.
+ *
+ * @param policy The busy policy applied to subsequent requests of this process.
+ * @return Returns the flag indicating whether setting the policy was successful.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_busy_policy(vibrator_busy_policy_e policy);
+
+/**
+ * @brief Set the scheduling priority of play requests.
+ *
+ * @details A play request preempts the active playback if its priority is not
+ *          lower, otherwise it waits in the device queue.
+ *
+ * @param priority The priority applied to subsequent requests of this process.
+ * @return Returns the flag indicating whether setting the priority was successful.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_priority(vibrator_priority_e priority);
+
+/**
+ * @brief Set how long a queued play request may wait before it is dropped.
+ *
+ * @param deadline_ms Milliseconds a request may wait, 0 means no limit.
+ * @return Returns the flag indicating whether setting the deadline was successful.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_deadline(uint16_t deadline_ms);
+
+/**
+ * @brief Select the actuator that subsequent requests are sent to.
+ *
+ * @details Every actuator has a playback engine of its own. A request to
+ *          VIBRATOR_DEVICE_ALL is executed by all of them and its playbacks
+ *          start together, registered requests and regions belong to a
+ *          single actuator.
+ *
+ * @param device The index of the actuator, 0 by default, or VIBRATOR_DEVICE_ALL.
+ * @return Returns the flag indicating whether selecting the device was successful.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_device(uint8_t device);
+
+/**
+ * @brief Set the category of play requests.
+ *
+ * @details With the server policy enabled, a request whose category is
+ *          denied, or not allowed during do-not-disturb, fails with -EPERM.
+ *
+ * @param category The category applied to subsequent requests of this process.
+ * @return Returns the flag indicating whether setting the category was successful.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_category(vibrator_category_e category);
+
+/**
+ * @brief Get the scheduler statistics of the vibrator device.
+ *
+ * @param stats Buffer that stores the statistics.
+ * @return Returns the flag indicating success in getting vibrator statistics.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_get_stats(vibrator_stats_t* stats);
+
+/**
+ * @brief Get the requests last executed by the vibrator device.
+ *
+ * @details The server keeps the playback and stop requests of each device in
+ *          a ring of CONFIG_VIBRATOR_HISTORY records, including the ones that
+ *          were rejected or expired in the queue.
+ *
+ * @param history Buffer that stores the records, newest first.
+ * @param count The number of records the buffer holds.
+ * @return Returns the number of records stored.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_get_history(vibrator_history_t* history, int count);
+
+/**
+ * @brief Get the internal state of the vibrator device.
+ *
+ * @param state Buffer that stores the state.
+ * @return Returns the flag indicating success in getting the state.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_get_state(vibrator_state_t* state);
+
+/**
+ * @brief Declare the tag that the requests of this process are accounted to.
+ *
+ * @details Without a tag the server identifies a local client by its peer
+ *          credentials, and accounts all untagged remote clients together.
+ *
+ * @param tag The tag, at most VIBRATOR_APP_TAG_MAX - 1 characters, or NULL
+ *            to go back to the peer credentials.
+ * @return Returns the flag indicating whether the tag was declared.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_set_app_tag(const char* tag);
+
+/**
+ * @brief Get the haptic usage of the applications accounted by the server.
+ *
+ * @param apps Buffer that stores the counters of the applications.
+ * @param count The number of applications the buffer holds.
+ * @return Returns the number of applications stored.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_get_app_stats(vibrator_app_stats_t* apps, int count);
+
+/**
+ * @brief Reset the haptic usage counters of all applications.
+ *
+ * @return Returns the flag indicating whether the counters were reset.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_reset_app_stats(void);
+
+/**
+ * @brief Open a session, a connection to the server kept open across calls.
+ *
+ * @details Effects registered on a session and the playbacks started on it
+ *          are owned by the session, and the registered effects are released
+ *          when it is closed. A session must not be used by several threads
+ *          at the same time.
+ *
+ * @return Returns the session descriptor.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_open(void);
+
+/**
+ * @brief Close a session.
+ *
+ * @param session The session descriptor.
+ * @return Returns the flag indicating whether the session was closed.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_close(int session);
+
+/**
+ * @brief Register a waveform on a session.
+ *
+ * @param session The session descriptor.
+ * @param timings The pattern of alternating on-off timings, starting with off.
+ * @param amplitudes The amplitude values of the timing/amplitude pairs.
+ * @param repeat The index into the timings array at which to repeat, or -1 if
+ *               you don't want to repeat.
+ * @param length The length of timings and amplitudes pairs.
+ * @return Returns the handle of the registered waveform.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_register_waveform(int session, const uint32_t timings[],
+    const uint8_t amplitudes[], int8_t repeat, uint8_t length);
+
+/**
+ * @brief Register a predefined effect on a session.
+ *
+ * @param session The session descriptor.
+ * @param effect_id The ID of the effect.
+ * @param es The vibration intensity.
+ * @return Returns the handle of the registered effect.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_register_predefined(int session, uint8_t effect_id,
+    vibrator_effect_strength_e es);
+
+/**
+ * @brief Register a pattern prepared by vibrator::Pattern on a session.
+ *
+ * @details The pattern was validated when it was built and the client sends
+ *          it as-is. The server still checks that its repeated steps play,
+ *          and rejects a repeat index out of range instead of dropping it.
+ *
+ * @param session The session descriptor.
+ * @param pattern The wire form of the pattern.
+ * @param size The size of the wire form.
+ * @return Returns the handle of the registered pattern.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_register_pattern(int session, const void* pattern,
+    size_t size);
+
+/**
+ * @brief Unregister an effect of a session.
+ *
+ * @details The request is sent asynchronously, the server does not reply.
+ *
+ * @param session The session descriptor.
+ * @param handle The handle of the registered effect.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_unregister(int session, int handle);
+
+/**
+ * @brief Play a registered effect.
+ *
+ * @details The request is sent asynchronously, the server does not reply.
+ *
+ * @param session The session descriptor.
+ * @param handle The handle of the registered effect.
+ * @param token Returned playback token, may be NULL.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_play(int session, int handle, uint32_t* token);
+
+/**
+ * @brief Play a waveform on a session.
+ *
+ * @details The request is sent asynchronously, the server does not reply.
+ *
+ * @param session The session descriptor.
+ * @param timings The pattern of alternating on-off timings, starting with off.
+ * @param amplitudes The amplitude values of the timing/amplitude pairs.
+ * @param repeat The index into the timings array at which to repeat, or -1 if
+ *               you don't want to repeat.
+ * @param length The length of timings and amplitudes pairs.
+ * @param token Returned playback token, may be NULL.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_play_waveform(int session, const uint32_t timings[],
+    const uint8_t amplitudes[], int8_t repeat, uint8_t length,
+    uint32_t* token);
+
+/**
+ * @brief Play a pattern prepared by vibrator::Pattern on a session.
+ *
+ * @details The request is sent asynchronously, the server does not reply.
+ *
+ * @param session The session descriptor.
+ * @param pattern The wire form of the pattern.
+ * @param size The size of the wire form.
+ * @param token Returned playback token, may be NULL.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_play_pattern(int session, const void* pattern,
+    size_t size, uint32_t* token);
+
+/**
+ * @brief Cancel a playback of a session.
+ *
+ * @details The playback is stopped, or dropped from the device queue, only
+ *          while it is still the one started with the token; a playback
+ *          started afterwards is left untouched. The request is sent
+ *          asynchronously, the server does not reply.
+ *
+ * @param session The session descriptor.
+ * @param token The playback token.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_cancel(int session, uint32_t token);
+
+/**
+ * @brief Register a shared memory region with the server.
+ *
+ * @details The region is a POSIX shared memory object holding an array of
+ *          vibrator_step_t, created by the caller with shm_open(). The
+ *          server maps it read-only and plays from it in place, the steps
+ *          may be rewritten between playbacks. Its name starts with
+ *          VIBRATOR_REGION_PREFIX and holds no other '/', the server maps no
+ *          other object. Regions are only available on the core of the
+ *          server.
+ *
+ * @param session The session descriptor.
+ * @param name The name of the shared memory object.
+ * @param size The size of the object in bytes, a multiple of vibrator_step_t.
+ * @return Returns the handle of the region.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_register_region(int session, const char* name,
+    size_t size);
+
+/**
+ * @brief Release a shared memory region of a session.
+ *
+ * @details A playback from the region is stopped. The request is sent
+ *          asynchronously, the server does not reply.
+ *
+ * @param session The session descriptor.
+ * @param region The handle of the region.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_release_region(int session, int region);
+
+/**
+ * @brief Play steps of a shared memory region on a session.
+ *
+ * @details The request is sent asynchronously, the server does not reply.
+ *
+ * @param session The session descriptor.
+ * @param region The handle of the region.
+ * @param offset The index of the first step.
+ * @param length The number of steps, at most INT16_MAX.
+ * @param repeat The index into the steps at which to repeat, or -1.
+ * @param token Returned playback token, may be NULL.
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_play_region(int session, int region, uint32_t offset,
+    uint32_t length, int16_t repeat, uint32_t* token);
+
+/**
+ * @brief Change the amplitude of the playing vibration on a session.
+ *
+ * @details The effect started by vibrator_start_amplitude() or by an
+ *          interval vibration keeps playing and only its level is
+ *          rewritten, it can be called once per frame. Updates faster than
+ *          the device rate are coalesced on the server. The request is sent
+ *          asynchronously, the server does not reply.
+ *
+ * @param session The session descriptor.
+ * @param amplitude The amplitude of vibration, [0, 255].
+ * @return Returns the flag indicating whether the request was sent.
+ *         Greater than or equal to 0 means success; otherwise, it means failure.
+ */
+int vibrator_session_update(int session, uint8_t amplitude);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,697 @@
+/****************************************************************************
+ *
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+#ifndef __INCLUDE_VIBRATOR_API_HPP
+#define __INCLUDE_VIBRATOR_API_HPP
+
+/* vibrator::Pattern builds waveforms in relaxed constexpr functions */
+
+#if __cplusplus < 201402L
+#error "vibrator_api.hpp requires C++14 or later"
+#endif
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#define VIBRATOR_HAVE_STD_SPAN 1
+#endif
+#endif
+
+#include "vibrator_api.h"
+
+namespace vibrator {
+
+/****************************************************************************
+ * @brief Public Types
+ ****************************************************************************/
+
+#ifdef VIBRATOR_HAVE_STD_SPAN
+template <typename T>
+using span = std::span<T>;
+#else
+
+/**
+ * @brief Non-owning view of a contiguous array, for toolchains without
+ *        std::span
+ */
+template <typename T>
+class span {
+public:
+    constexpr span() noexcept
+        : data_(nullptr)
+        , size_(0)
+    {
+    }
+
+    constexpr span(T* data, std::size_t size) noexcept
+        : data_(data)
+        , size_(size)
+    {
+    }
+
+    template <std::size_t N>
+    constexpr span(T (&array)[N]) noexcept
+        : data_(array)
+        , size_(N)
+    {
+    }
+
+    template <typename C,
+        typename = typename std::enable_if<std::is_convertible<
+            decltype(std::declval<C&>().data()), T*>::value>::type>
+    constexpr span(C& container) noexcept
+        : data_(container.data())
+        , size_(container.size())
+    {
+    }
+
+    constexpr T* data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr T* begin() const noexcept { return data_; }
+    constexpr T* end() const noexcept { return data_ + size_; }
+
+private:
+    T* data_;
+    std::size_t size_;
+};
+#endif
+
+/**
+ * @brief One step of a pattern, amplitude 0 means the motor is off
+ */
+struct Step {
+    uint32_t timing; /**< Milliseconds of the step */
+    int amplitude; /**< Amplitude of the step, [0, 255] */
+};
+
+namespace detail {
+
+    /* not constexpr on purpose: reaching it while a constexpr Pattern is
+       built turns an invalid pattern into a compile error */
+
+    inline bool invalid_pattern(const char*) noexcept
+    {
+        return false;
+    }
+
+} // namespace detail
+
+/**
+ * @brief A waveform validated and merged when it is built.
+ *
+ * @details Declared constexpr, an invalid length, amplitude or repeat index
+ *          fails to compile. Adjacent steps of the same amplitude are merged
+ *          and steps of zero timing are dropped. The wire form is a constant
+ *          sent as-is, the server rejects it if its repeat index is out of
+ *          range.
+ *
+ * @code
+ *   static constexpr vibrator::Pattern click({ { 20, 255 }, { 30, 0 } });
+ * @endcode
+ */
+class Pattern {
+public:
+    /**
+     * @brief Wire form of a waveform, laid out as the server expects it.
+     */
+    struct Wire {
+        int8_t repeat;
+        uint8_t length;
+        int16_t count;
+        uint8_t amplitudes[VIBRATOR_WAVEFORM_MAX];
+        uint32_t timings[VIBRATOR_WAVEFORM_MAX];
+    };
+
+    /**
+     * @brief Build a pattern.
+     *
+     * @param steps The steps of the pattern.
+     * @param repeat The index into steps at which to repeat, or -1 if you
+     *               don't want to repeat.
+     */
+    template <std::size_t N>
+    constexpr Pattern(const Step (&steps)[N], int repeat = -1)
+        : wire_ {}
+        , valid_(false)
+    {
+        static_assert(N > 0, "pattern has no step");
+        static_assert(N <= VIBRATOR_WAVEFORM_MAX, "pattern has too many steps");
+
+        valid_ = build(steps, N, repeat);
+    }
+
+    constexpr bool valid() const noexcept { return valid_; }
+    constexpr uint8_t length() const noexcept { return wire_.length; }
+    constexpr int repeat() const noexcept { return wire_.repeat; }
+    constexpr uint32_t timing(std::size_t i) const { return wire_.timings[i]; }
+    constexpr uint8_t amplitude(std::size_t i) const { return wire_.amplitudes[i]; }
+    constexpr const Wire& wire() const noexcept { return wire_; }
+
+private:
+    constexpr bool build(const Step* steps, std::size_t count, int repeat)
+    {
+        bool pending = false;
+        bool audible = false;
+        uint8_t n = 0;
+
+        wire_.repeat = -1;
+        if (repeat < -1 || repeat >= static_cast<int>(count))
+            return detail::invalid_pattern("repeat index out of range");
+
+        for (std::size_t i = 0; i < count; i++) {
+            uint32_t timing = steps[i].timing;
+            int amplitude = steps[i].amplitude;
+
+            if (amplitude < 0 || amplitude > UINT8_MAX)
+                return detail::invalid_pattern("amplitude out of range");
+
+            /* a step of zero timing is dropped, the repeat moves to the
+               step after it */
+
+            pending |= static_cast<int>(i) == repeat;
+            if (timing == 0)
+                continue;
+
+            /* the server plays a step for at most 16 bits of ms */
+
+            if (!pending && n > 0 && wire_.amplitudes[n - 1] == amplitude
+                && wire_.timings[n - 1] + timing <= UINT16_MAX) {
+                wire_.timings[n - 1] += timing;
+            } else {
+                if (pending)
+                    wire_.repeat = static_cast<int8_t>(n);
+                wire_.amplitudes[n] = static_cast<uint8_t>(amplitude);
+                wire_.timings[n] = timing;
+                n++;
+            }
+
+            if (wire_.repeat >= 0 && amplitude > 0)
+                audible = true;
+
+            pending = false;
+        }
+
+        wire_.length = n;
+        if (n == 0)
+            return detail::invalid_pattern("pattern is empty");
+
+        if (repeat >= 0 && !audible)
+            return detail::invalid_pattern("repeated steps are silent");
+
+        return true;
+    }
+
+    Wire wire_;
+    bool valid_;
+};
+
+class Session;
+
+namespace detail {
+
+    /* links a handle into the list of its session. The session follows
+       its handles when it is moved and detaches them when it is closed, so
+       a handle that outlives its session never writes to a stale fd. */
+
+    class SessionLink {
+    protected:
+        SessionLink() noexcept = default;
+        SessionLink(const SessionLink&) = delete;
+        SessionLink& operator=(const SessionLink&) = delete;
+
+        void attach(Session* session) noexcept;
+        void detach() noexcept;
+        void take(SessionLink& other) noexcept;
+        int fd() const noexcept;
+        bool linked() const noexcept { return session_ != nullptr; }
+
+    private:
+        friend class vibrator::Session;
+
+        Session* session_ = nullptr;
+        SessionLink* prev_ = nullptr;
+        SessionLink* next_ = nullptr;
+    };
+
+} // namespace detail
+
+/**
+ * @brief An effect registered on a session, unregistered on destruction.
+ *
+ * @details Once the session is closed the server has released the effect,
+ *          and the handle becomes invalid without sending anything.
+ */
+class EffectHandle : private detail::SessionLink {
+public:
+    EffectHandle() noexcept = default;
+
+    EffectHandle(EffectHandle&& other) noexcept
+        : handle_(std::exchange(other.handle_, -1))
+    {
+        take(other);
+    }
+
+    EffectHandle& operator=(EffectHandle&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            take(other);
+            handle_ = std::exchange(other.handle_, -1);
+        }
+
+        return *this;
+    }
+
+    EffectHandle(const EffectHandle&) = delete;
+    EffectHandle& operator=(const EffectHandle&) = delete;
+
+    ~EffectHandle() { reset(); }
+
+    /**
+     * @brief Unregister the effect.
+     */
+    void reset() noexcept
+    {
+        if (valid())
+            vibrator_session_unregister(fd(), handle_);
+
+        detach();
+        handle_ = -1;
+    }
+
+    bool valid() const noexcept { return handle_ >= 0 && linked(); }
+    explicit operator bool() const noexcept { return valid(); }
+    int get() const noexcept { return valid() ? handle_ : -1; }
+
+private:
+    friend class Session;
+
+    EffectHandle(Session* session, int handle) noexcept
+        : handle_(handle)
+    {
+        attach(session);
+    }
+
+    int handle_ = -1;
+};
+
+/**
+ * @brief A playback started on a session, cancelled on destruction unless
+ *        it is released.
+ *
+ * @details Cancelling only stops the playback while it is still the one
+ *          started with this token. Once the session is closed the token
+ *          becomes invalid without sending anything.
+ */
+class PlaybackToken : private detail::SessionLink {
+public:
+    PlaybackToken() noexcept = default;
+
+    PlaybackToken(PlaybackToken&& other) noexcept
+        : token_(std::exchange(other.token_, 0))
+    {
+        take(other);
+    }
+
+    PlaybackToken& operator=(PlaybackToken&& other) noexcept
+    {
+        if (this != &other) {
+            cancel();
+            take(other);
+            token_ = std::exchange(other.token_, 0);
+        }
+
+        return *this;
+    }
+
+    PlaybackToken(const PlaybackToken&) = delete;
+    PlaybackToken& operator=(const PlaybackToken&) = delete;
+
+    ~PlaybackToken() { cancel(); }
+
+    /**
+     * @brief Cancel the playback if it is still current.
+     */
+    void cancel() noexcept
+    {
+        if (valid())
+            vibrator_session_cancel(fd(), token_);
+
+        release();
+    }
+
+    /**
+     * @brief Let the playback run to its end.
+     *
+     * @return Returns the token of the playback.
+     */
+    uint32_t release() noexcept
+    {
+        detach();
+        return std::exchange(token_, 0);
+    }
+
+    bool valid() const noexcept { return token_ != 0 && linked(); }
+    explicit operator bool() const noexcept { return valid(); }
+    uint32_t get() const noexcept { return token_; }
+
+private:
+    friend class Session;
+
+    uint32_t token_ = 0;
+};
+
+/**
+ * @brief A connection to the vibrator server kept open across calls.
+ *
+ * @details Playback requests are sent asynchronously without allocating,
+ *          the server does not reply to them. A session must not be used by
+ *          several threads at the same time.
+ */
+class Session {
+public:
+    Session() noexcept = default;
+
+    Session(Session&& other) noexcept
+        : session_(std::exchange(other.session_, -1))
+        , links_(std::exchange(other.links_, nullptr))
+    {
+        adopt();
+    }
+
+    Session& operator=(Session&& other) noexcept
+    {
+        if (this != &other) {
+            close();
+            session_ = std::exchange(other.session_, -1);
+            links_ = std::exchange(other.links_, nullptr);
+            adopt();
+        }
+
+        return *this;
+    }
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    ~Session() { close(); }
+
+    /**
+     * @brief Connect to the server.
+     *
+     * @return Returns 0 on success, or a negative errno.
+     */
+    int open() noexcept
+    {
+        int ret;
+
+        close();
+        ret = vibrator_session_open();
+        if (ret < 0)
+            return ret;
+
+        session_ = ret;
+        return 0;
+    }
+
+    /**
+     * @brief Close the connection, releasing its registered effects and
+     *        invalidating its handles and tokens.
+     */
+    void close() noexcept
+    {
+        while (links_ != nullptr)
+            links_->detach();
+
+        if (session_ >= 0)
+            vibrator_session_close(session_);
+
+        session_ = -1;
+    }
+
+    bool valid() const noexcept { return session_ >= 0; }
+    explicit operator bool() const noexcept { return valid(); }
+    int native_handle() const noexcept { return session_; }
+
+    /**
+     * @brief Register a waveform.
+     *
+     * @param effect Returned handle of the registered waveform.
+     * @param timings The pattern of alternating on-off timings, starting with off.
+     * @param amplitudes The amplitude values of the timing/amplitude pairs.
+     * @param repeat The index into the timings array at which to repeat, or -1.
+     * @return Returns 0 on success, or a negative errno.
+     */
+    int register_waveform(EffectHandle& effect, span<const uint32_t> timings,
+        span<const uint8_t> amplitudes, int8_t repeat = -1) noexcept
+    {
+        int ret;
+
+        if (timings.size() != amplitudes.size() || timings.size() > UINT8_MAX)
+            return -EINVAL;
+
+        ret = vibrator_session_register_waveform(session_, timings.data(),
+            amplitudes.data(), repeat, static_cast<uint8_t>(timings.size()));
+        if (ret < 0)
+            return ret;
+
+        effect = EffectHandle(this, ret);
+        return 0;
+    }
+
+    /**
+     * @brief Register a predefined effect.
+     *
+     * @param effect Returned handle of the registered effect.
+     * @param effect_id The ID of the effect.
+     * @param es The vibration intensity.
+     * @return Returns 0 on success, or a negative errno.
+     */
+    int register_predefined(EffectHandle& effect, uint8_t effect_id,
+        vibrator_effect_strength_e es = VIBRATION_DEFAULTES) noexcept
+    {
+        int ret;
+
+        ret = vibrator_session_register_predefined(session_, effect_id, es);
+        if (ret < 0)
+            return ret;
+
+        effect = EffectHandle(this, ret);
+        return 0;
+    }
+
+    /**
+     * @brief Register a pattern.
+     *
+     * @param effect Returned handle of the registered pattern.
+     * @param pattern The pattern.
+     * @return Returns 0 on success, or a negative errno.
+     */
+    int register_pattern(EffectHandle& effect, const Pattern& pattern) noexcept
+    {
+        int ret;
+
+        if (!pattern.valid())
+            return -EINVAL;
+
+        ret = vibrator_session_register_pattern(session_, &pattern.wire(),
+            sizeof(Pattern::Wire));
+        if (ret < 0)
+            return ret;
+
+        effect = EffectHandle(this, ret);
+        return 0;
+    }
+
+    /**
+     * @brief Play a registered effect.
+     *
+     * @param effect The registered effect.
+     * @param token Returned token of the playback.
+     * @return Returns 0 once the request is sent, or a negative errno.
+     */
+    int play(const EffectHandle& effect, PlaybackToken& token) noexcept
+    {
+        uint32_t id;
+        int ret;
+
+        if (!effect.valid() || effect.session_ != this)
+            return -EINVAL;
+
+        ret = vibrator_session_play(session_, effect.get(), &id);
+        if (ret < 0)
+            return ret;
+
+        return start(token, id);
+    }
+
+    /**
+     * @brief Play a waveform, the arrays are not retained.
+     *
+     * @param token Returned token of the playback.
+     * @param timings The pattern of alternating on-off timings, starting with off.
+     * @param amplitudes The amplitude values of the timing/amplitude pairs.
+     * @param repeat The index into the timings array at which to repeat, or -1.
+     * @return Returns 0 once the request is sent, or a negative errno.
+     */
+    int play_waveform(PlaybackToken& token, span<const uint32_t> timings,
+        span<const uint8_t> amplitudes, int8_t repeat = -1) noexcept
+    {
+        uint32_t id;
+        int ret;
+
+        if (timings.size() != amplitudes.size() || timings.size() > UINT8_MAX)
+            return -EINVAL;
+
+        ret = vibrator_session_play_waveform(session_, timings.data(),
+            amplitudes.data(), repeat, static_cast<uint8_t>(timings.size()),
+            &id);
+        if (ret < 0)
+            return ret;
+
+        return start(token, id);
+    }
+
+    /**
+     * @brief Play a pattern.
+     *
+     * @param token Returned token of the playback.
+     * @param pattern The pattern.
+     * @return Returns 0 once the request is sent, or a negative errno.
+     */
+    int play(PlaybackToken& token, const Pattern& pattern) noexcept
+    {
+        uint32_t id;
+        int ret;
+
+        if (!pattern.valid())
+            return -EINVAL;
+
+        ret = vibrator_session_play_pattern(session_, &pattern.wire(),
+            sizeof(Pattern::Wire), &id);
+        if (ret < 0)
+            return ret;
+
+        return start(token, id);
+    }
+
+    /**
+     * @brief Change the amplitude of the playing vibration.
+     *
+     * @param amplitude The amplitude of vibration, [0, 255].
+     * @return Returns 0 once the request is sent, or a negative errno.
+     */
+    int update(uint8_t amplitude) noexcept
+    {
+        return vibrator_session_update(session_, amplitude);
+    }
+
+private:
+    friend class detail::SessionLink;
+
+    int start(PlaybackToken& token, uint32_t id) noexcept
+    {
+        token.cancel();
+        token.attach(this);
+        token.token_ = id;
+        return 0;
+    }
+
+    /* the handles and tokens follow the session it was moved to */
+
+    void adopt() noexcept
+    {
+        for (detail::SessionLink* link = links_; link != nullptr;
+             link = link->next_)
+            link->session_ = this;
+    }
+
+    int session_ = -1;
+    detail::SessionLink* links_ = nullptr;
+};
+
+/****************************************************************************
+ * @brief Inline Functions
+ ****************************************************************************/
+
+inline void detail::SessionLink::attach(Session* session) noexcept
+{
+    detach();
+    session_ = session;
+    next_ = session->links_;
+    if (next_ != nullptr)
+        next_->prev_ = this;
+
+    session->links_ = this;
+}
+
+inline void detail::SessionLink::detach() noexcept
+{
+    if (session_ == nullptr)
+        return;
+
+    if (prev_ != nullptr)
+        prev_->next_ = next_;
+    else
+        session_->links_ = next_;
+
+    if (next_ != nullptr)
+        next_->prev_ = prev_;
+
+    session_ = nullptr;
+    prev_ = nullptr;
+    next_ = nullptr;
+}
+
+/* take the place of other in the list of its session */
+
+inline void detail::SessionLink::take(SessionLink& other) noexcept
+{
+    detach();
+    if (other.session_ == nullptr)
+        return;
+
+    session_ = other.session_;
+    prev_ = other.prev_;
+    next_ = other.next_;
+    if (prev_ != nullptr)
+        prev_->next_ = this;
+    else
+        session_->links_ = this;
+
+    if (next_ != nullptr)
+        next_->prev_ = this;
+
+    other.session_ = nullptr;
+    other.prev_ = nullptr;
+    other.next_ = nullptr;
+}
+
+inline int detail::SessionLink::fd() const noexcept
+{
+    return session_ != nullptr ? session_->native_handle() : -1;
+}
+
+} // namespace vibrator
+
+#endif /* #define __INCLUDE_VIBRATOR_API_HPP */
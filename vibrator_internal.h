@@ -35,9 +35,35 @@
  ****************************************************************************/
 
 #define PROP_SERVER_PATH "vibratord"
-#define WAVEFORM_MAXNUM 24
-#define VIBRATOR_MSG_HEADER 8
-#define VIBRATOR_MSG_RESULT 4
+#define PROP_DGRAM_PATH "vibratord.dgram"
+#define WAVEFORM_MAXNUM VIBRATOR_WAVEFORM_MAX
+#define VIBRATOR_MSG_HEADER 28
+#define VIBRATOR_MSG_RESULT VIBRATOR_MSG_HEADER
+#define VIBRATOR_MSG_VERSION 1
+#define VIBRATOR_HISTORY_PAGE 4
+#define VIBRATOR_APP_PAGE 3
+#define VIBRATOR_FNV_BASIS 2166136261u
+#define VIBRATOR_FNV_PRIME 16777619u
+
+/* Application keys, carried in vibrator_msg_t.app. A declared tag is
+   keyed by its hash with the top bit cleared, an undeclared client by its
+   peer credentials */
+
+#define VIBRATOR_APP_UNKNOWN 0
+#define VIBRATOR_APP_PID 0x80000000u
+#define VIBRATOR_APP_REMOTE 0xffffffffu
+
+/* Request flags, carried in vibrator_msg_t.flags */
+
+#define VIBRATOR_FLAG_COALESCE 0x01
+#define VIBRATOR_FLAG_NOREPLY 0x02
+#define VIBRATOR_FLAG_REGISTER 0x04
+#define VIBRATOR_FLAG_PREVALIDATED 0x08
+
+/* Reply status bits, carried in vibrator_msg_t.status */
+
+#define VIBRATOR_STATUS_BUSY 0x01
+#define VIBRATOR_STATUS_QUEUED 0x02
 
 #ifdef CONFIG_VIBRATOR_ERROR
 #ifdef CONFIG_ANDROID_BINDER
@@ -53,7 +79,7 @@
 #ifdef CONFIG_ANDROID_BINDER
 #define VIBRATORWARN(format, args...) SLOGW(format, ##args)
 #else
-#define VIBRATORWARN(format, args...) syslog(LOG_WARN, format "\n", ##args)
+#define VIBRATORWARN(format, args...) syslog(LOG_WARNING, format "\n", ##args)
 #endif
 #else
 #define VIBRATORWARN(format, args...)
@@ -73,20 +99,52 @@
  * Public Types
  ****************************************************************************/
 
+/* Vibrator operation table, shared by the client and the server:
+ * OP(type, request payload size, response payload size). The position in
+ * the table is the wire value of the type, new operations are appended.
+ */
+
+#define VIBRATOR_OPS(OP)                                                        \
+    OP(VIBRATION_WAVEFORM, sizeof(vibrator_waveform_t), 0)                      \
+    OP(VIBRATION_EFFECT, sizeof(vibrator_effect_t), sizeof(vibrator_effect_t))  \
+    OP(VIBRATION_COMPOSITION, 0, 0)                                             \
+    OP(VIBRATION_START, sizeof(uint32_t), 0)                                    \
+    OP(VIBRATION_STOP, 0, 0)                                                    \
+    OP(VIBRATION_PRIMITIVE, sizeof(vibrator_effect_t), sizeof(vibrator_effect_t)) \
+    OP(VIBRATION_INTERVAL, sizeof(vibrator_waveform_t), 0)                      \
+    OP(VIBRATION_SET_AMPLITUDE, sizeof(uint8_t), 0)                             \
+    OP(VIBRATION_GET_CAPABLITY, 0, sizeof(int32_t))                             \
+    OP(VIBRATION_SET_INTENSITY, sizeof(vibrator_intensity_e), 0)                \
+    OP(VIBRATION_GET_INTENSITY, 0, sizeof(int32_t))                             \
+    OP(VIBRATION_GET_STATUS, 0, 0)                                              \
+    OP(VIBRATION_GET_STATS, 0, sizeof(vibrator_stats_t))                        \
+    OP(VIBRATION_PLAY_HANDLE, sizeof(int32_t), 0)                               \
+    OP(VIBRATION_UNREGISTER, sizeof(int32_t), 0)                                \
+    OP(VIBRATION_CANCEL_TOKEN, 0, 0)                                            \
+    OP(VIBRATION_REGISTER_REGION, sizeof(vibrator_region_t), 0)                 \
+    OP(VIBRATION_RELEASE_REGION, sizeof(int32_t), 0)                            \
+    OP(VIBRATION_PLAY_REGION, sizeof(vibrator_region_play_t), 0)               \
+    OP(VIBRATION_START_AMPLITUDE, sizeof(vibrator_start_t), 0)                  \
+    OP(VIBRATION_UPDATE, sizeof(uint8_t), 0)                                    \
+    OP(VIBRATION_RUMBLE, sizeof(vibrator_rumble_t), 0)                          \
+    OP(VIBRATION_ALWAYS_ON_ENABLE, sizeof(vibrator_always_on_t), 0)             \
+    OP(VIBRATION_ALWAYS_ON_DISABLE, sizeof(uint8_t), 0)                         \
+    OP(VIBRATION_GET_HISTORY, sizeof(uint32_t), sizeof(vibrator_history_page_t)) \
+    OP(VIBRATION_GET_STATE, 0, sizeof(vibrator_state_t))                         \
+    OP(VIBRATION_APP_TAG, VIBRATOR_APP_TAG_MAX, 0)                              \
+    OP(VIBRATION_GET_APPS, sizeof(uint32_t), sizeof(vibrator_app_page_t))       \
+    OP(VIBRATION_RESET_APPS, 0, 0)
+
+#define VIBRATOR_OP_TYPE(type, request, response) type,
+#define VIBRATOR_OP_LEN(type, request, response) \
+    [type] = { VIBRATOR_MSG_HEADER + (request), VIBRATOR_MSG_RESULT + (response) },
+
 /* Vibrator operation types */
 
 enum {
-    VIBRATION_WAVEFORM = 1,
-    VIBRATION_EFFECT,
-    VIBRATION_COMPOSITION,
-    VIBRATION_START,
-    VIBRATION_STOP,
-    VIBRATION_PRIMITIVE,
-    VIBRATION_INTERVAL,
-    VIBRATION_SET_AMPLITUDE,
-    VIBRATION_GET_CAPABLITY,
-    VIBRATION_SET_INTENSITY,
-    VIBRATION_GET_INTENSITY
+    VIBRATION_NONE = 0,
+    VIBRATOR_OPS(VIBRATOR_OP_TYPE)
+    VIBRATION_OP_COUNT
 };
 
 /* struct vibrator_waveform_t
@@ -119,6 +177,91 @@ typedef struct {
     };
 } aligned_data(4) vibrator_effect_t;
 
+/* struct vibrator_start_t
+ * @timeoutms: the number of milliseconds to vibrate
+ * @amplitude: the amplitude of vibration, VIBRATOR_AMPLITUDE_DEVICE for the
+ *             amplitude set with VIBRATION_SET_AMPLITUDE
+ */
+
+typedef struct {
+    uint32_t timeoutms;
+    int16_t amplitude;
+} aligned_data(4) vibrator_start_t;
+
+/* struct vibrator_rumble_t
+ * @timeoutms: the number of milliseconds to vibrate
+ * @strong: the amplitude of the strong motor
+ * @weak: the amplitude of the weak motor
+ */
+
+typedef struct {
+    uint32_t timeoutms;
+    uint8_t strong;
+    uint8_t weak;
+} aligned_data(4) vibrator_rumble_t;
+
+/* struct vibrator_always_on_t
+ * @id: the always-on id, [0, CONFIG_VIBRATOR_ALWAYS_ON)
+ * @effect_id: the predefined effect to be armed
+ * @es: the strength of the effect
+ * @trigger: the driver trigger that plays the effect
+ */
+
+typedef struct {
+    uint8_t id;
+    uint8_t effect_id;
+    uint8_t es;
+    uint16_t trigger;
+} aligned_data(4) vibrator_always_on_t;
+
+/* struct vibrator_region_t
+ * @size: the size of the shared memory object in bytes
+ * @name: the name of the shared memory object
+ */
+
+typedef struct {
+    uint32_t size;
+    char name[VIBRATOR_REGION_NAME_MAX];
+} aligned_data(4) vibrator_region_t;
+
+/* struct vibrator_region_play_t
+ * @region: the handle of a registered region
+ * @offset: the index of the first step
+ * @length: the number of steps
+ * @repeat: the index into the steps at which to repeat, -1 for none
+ */
+
+typedef struct {
+    int32_t region;
+    uint32_t offset;
+    uint32_t length;
+    int16_t repeat;
+} aligned_data(4) vibrator_region_play_t;
+
+/* struct vibrator_history_page_t
+ * @start: the index of the first record, 0 is the newest
+ * @count: returned number of records in entries
+ * @entries: returned records from start on, newest first
+ */
+
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+    vibrator_history_t entries[VIBRATOR_HISTORY_PAGE];
+} aligned_data(4) vibrator_history_page_t;
+
+/* struct vibrator_app_page_t
+ * @start: the index of the first application
+ * @count: returned number of applications in entries
+ * @entries: returned counters of the applications from start on
+ */
+
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+    vibrator_app_stats_t entries[VIBRATOR_APP_PAGE];
+} aligned_data(4) vibrator_app_page_t;
+
 /* struct vibrator_msg_t
  * @type: vibrator of type
  * @effect: the vibrator_effect_t of above structure
@@ -128,6 +271,35 @@ typedef struct {
  * @timeoutms: the number of milliseconds to vibrate
  * @amplitude: the amplitude of vibration
  * @capabilities: the capabilities of vibrator
+ * @flags: request flags, VIBRATOR_FLAG_*. A request with
+ *         VIBRATOR_FLAG_NOREPLY is not answered, a playback request with
+ *         VIBRATOR_FLAG_REGISTER is stored and its handle is returned
+ * @status: reply status of the device, VIBRATOR_STATUS_*
+ * @depth: reply, number of requests outstanding on the device
+ * @retry_after: reply, milliseconds until the device is expected to be idle
+ * @priority: scheduling priority of a playback request
+ * @device: index of the actuator, VIBRATOR_DEVICE_ALL for a synchronized
+ *          request to every actuator
+ * @app: the application the request is accounted to, VIBRATOR_APP_UNKNOWN
+ *       to let the server identify it by the peer credentials
+ * @category: the vibrator_category_e of a playback request
+ * @version: the layout of the message, VIBRATOR_MSG_VERSION, a request of
+ *           another version is refused with -EPROTO
+ * @reserved: must be zero
+ * @deadline: milliseconds a queued playback request may wait, 0 for no limit
+ * @token: playback token chosen by a session, VIBRATION_CANCEL_TOKEN only
+ *         stops the playback started with the same token on that session
+ * @handle: the handle of a registered request
+ * @stats: the scheduler statistics of the device
+ * @start: the duration and amplitude of a constant vibration
+ * @region: the shared memory region to be registered
+ * @region_play: the steps of a registered region to be played
+ * @rumble: the duration and motor amplitudes of a rumble
+ * @always_on: the always-on effect to be armed or disarmed
+ * @history: the records of the device history to be read
+ * @state: the internal state of the device
+ * @app_tag: the tag an application declares for its key
+ * @apps: the counters of the applications to be read
  */
 
 typedef struct {
@@ -135,15 +307,73 @@ typedef struct {
     uint8_t type;
     uint8_t request_len;
     uint8_t response_len;
-    uint8_t padding;
+    uint8_t flags;
+    uint8_t status;
+    uint8_t depth;
+    uint16_t retry_after;
+    uint8_t priority;
+    uint8_t device;
+    uint16_t deadline;
+    uint32_t token;
+    uint32_t app;
+    uint8_t category;
+    uint8_t version;
+    uint8_t reserved[2];
     union {
         uint8_t intensity;
         uint8_t amplitude;
         uint32_t timeoutms;
         int32_t capabilities;
+        int32_t handle;
         vibrator_waveform_t wave;
         vibrator_effect_t effect;
+        vibrator_stats_t stats;
+        vibrator_start_t start;
+        vibrator_region_t region;
+        vibrator_region_play_t region_play;
+        vibrator_rumble_t rumble;
+        vibrator_always_on_t always_on;
+        vibrator_history_page_t history;
+        vibrator_state_t state;
+        char app_tag[VIBRATOR_APP_TAG_MAX];
+        vibrator_app_page_t apps;
     };
 } aligned_data(4) vibrator_msg_t;
 
+/* struct vibrator_op_len_t
+ * @request_len: length of the request, zero for an unknown type
+ * @response_len: length of the reply
+ */
+
+typedef struct {
+    uint8_t request_len;
+    uint8_t response_len;
+} vibrator_op_len_t;
+
+/****************************************************************************
+ * Public Data
+ ****************************************************************************/
+
+static const vibrator_op_len_t g_vibrator_op_len[VIBRATION_OP_COUNT] unused_data = {
+    VIBRATOR_OPS(VIBRATOR_OP_LEN)
+};
+
+/****************************************************************************
+ * Inline Functions
+ ****************************************************************************/
+
+/* the application key of a declared tag, shared by the client that
+   declares it and the server policy that names it */
+
+static inline uint32_t vibrator_app_key(const char* tag)
+{
+    uint32_t hash = VIBRATOR_FNV_BASIS;
+
+    for (; *tag != '\0'; tag++)
+        hash = (hash ^ (uint8_t)*tag) * VIBRATOR_FNV_PRIME;
+
+    hash &= ~VIBRATOR_APP_PID;
+    return hash != VIBRATOR_APP_UNKNOWN ? hash : 1;
+}
+
 #endif /* #define __INCLUDE_VIBRATOR_H */
@@ -18,20 +18,30 @@
  * Included Files
  ****************************************************************************/
 
+#include <assert.h>
 #include <fcntl.h>
 #include <kvdb.h>
+#include <limits.h>
 #include <mqueue.h>
 #include <netpacket/rpmsg.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #include <uv.h>
 
@@ -46,6 +56,10 @@
 #define VIBRATOR_LOCAL 0
 #define VIBRATOR_REMOTE 1
 #define VIBRATOR_COUNT 2
+#define VIBRATOR_DGRAM 2
+#define VIBRATOR_ENDPOINTS 3
+#define VIBRATOR_TRANSPORT(endpoint) \
+    ((endpoint) == VIBRATOR_DGRAM ? VIBRATOR_LOCAL : (endpoint))
 #define VIBRATOR_MAX_CLIENTS 16
 #define VIBRATOR_MAX_AMPLITUDE 255
 #define VIBRATOR_DEFAULT_AMPLITUDE -1
@@ -54,949 +68,6077 @@
 #define VIBRATOR_MEDIUM_MAGNITUDE 0x5fff
 #define VIBRATOR_LIGHT_MAGNITUDE 0x3fff
 #define VIBRATOR_CUSTOM_DATA_LEN 3
-#define VIBRATOR_DEV_FS "/dev/lra0"
+#define VIBRATOR_BUSY_FOREVER UINT64_MAX
+#define VIBRATOR_SLOT_NUM 2
+#define VIBRATOR_SHAPE_KICK 0x01
+#define VIBRATOR_SHAPE_BRAKE 0x02
+#define VIBRATOR_BRAKE_ZERO 0
+#define VIBRATOR_BRAKE_REVERSE 1
+#define VIBRATOR_OP_MAX 32
+#define VIBRATOR_OP_PLAYBACK 0x01
+#define VIBRATOR_OP_PREEMPT 0x02
+#define VIBRATOR_MOCK_EFFECTS 16
+#define VIBRATOR_MOCK_EFFECT_MS 30
+#define VIBRATOR_DEV_FS "/dev/lra"
 #define KVDB_KEY_VIBRATOR_MODE "persist.vibrator_mode"
 #define KVDB_KEY_VIBRATOR_ENABLE "persist.vibration_enable"
+#define KVDB_KEY_VIBRATOR_KICK_MS "persist.vibrator_kick_ms"
+#define KVDB_KEY_VIBRATOR_KICK_AMPLITUDE "persist.vibrator_kick_amplitude"
+#define KVDB_KEY_VIBRATOR_BRAKE_MS "persist.vibrator_brake_ms"
+#define KVDB_KEY_VIBRATOR_BRAKE_MODE "persist.vibrator_brake_mode"
+#define KVDB_KEY_VIBRATOR_BRAKE_AMPLITUDE "persist.vibrator_brake_amplitude"
+#define KVDB_KEY_VIBRATOR_CONFIG "persist.vibrator_config.*"
+#define KVDB_KEY_VIBRATOR_DEVICE "persist.vibrator_config.device"
+#define KVDB_KEY_VIBRATOR_LIGHT "persist.vibrator_config.light_magnitude"
+#define KVDB_KEY_VIBRATOR_MEDIUM "persist.vibrator_config.medium_magnitude"
+#define KVDB_KEY_VIBRATOR_STRONG "persist.vibrator_config.strong_magnitude"
+#define KVDB_KEY_VIBRATOR_SCALE_LOW "persist.vibrator_config.scale_low"
+#define KVDB_KEY_VIBRATOR_SCALE_MEDIUM "persist.vibrator_config.scale_medium"
+#define KVDB_KEY_VIBRATOR_SCALE_HIGH "persist.vibrator_config.scale_high"
+#define KVDB_KEY_VIBRATOR_MAX_MS "persist.vibrator_config.max_ms"
+#define KVDB_KEY_VIBRATOR_POLICY "persist.vibrator_policy.*"
+#define KVDB_KEY_VIBRATOR_POLICY_DND "persist.vibrator_policy.dnd"
+#define KVDB_KEY_VIBRATOR_POLICY_SCHEDULE "persist.vibrator_policy.schedule"
+#define KVDB_KEY_VIBRATOR_POLICY_ALLOW "persist.vibrator_policy.allow"
+#define KVDB_KEY_VIBRATOR_POLICY_DENY "persist.vibrator_policy.deny"
+#define KVDB_KEY_VIBRATOR_POLICY_APPS "persist.vibrator_policy.apps"
+#define VIBRATOR_POLICY_WINDOWS 4
+#define VIBRATOR_POLICY_ALLOW "alarm,accessibility"
+#define VIBRATOR_SCALE_LOW 30
+#define VIBRATOR_SCALE_MEDIUM 60
+#define VIBRATOR_SCALE_HIGH 100
+
+#ifdef CONFIG_VIBRATOR_BRAKE_REVERSE
+#define VIBRATOR_BRAKE_MODE VIBRATOR_BRAKE_REVERSE
+#else
+#define VIBRATOR_BRAKE_MODE VIBRATOR_BRAKE_ZERO
+#endif
 
 /****************************************************************************
  * Private Types
  ****************************************************************************/
 
+typedef struct {
+    uint16_t kick_ms;
+    uint8_t kick_amplitude;
+    uint8_t brake_mode;
+    uint16_t brake_ms;
+    uint8_t brake_amplitude;
+} vibrator_drive_t;
+
+/* loop is the loop of the engine that owns the device, its timers and its
+   clock */
+
 typedef struct {
     int fd;
+    uv_loop_t* loop;
     int16_t curr_app_id;
+    uint16_t curr_app_type;
+    bool curr_updatable;
+    struct ff_effect curr_effect;
+    uint8_t curr_rumble[2];
     int16_t curr_magnitude;
     uint8_t curr_amplitude;
     int32_t capabilities;
     vibrator_intensity_e intensity;
+    uint64_t busy_until;
+    bool double_buffer;
+    bool square;
+    bool rumble;
+    bool gain;
+    uint8_t slot_next;
+    int16_t slot_id[VIBRATOR_SLOT_NUM];
+    int16_t slot_step[VIBRATOR_SLOT_NUM];
+    bool driving;
+    bool brake_armed;
+    int16_t brake_id;
+    uint64_t brake_at;
+    vibrator_drive_t drive;
+#if CONFIG_VIBRATOR_ALWAYS_ON > 0
+    int16_t always_on_id[CONFIG_VIBRATOR_ALWAYS_ON];
+#endif
+#ifdef CONFIG_VIBRATOR_MOCK
+    uint32_t mock_effects;
+#endif
 } ff_dev_t;
 
+/* the owner of a request is the connection it arrived on, it is only
+   compared and never dereferenced. queued is the time it entered the
+   queue. */
+
+typedef struct {
+    vibrator_msg_t msg;
+    uint64_t deadline;
+    uint64_t queued;
+    void* owner;
+} vibrator_cmd_t;
+
+typedef struct {
+    vibrator_cmd_t cmds[CONFIG_VIBRATOR_QUEUE_DEPTH];
+    uint8_t count;
+    uint8_t active_priority;
+    void* active_owner;
+    uint32_t active_token;
+    uv_timer_t timer;
+    vibrator_stats_t stats;
+} vibrator_queue_t;
+
 typedef struct {
-    vibrator_waveform_t wave;
     vibrator_msg_t msg;
+    void* owner;
+} vibrator_registry_t;
+
+/* the timeline played by the waveform engine, its steps are read from the
+   loaded waveform, or in place from a shared memory region when steps is
+   set */
+
+typedef struct {
+    const vibrator_step_t* steps;
+    int32_t length;
+    int32_t repeat;
+    int32_t count;
+    uint32_t elapsed; /* ms played since the last pass of the repeat began */
+} vibrator_timeline_t;
+
+/* a shared memory region mapped read-only for its owner */
+
+typedef struct {
+    const vibrator_step_t* steps;
+    uint32_t count;
+    void* owner;
+} vibrator_shm_t;
+
+/* the newest level of vibrator_session_update() and the time it was last
+   written, updates in between are coalesced by the timer */
+
+typedef struct {
+    uv_timer_t timer;
+    uint64_t last;
+    uint8_t amplitude;
+} vibrator_update_t;
+
+/* the usage of an application on a device, energy is the sum of the
+   level driven times the milliseconds it was driven for */
+
+typedef struct {
+    bool used;
+    uint32_t key;
+    uint64_t energy;
+    vibrator_app_stats_t stats;
+} vibrator_app_t;
+
+/* the segment the device is being driven in, app drives it at level from
+   since until the segment is closed but no longer than until */
+
+typedef struct {
+    vibrator_app_t* app;
+    uint64_t since;
+    uint64_t until;
+    uint8_t level;
+} vibrator_meter_t;
+
+#ifdef CONFIG_VIBRATOR_THREADS
+/* a request handed from a transport thread to a device engine, a job
+   without msg releases the session of its owner. The jobs of a request to
+   VIBRATOR_DEVICE_ALL share a barrier that every engine waits on before
+   it executes its job. The transport waits on done until the engine has
+   executed the request and built the reply in place. */
+
+typedef struct vibrator_job_s {
+    _Atomic(struct vibrator_job_s*) next;
+    vibrator_msg_t* msg;
+    void* owner;
+    pthread_barrier_t* barrier;
+    sem_t done;
+} vibrator_job_t;
+
+/* intrusive multi-producer single-consumer queue of jobs. Producers only
+   exchange head, the engine alone walks from tail, and stub keeps the
+   queue from ever being empty. */
+
+typedef struct {
+    _Atomic(vibrator_job_t*) head;
+    vibrator_job_t* tail;
+    vibrator_job_t stub;
+    uv_async_t async;
+} vibrator_jobs_t;
+#endif
+
+/* wave holds the waveform loaded from a validated request, it is owned by
+   the playback engine of the device. With CONFIG_VIBRATOR_THREADS the
+   engines after the first run own_loop on a thread of their own. history
+   is a ring of the last playback and stop requests, history_seq counts
+   the records written and history_active is the count after the record
+   of the active playback, 0 if there is none. apps holds the usage of the
+   applications, app_active is the one whose playback was started last and
+   meter the segment it is driving. */
+
+typedef struct {
+    vibrator_waveform_t wave;
+    vibrator_timeline_t timeline;
     uv_timer_t timer;
     ff_dev_t* ff_dev;
+    vibrator_queue_t queue;
+    vibrator_update_t update;
+    vibrator_registry_t registry[CONFIG_VIBRATOR_REGISTRY_SIZE];
+#if CONFIG_VIBRATOR_REGIONS > 0
+    vibrator_shm_t regions[CONFIG_VIBRATOR_REGIONS];
+#endif
+#if CONFIG_VIBRATOR_HISTORY > 0
+    vibrator_history_t history[CONFIG_VIBRATOR_HISTORY];
+    uint32_t history_seq;
+    uint32_t history_active;
+#endif
+#if CONFIG_VIBRATOR_APPS > 0
+    vibrator_app_t apps[CONFIG_VIBRATOR_APPS];
+    vibrator_app_t* app_active;
+    vibrator_meter_t meter;
+#endif
+#ifdef CONFIG_VIBRATOR_THREADS
+    vibrator_jobs_t jobs;
+    uv_loop_t own_loop;
+    pthread_t thread;
+#endif
 } threadargs;
 
+/* a KVDB monitor, load is called whenever one of the keys it matches
+   changes */
+
+typedef struct {
+    uv_poll_t poll;
+    int fd;
+    void (*load)(void);
+} vibrator_monitor_t;
+
+/* the tunables loaded from KVDB and the tables derived from them.
+   strength holds the magnitude of each effect strength, scale maps an
+   amplitude through each intensity and magnitude maps it onto the range
+   from the light to the strong magnitude. max_ms caps a one-shot
+   vibration, 0 for no limit. */
+
+typedef struct {
+    int16_t strength[VIBRATION_STRONG + 1];
+    uint32_t max_ms;
+    uint8_t scale[VIBRATION_INTENSITY_HIGH + 1][VIBRATOR_MAX_AMPLITUDE + 1];
+    int16_t magnitude[VIBRATOR_MAX_AMPLITUDE + 1];
+} vibrator_config_t;
+
+#ifdef CONFIG_VIBRATOR_POLICY
+/* a do-not-disturb window in minutes of the local day, a window that ends
+   before it starts runs over midnight */
+
+typedef struct {
+    uint16_t start;
+    uint16_t end;
+} vibrator_window_t;
+
+/* an application the policy allows or denies whatever its category */
+
+typedef struct {
+    uint32_t key;
+    bool allow;
+} vibrator_override_t;
+
+/* the rules compiled from KVDB. allow is the mask of the categories that
+   pass do-not-disturb, deny the mask of those refused at all times. */
+
+typedef struct {
+    bool dnd;
+    uint8_t windows;
+    uint8_t overrides;
+    uint32_t allow;
+    uint32_t deny;
+    vibrator_window_t window[VIBRATOR_POLICY_WINDOWS];
+    vibrator_override_t override[CONFIG_VIBRATOR_POLICY_OVERRIDES];
+} vibrator_policy_t;
+#endif
+
+/* a transport serves the endpoints of one socket family. With
+   CONFIG_VIBRATOR_THREADS it runs a loop of its own on a thread of its
+   own, otherwise every transport shares the loop of the device engines.
+   msg only holds a request while another one that arrived behind it is
+   still in the receive buffer, group holds the copies of a request to
+   VIBRATOR_DEVICE_ALL for the devices after the first. The counters are
+   written by the transport alone and summed up by VIBRATION_GET_STATS. */
+
+typedef struct {
+    uv_loop_t* loop;
+    vibrator_msg_t msg;
+#if CONFIG_VIBRATOR_DEVICES > 1
+    vibrator_msg_t group[CONFIG_VIBRATOR_DEVICES - 1];
+#endif
+    uint32_t wakeups;
+    uint32_t frames;
+    uint32_t batch_peak;
+    uint32_t accept_peak;
+#ifdef CONFIG_VIBRATOR_THREADS
+    uv_loop_t own_loop;
+    pthread_t thread;
+#endif
+} vibrator_transport_t;
+
+/* thread_args points to the engines of all devices, indexed by the device
+   of a request. peer is the application key of the requests that carry
+   none, taken from the credentials of the client. */
+
 typedef struct vibrator_context_s {
     uv_poll_t poll_handle;
     uv_os_sock_t sock;
+    uint32_t peer;
     threadargs* thread_args;
+    vibrator_transport_t* transport;
+    vibrator_msg_t rx;
+    size_t rx_len;
 } vibrator_context_t;
 
+/* struct vibrator_op_t
+ * @validate: checks the request before it is queued or executed, optional
+ * @handle: executes the request
+ * @flags: VIBRATOR_OP_PLAYBACK if the request occupies the device and is
+ *         scheduled, VIBRATOR_OP_PREEMPT if it stops the active playback
+ */
+
+typedef int (*vibrator_op_validate_t)(threadargs* thread_args,
+    vibrator_msg_t* msg);
+typedef int (*vibrator_op_handle_t)(threadargs* thread_args,
+    vibrator_msg_t* msg, void* owner);
+
+typedef struct {
+    vibrator_op_validate_t validate;
+    vibrator_op_handle_t handle;
+    uint8_t flags;
+} vibrator_op_t;
+
+/****************************************************************************
+ * Private Function Prototypes
+ ****************************************************************************/
+
+static void queue_timer_cb(uv_timer_t* timer);
+static void vibrator_queue_dispatch(threadargs* thread_args);
+
+static int check_waveform(threadargs* thread_args, vibrator_msg_t* msg);
+static int check_interval(threadargs* thread_args, vibrator_msg_t* msg);
+static int check_effect(threadargs* thread_args, vibrator_msg_t* msg);
+static int check_primitive(threadargs* thread_args, vibrator_msg_t* msg);
+static int check_intensity(threadargs* thread_args, vibrator_msg_t* msg);
+static int check_start_amplitude(threadargs* thread_args,
+    vibrator_msg_t* msg);
+static int check_update(threadargs* thread_args, vibrator_msg_t* msg);
+static int check_rumble(threadargs* thread_args, vibrator_msg_t* msg);
+
+static int op_waveform(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_interval(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_effect(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_primitive(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_start(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_start_amplitude(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_stop(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_set_amplitude(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_get_capabilities(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_set_intensity(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_get_intensity(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_get_status(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_get_stats(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_get_state(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_update(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+static int op_rumble(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner);
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+/* descriptors of the operations, indexed by the request type. Features
+   add their operations with vibrator_register_op() */
+
+static vibrator_op_t g_vibrator_ops[VIBRATOR_OP_MAX] = {
+    [VIBRATION_WAVEFORM] = { check_waveform, op_waveform,
+        VIBRATOR_OP_PLAYBACK | VIBRATOR_OP_PREEMPT },
+    [VIBRATION_INTERVAL] = { check_interval, op_interval,
+        VIBRATOR_OP_PLAYBACK | VIBRATOR_OP_PREEMPT },
+    [VIBRATION_EFFECT] = { check_effect, op_effect,
+        VIBRATOR_OP_PLAYBACK | VIBRATOR_OP_PREEMPT },
+    [VIBRATION_PRIMITIVE] = { check_primitive, op_primitive,
+        VIBRATOR_OP_PLAYBACK | VIBRATOR_OP_PREEMPT },
+    [VIBRATION_START] = { NULL, op_start,
+        VIBRATOR_OP_PLAYBACK | VIBRATOR_OP_PREEMPT },
+    [VIBRATION_START_AMPLITUDE] = { check_start_amplitude, op_start_amplitude,
+        VIBRATOR_OP_PLAYBACK | VIBRATOR_OP_PREEMPT },
+    [VIBRATION_STOP] = { NULL, op_stop, VIBRATOR_OP_PREEMPT },
+    [VIBRATION_SET_AMPLITUDE] = { NULL, op_set_amplitude, 0 },
+    [VIBRATION_GET_CAPABLITY] = { NULL, op_get_capabilities, 0 },
+    [VIBRATION_SET_INTENSITY] = { check_intensity, op_set_intensity, 0 },
+    [VIBRATION_GET_INTENSITY] = { NULL, op_get_intensity, 0 },
+    [VIBRATION_GET_STATUS] = { NULL, op_get_status, 0 },
+    [VIBRATION_GET_STATS] = { NULL, op_get_stats, 0 },
+    [VIBRATION_GET_STATE] = { NULL, op_get_state, 0 },
+    [VIBRATION_UPDATE] = { check_update, op_update, 0 },
+    [VIBRATION_RUMBLE] = { check_rumble, op_rumble,
+        VIBRATOR_OP_PLAYBACK | VIBRATOR_OP_PREEMPT },
+};
+
+static vibrator_transport_t g_vibrator_transports[VIBRATOR_COUNT];
+
+/* the configuration and the policy are built into a staging table and
+   copied into the published one under a sequence counter, which is odd
+   while the copy is in progress. The engines read the published table
+   without a lock and read again when the counter moved meanwhile. */
+
+static vibrator_config_t g_vibrator_config;
+static vibrator_config_t g_vibrator_config_next;
+static atomic_uint g_vibrator_config_seq;
+static vibrator_monitor_t g_vibrator_config_monitor;
+
+#ifdef CONFIG_VIBRATOR_POLICY
+static vibrator_policy_t g_vibrator_policy;
+static vibrator_policy_t g_vibrator_policy_next;
+static atomic_uint g_vibrator_policy_seq;
+static vibrator_monitor_t g_vibrator_policy_monitor;
+
+/* the names of vibrator_category_e in the policy keys */
+
+static const char* const g_vibrator_categories[] = {
+    [VIBRATOR_CATEGORY_UNKNOWN] = "unknown",
+    [VIBRATOR_CATEGORY_ALARM] = "alarm",
+    [VIBRATOR_CATEGORY_RINGTONE] = "ringtone",
+    [VIBRATOR_CATEGORY_NOTIFICATION] = "notification",
+    [VIBRATOR_CATEGORY_COMMUNICATION] = "communication",
+    [VIBRATOR_CATEGORY_TOUCH] = "touch",
+    [VIBRATOR_CATEGORY_MEDIA] = "media",
+    [VIBRATOR_CATEGORY_ACCESSIBILITY] = "accessibility",
+};
+#endif
+
+/* the jobs of the requests to every device are pushed under the lock, so
+   that all engines see them in the same order and wait on their barriers
+   in the same order */
+
+#if defined(CONFIG_VIBRATOR_THREADS) && CONFIG_VIBRATOR_DEVICES > 1
+static pthread_mutex_t g_vibrator_group_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* with CONFIG_VIBRATOR_STATIC_ALLOC the connections come from a fixed
+   pool, a free context has no thread_args */
+
+#ifdef CONFIG_VIBRATOR_STATIC_ALLOC
+static vibrator_context_t g_vibrator_conns[CONFIG_VIBRATOR_CONNECTIONS];
+
+/* the threads run on stacks of the pool too, the calling thread runs the
+   engine of the first device */
+
+#ifdef CONFIG_VIBRATOR_THREADS
+#define VIBRATOR_STACK_WORDS(size) \
+    (((size) + sizeof(uint64_t) - 1) / sizeof(uint64_t))
+
+static pthread_mutex_t g_vibrator_conns_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t g_vibrator_transport_stacks[VIBRATOR_COUNT]
+    [VIBRATOR_STACK_WORDS(CONFIG_VIBRATOR_TRANSPORT_STACKSIZE)];
+
+#if CONFIG_VIBRATOR_DEVICES > 1
+static uint64_t g_vibrator_engine_stacks[CONFIG_VIBRATOR_DEVICES - 1]
+    [VIBRATOR_STACK_WORDS(CONFIG_VIBRATOR_ENGINE_STACKSIZE)];
+#define VIBRATOR_STACKS_SIZE (sizeof(g_vibrator_transport_stacks) \
+    + sizeof(g_vibrator_engine_stacks))
+#else
+#define VIBRATOR_STACKS_SIZE sizeof(g_vibrator_transport_stacks)
+#endif
+#else
+#define VIBRATOR_STACKS_SIZE 0
+#endif
+
+#ifdef CONFIG_VIBRATOR_POLICY
+#define VIBRATOR_POLICY_SIZE (sizeof(g_vibrator_policy) \
+    + sizeof(g_vibrator_policy_next))
+#else
+#define VIBRATOR_POLICY_SIZE 0
+#endif
+
+#define VIBRATOR_STATIC_SIZE ((sizeof(ff_dev_t) + sizeof(threadargs)) \
+    * CONFIG_VIBRATOR_DEVICES \
+    + sizeof(vibrator_context_t) * (VIBRATOR_ENDPOINTS + CONFIG_VIBRATOR_CONNECTIONS) \
+    + sizeof(g_vibrator_transports) + sizeof(g_vibrator_ops) \
+    + sizeof(g_vibrator_config) + sizeof(g_vibrator_config_next) \
+    + VIBRATOR_POLICY_SIZE + VIBRATOR_STACKS_SIZE)
+
+#if CONFIG_VIBRATOR_STATIC_BUDGET > 0
+static_assert(VIBRATOR_STATIC_SIZE <= CONFIG_VIBRATOR_STATIC_BUDGET,
+    "vibratord static memory exceeds CONFIG_VIBRATOR_STATIC_BUDGET");
+#endif
+#endif
+
 /****************************************************************************
  * Private Functions
  ****************************************************************************/
 
+#ifdef CONFIG_VIBRATOR_MOCK
+
 /****************************************************************************
- * Name: ff_play()
+ * Name: mock_timestamp()
  *
  * Description:
- *    operate the driver's interface, vibrator device control
- *
- * Input Parameters:
- *   ff_dev - structure for operating the ff device driver
- *   effect_id - ID of the predefined effect will be played. If effectId is
- *               valid(non-negative value), the timeout_ms value will be
- *               ignored, and the real playing length will be set in
- *               playLengtMs and returned to VibratorService. If effectId is
- *               invalid, value in param timeout_ms will be used as the play
- *               length for playing a constant effect.
- *   timeout_ms - playing length, non-zero means playing, zero means stop
- *                playing.
- *   play_length_ms - the playing length in ms unit which will be returned to
- *                    VibratorService if the request is playing a predefined
- *                    effect.
+ *   get the monotonic time stamp of a command log record
  *
  * Returned Value:
- *   return the ret of file system operations
+ *   the monotonic time in ms
  *
  ****************************************************************************/
 
-static int ff_play(ff_dev_t* ff_dev, int effect_id, uint32_t timeout_ms,
-    long* play_length_ms)
+static uint64_t mock_timestamp(void)
 {
-    int16_t data[VIBRATOR_CUSTOM_DATA_LEN] = { 0, 0, 0 };
-    struct ff_effect effect;
-    struct ff_event_s play;
-    int ret;
-
-    memset(&play, 0, sizeof(play));
-    if (timeout_ms != 0) {
-
-        /* if curr_app_id is valid, then remove the effect from the device
-           first */
-
-        if (ff_dev->curr_app_id != VIBRATOR_INVALID_VALUE) {
-            ret = ioctl(ff_dev->fd, EVIOCRMFF, ff_dev->curr_app_id);
-            if (ret < 0) {
-                VIBRATORERR("ioctl EVIOCRMFF failed, errno = %d", errno);
-                goto errout;
-            }
-            ff_dev->curr_app_id = VIBRATOR_INVALID_VALUE;
-        }
-
-        /* if effect_id is valid, then upload the predefined effect with
-           effect_id, else upload a constant effect with timeout_ms */
-
-        memset(&effect, 0, sizeof(effect));
-        if (effect_id != VIBRATOR_INVALID_VALUE) {
-            data[0] = effect_id;
-            effect.type = FF_PERIODIC;
-            effect.u.periodic.waveform = FF_CUSTOM;
-            effect.u.periodic.magnitude = ff_dev->curr_magnitude;
-            effect.u.periodic.custom_data = data;
-            effect.u.periodic.custom_len = sizeof(int16_t) * VIBRATOR_CUSTOM_DATA_LEN;
-        } else {
-            effect.type = FF_CONSTANT;
-            effect.u.constant.level = ff_dev->curr_magnitude;
-            effect.replay.length = timeout_ms;
-        }
-
-        effect.id = ff_dev->curr_app_id;
-        effect.replay.delay = 0;
-
-        ret = ioctl(ff_dev->fd, EVIOCSFF, &effect);
-        if (ret < 0) {
-            VIBRATORERR("ioctl EVIOCSFF failed, errno = %d", errno);
-            goto errout;
-        }
-
-        /* update the curr_app_id with the ID obtained from device driver */
+    struct timespec ts;
 
-        ff_dev->curr_app_id = effect.id;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-        /* return the effect play length to vibrator service */
+/****************************************************************************
+ * Name: mock_upload()
+ *
+ * Description:
+ *   emulate EVIOCSFF, allocate an effect id and log the effect parameters
+ *   in the format read by vibrator_sim:
+ *   <ms> upload <id> <type> <level> <length> <delay> <attack_length>
+ *   <attack_level> <fade_length> <fade_level> <period> <offset>
+ *   A rumble effect logs its strong and weak magnitudes, halved to the
+ *   range of the other levels, as <level> and <offset>.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   effect - the effect to be uploaded
+ *
+ * Returned Value:
+ *   0 means success, otherwise it means failure
+ *
+ ****************************************************************************/
 
-        if (effect_id != VIBRATOR_INVALID_VALUE && play_length_ms != NULL) {
-            *play_length_ms = data[1] * 1000 + data[2];
-            VIBRATORINFO("*play_length_ms = %ld", *play_length_ms);
+static int mock_upload(ff_dev_t* ff_dev, struct ff_effect* effect)
+{
+    const struct ff_envelope* envelope = NULL;
+    const char* type = "periodic";
+    uint16_t length = effect->replay.length;
+    uint16_t period = 0;
+    int16_t offset = 0;
+    int16_t level = 0;
+    int id;
+
+    if (effect->id == VIBRATOR_INVALID_VALUE) {
+        for (id = 0; id < VIBRATOR_MOCK_EFFECTS; id++) {
+            if (!(ff_dev->mock_effects & (1u << id)))
+                break;
         }
 
-        if (ff_dev->curr_app_id == VIBRATOR_INVALID_VALUE)
-            return ret;
-
-        /* write the play event to vibrator device */
-
-        play.value = 1;
-        play.code = ff_dev->curr_app_id;
-        ret = write(ff_dev->fd, (const void*)&play, sizeof(play));
-        if (ret < 0) {
-            VIBRATORERR("write failed, errno = %d", errno);
-            ret = ioctl(ff_dev->fd, EVIOCRMFF, ff_dev->curr_app_id);
-            if (ret < 0)
-                VIBRATORERR("ioctl EVIOCRMFF failed, errno = %d", errno);
-            goto errout;
+        if (id == VIBRATOR_MOCK_EFFECTS) {
+            errno = ENOSPC;
+            return -1;
         }
-    } else if (ff_dev->curr_app_id != VIBRATOR_INVALID_VALUE) {
 
-        /* stop vibration if timeout_ms is zero and curr_app_id is valid */
+        ff_dev->mock_effects |= 1u << id;
+        effect->id = id;
+    }
 
-        ret = ioctl(ff_dev->fd, EVIOCRMFF, ff_dev->curr_app_id);
-        if (ret < 0) {
-            VIBRATORERR("ioctl EVIOCRMFF failed, errno = %d", errno);
-            goto errout;
+    switch (effect->type) {
+    case FF_CONSTANT:
+        type = "constant";
+        level = effect->u.constant.level;
+        envelope = &effect->u.constant.envelope;
+        break;
+    case FF_RUMBLE:
+        type = "rumble";
+        level = effect->u.rumble.strong_magnitude >> 1;
+        offset = effect->u.rumble.weak_magnitude >> 1;
+        break;
+    case FF_PERIODIC:
+        level = effect->u.periodic.magnitude;
+        period = effect->u.periodic.period;
+        offset = effect->u.periodic.offset;
+        envelope = &effect->u.periodic.envelope;
+        if (effect->u.periodic.waveform == FF_SQUARE) {
+            type = "square";
+        } else if (effect->u.periodic.waveform == FF_CUSTOM) {
+
+            /* predefined effects report a fixed play length */
+
+            type = "custom";
+            length = VIBRATOR_MOCK_EFFECT_MS;
+            effect->u.periodic.custom_data[1] = 0;
+            effect->u.periodic.custom_data[2] = VIBRATOR_MOCK_EFFECT_MS;
         }
-        ff_dev->curr_app_id = VIBRATOR_INVALID_VALUE;
+        break;
+    default:
+        break;
     }
-    return 0;
 
-errout:
-    ff_dev->curr_app_id = VIBRATOR_INVALID_VALUE;
-    return ret;
+    dprintf(ff_dev->fd, "%" PRIu64 " upload %d %s %d %u %u %u %u %u %u %u %d\n",
+        mock_timestamp(), effect->id, type, level, length, effect->replay.delay,
+        envelope ? envelope->attack_length : 0,
+        envelope ? envelope->attack_level : 0,
+        envelope ? envelope->fade_length : 0,
+        envelope ? envelope->fade_level : 0, period, offset);
+    return OK;
 }
 
 /****************************************************************************
- * Name: ff_set_amplitude()
+ * Name: mock_ioctl()
  *
  * Description:
- *   operate the driver's interface, set gain to vibrator device
+ *   emulate the ioctl interface of a force feedback device
  *
  * Input Parameters:
  *   ff_dev - structure for operating the ff device driver
- *   amplitude - vibration instensity, range[0,255]
+ *   req - the ioctl command
+ *   arg - the ioctl argument
  *
  * Returned Value:
- *   return the ret of write
+ *   0 means success, otherwise it means failure
  *
  ****************************************************************************/
 
-static int ff_set_amplitude(ff_dev_t* ff_dev, uint8_t amplitude)
+static int mock_ioctl(ff_dev_t* ff_dev, int req, unsigned long arg)
 {
-    struct ff_event_s gain;
-    int tmp;
-    int ret;
-
-    memset(&gain, 0, sizeof(gain));
-
-    tmp = amplitude * (VIBRATOR_STRONG_MAGNITUDE - VIBRATOR_LIGHT_MAGNITUDE) / 255;
-    tmp += VIBRATOR_LIGHT_MAGNITUDE;
-
-    gain.code = FF_GAIN;
-    gain.value = tmp;
+    unsigned char* ffbitmask;
+    int id;
+
+    switch (req) {
+    case EVIOCGBIT:
+        ffbitmask = (unsigned char*)arg;
+        ffbitmask[FF_CONSTANT / 8] |= 1 << (FF_CONSTANT % 8);
+        ffbitmask[FF_PERIODIC / 8] |= 1 << (FF_PERIODIC % 8);
+        ffbitmask[FF_SQUARE / 8] |= 1 << (FF_SQUARE % 8);
+        ffbitmask[FF_RUMBLE / 8] |= 1 << (FF_RUMBLE % 8);
+        ffbitmask[FF_CUSTOM / 8] |= 1 << (FF_CUSTOM % 8);
+        ffbitmask[FF_GAIN / 8] |= 1 << (FF_GAIN % 8);
+        return OK;
+    case EVIOCGEFFECTS:
+        *(int*)arg = VIBRATOR_MOCK_EFFECTS;
+        return OK;
+    case EVIOCSFF:
+        return mock_upload(ff_dev, (struct ff_effect*)arg);
+    case EVIOCRMFF:
+        id = (int)arg;
+        if (id < 0 || id >= VIBRATOR_MOCK_EFFECTS) {
+            errno = EINVAL;
+            return -1;
+        }
 
-    ret = write(ff_dev->fd, &gain, sizeof(gain));
-    if (ret < 0) {
-        VIBRATORERR("write FF_GAIN failed, errno = %d", errno);
-        return ret;
+        ff_dev->mock_effects &= ~(1u << id);
+        dprintf(ff_dev->fd, "%" PRIu64 " remove %d\n", mock_timestamp(), id);
+        return OK;
+    default:
+        errno = ENOTTY;
+        return -1;
     }
-
-    ff_dev->curr_magnitude = tmp;
-
-    return ret;
 }
 
 /****************************************************************************
- * Name: play_effect()
+ * Name: mock_write()
  *
  * Description:
- *    play the predefined effect.
+ *   emulate the play and gain events of a force feedback device
  *
  * Input Parameters:
  *   ff_dev - structure for operating the ff device driver
- *   effect_id - ID of the predefined effect will be played.
- *   es - effect intensity.
- *   play_length_ms - the playing length in ms unit which will be returned to
- *                    VibratorService if the request is playing a predefined
- *                    effect.
+ *   event - the event to be written
  *
  * Returned Value:
- *   return the ret of ff_play
+ *   the size of the event
  *
  ****************************************************************************/
 
-static int play_effect(ff_dev_t* ff_dev, int effect_id,
-    vibrator_effect_strength_e es, long* play_length_ms)
+static int mock_write(ff_dev_t* ff_dev, const struct ff_event_s* event)
 {
-    switch (es) {
-    case VIBRATION_LIGHT: {
-        ff_dev->curr_magnitude = VIBRATOR_LIGHT_MAGNITUDE;
-        break;
-    }
-    case VIBRATION_MEDIUM: {
-        ff_dev->curr_magnitude = VIBRATOR_MEDIUM_MAGNITUDE;
-        break;
-    }
-    case VIBRATION_STRONG: {
-        ff_dev->curr_magnitude = VIBRATOR_STRONG_MAGNITUDE;
-        break;
-    }
-    default: {
-        break;
-    }
+    if (event->code == FF_GAIN) {
+        dprintf(ff_dev->fd, "%" PRIu64 " gain %d\n", mock_timestamp(),
+            event->value);
+    } else {
+        dprintf(ff_dev->fd, "%" PRIu64 " play %" PRIu32 " %d\n",
+            mock_timestamp(), (uint32_t)event->code, event->value);
     }
 
-    return ff_play(ff_dev, effect_id, VIBRATOR_INVALID_VALUE,
-        play_length_ms);
+    return sizeof(*event);
 }
 
+#endif /* CONFIG_VIBRATOR_MOCK */
+
 /****************************************************************************
- * Name: play_primitive()
+ * Name: ff_ioctl()
  *
  * Description:
- *    play the predefined effect with the specified amplitude.
+ *   issue an ioctl to the vibrator device, or to the mock backend
  *
  * Input Parameters:
  *   ff_dev - structure for operating the ff device driver
- *   effect_id - ID of the predefined effect will be played.
- *   amplitude - effect amplitude(0-1.0).
- *   play_length_ms - the playing length in ms unit which will be returned to
- *                    VibratorService if the request is playing a predefined
- *                    effect.
+ *   req - the ioctl command
+ *   arg - the ioctl argument
  *
  * Returned Value:
- *   return the ret of ff_play
+ *   return the ret of ioctl
  *
  ****************************************************************************/
 
-static int play_primitive(ff_dev_t* ff_dev, int effect_id,
-    float amplitude, long* play_length_ms)
+static int ff_ioctl(ff_dev_t* ff_dev, int req, unsigned long arg)
 {
-    int tmp;
-
-    tmp = (uint8_t)(amplitude * VIBRATOR_MAX_AMPLITUDE);
-    ff_dev->curr_magnitude = tmp * (VIBRATOR_STRONG_MAGNITUDE - VIBRATOR_LIGHT_MAGNITUDE) / 255;
-    ff_dev->curr_magnitude += VIBRATOR_LIGHT_MAGNITUDE;
-
-    return ff_play(ff_dev, effect_id, VIBRATOR_INVALID_VALUE,
-        play_length_ms);
+#ifdef CONFIG_VIBRATOR_MOCK
+    return mock_ioctl(ff_dev, req, arg);
+#else
+    return ioctl(ff_dev->fd, req, arg);
+#endif
 }
 
 /****************************************************************************
- * Name: on()
+ * Name: ff_write()
  *
  * Description:
- *    turn on vibrator.
+ *   write a play or gain event to the vibrator device, or to the mock backend
  *
  * Input Parameters:
  *   ff_dev - structure for operating the ff device driver
- *   timeout_ms - number of milliseconds to vibrate
+ *   event - the event to be written
  *
  * Returned Value:
- *   return the ret of ff_play
+ *   return the ret of write
  *
  ****************************************************************************/
 
-static int on(ff_dev_t* ff_dev, uint32_t timeout_ms)
+static int ff_write(ff_dev_t* ff_dev, const struct ff_event_s* event)
 {
-    return ff_play(ff_dev, VIBRATOR_INVALID_VALUE, timeout_ms, NULL);
+#ifdef CONFIG_VIBRATOR_MOCK
+    return mock_write(ff_dev, event);
+#else
+    return write(ff_dev->fd, event, sizeof(*event));
+#endif
 }
 
 /****************************************************************************
- * Name: off()
+ * Name: vibrator_monitor_cb()
  *
  * Description:
- *    turn off vibrator.
+ *   load the keys of a monitor again when one of them changed
  *
- * Input Parameters:
- *   ff_dev - structure for operating the ff device driver
+ ****************************************************************************/
+
+static void vibrator_monitor_cb(uv_poll_t* handle, int status, int events)
+{
+    vibrator_monitor_t* monitor = handle->data;
+    char key[PROP_NAME_MAX];
+    char value[PROP_VALUE_MAX];
+
+    if (property_monitor_read(monitor->fd, key, value, sizeof(value)) < 0)
+        return;
+
+    VIBRATORINFO("key %s changed", key);
+    monitor->load();
+}
+
+/****************************************************************************
+ * Name: vibrator_monitor_start()
  *
- * Returned Value:
- *   return the ret of ff_play
+ * Description:
+ *   watch the KVDB keys matching a pattern, without the monitor they are
+ *   only loaded at start
+ *
+ * Input Parameters:
+ *   loop - the loop that loads the keys again
+ *   monitor - the monitor to be started
+ *   key - the pattern of the keys
+ *   load - called whenever one of the keys changes
  *
  ****************************************************************************/
 
-static int off(ff_dev_t* ff_dev)
+static void vibrator_monitor_start(uv_loop_t* loop,
+    vibrator_monitor_t* monitor, const char* key, void (*load)(void))
 {
-    return ff_play(ff_dev, VIBRATOR_INVALID_VALUE, 0, NULL);
+    monitor->load = load;
+    monitor->fd = property_monitor_open(key);
+    if (monitor->fd < 0) {
+        VIBRATORWARN("monitor of %s unavailable: %d", key, monitor->fd);
+        return;
+    }
+
+    monitor->poll.data = monitor;
+    if (uv_poll_init(loop, &monitor->poll, monitor->fd) < 0
+        || uv_poll_start(&monitor->poll, UV_READABLE,
+               vibrator_monitor_cb) < 0) {
+        VIBRATORWARN("monitor of %s poll failed", key);
+        property_monitor_close(monitor->fd);
+        monitor->fd = -1;
+    }
+}
+
+/****************************************************************************
+ * Name: vibrator_seq_begin()
+ *
+ * Description:
+ *   start reading a table published under a sequence counter, waiting for
+ *   a copy in progress to complete
+ *
+ * Input Parameters:
+ *   seq - the sequence counter of the table
+ *
+ * Returned Value:
+ *   the value of the counter, passed to vibrator_seq_retry()
+ *
+ ****************************************************************************/
+
+static unsigned int vibrator_seq_begin(atomic_uint* seq)
+{
+    unsigned int start;
+
+    while ((start = atomic_load_explicit(seq, memory_order_acquire)) & 1)
+        sched_yield();
+
+    return start;
+}
+
+/****************************************************************************
+ * Name: vibrator_seq_retry()
+ *
+ * Description:
+ *   tell whether the table was copied while it was read, the values read
+ *   are then discarded and read again
+ *
+ * Input Parameters:
+ *   seq - the sequence counter of the table
+ *   start - the value returned by vibrator_seq_begin()
+ *
+ * Returned Value:
+ *   true if the table must be read again
+ *
+ ****************************************************************************/
+
+static bool vibrator_seq_retry(atomic_uint* seq, unsigned int start)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(seq, memory_order_relaxed) != start;
+}
+
+/****************************************************************************
+ * Name: vibrator_seq_publish()
+ *
+ * Description:
+ *   copy a staging table into the published one, only called from the
+ *   loop that monitors the keys
+ *
+ * Input Parameters:
+ *   seq - the sequence counter of the table
+ *   dest - the published table
+ *   src - the staging table
+ *   size - the size of the table
+ *
+ ****************************************************************************/
+
+static void vibrator_seq_publish(atomic_uint* seq, void* dest,
+    const void* src, size_t size)
+{
+    atomic_fetch_add_explicit(seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(dest, src, size);
+    atomic_fetch_add_explicit(seq, 1, memory_order_release);
+}
+
+/****************************************************************************
+ * Name: vibrator_config_strength()
+ *
+ * Description:
+ *   get the magnitude of an effect strength from the configuration
+ *
+ * Input Parameters:
+ *   es - the effect strength
+ *
+ * Returned Value:
+ *   the magnitude
+ *
+ ****************************************************************************/
+
+static int16_t vibrator_config_strength(vibrator_effect_strength_e es)
+{
+    unsigned int start;
+    int16_t strength;
+
+    do {
+        start = vibrator_seq_begin(&g_vibrator_config_seq);
+        strength = g_vibrator_config.strength[es];
+    } while (vibrator_seq_retry(&g_vibrator_config_seq, start));
+
+    return strength;
+}
+
+/****************************************************************************
+ * Name: vibrator_config_load()
+ *
+ * Description:
+ *   load the tunables into the staging table, derive its lookup tables
+ *   and publish it. Out of range values keep their defaults.
+ *
+ ****************************************************************************/
+
+static void vibrator_config_load(void)
+{
+    static const char* const scale_keys[] = {
+        [VIBRATION_INTENSITY_LOW] = KVDB_KEY_VIBRATOR_SCALE_LOW,
+        [VIBRATION_INTENSITY_MEDIUM] = KVDB_KEY_VIBRATOR_SCALE_MEDIUM,
+        [VIBRATION_INTENSITY_HIGH] = KVDB_KEY_VIBRATOR_SCALE_HIGH,
+    };
+
+    static const int scale_defaults[] = {
+        [VIBRATION_INTENSITY_LOW] = VIBRATOR_SCALE_LOW,
+        [VIBRATION_INTENSITY_MEDIUM] = VIBRATOR_SCALE_MEDIUM,
+        [VIBRATION_INTENSITY_HIGH] = VIBRATOR_SCALE_HIGH,
+    };
+
+    vibrator_config_t* config = &g_vibrator_config_next;
+    int32_t light;
+    int32_t medium;
+    int32_t strong;
+    int32_t percent;
+    int32_t max_ms;
+
+    light = property_get_int32(KVDB_KEY_VIBRATOR_LIGHT,
+        VIBRATOR_LIGHT_MAGNITUDE);
+    medium = property_get_int32(KVDB_KEY_VIBRATOR_MEDIUM,
+        VIBRATOR_MEDIUM_MAGNITUDE);
+    strong = property_get_int32(KVDB_KEY_VIBRATOR_STRONG,
+        VIBRATOR_STRONG_MAGNITUDE);
+    if (light < 0 || light > medium || medium > strong || strong > INT16_MAX) {
+        VIBRATORWARN("invalid magnitudes %" PRId32 ", %" PRId32 ", %" PRId32,
+            light, medium, strong);
+        light = VIBRATOR_LIGHT_MAGNITUDE;
+        medium = VIBRATOR_MEDIUM_MAGNITUDE;
+        strong = VIBRATOR_STRONG_MAGNITUDE;
+    }
+
+    config->strength[VIBRATION_LIGHT] = light;
+    config->strength[VIBRATION_MEDIUM] = medium;
+    config->strength[VIBRATION_STRONG] = strong;
+    for (int i = 0; i <= VIBRATOR_MAX_AMPLITUDE; i++)
+        config->magnitude[i] = light + i * (strong - light)
+            / VIBRATOR_MAX_AMPLITUDE;
+
+    for (int i = 0; i <= VIBRATION_INTENSITY_HIGH; i++) {
+        percent = property_get_int32(scale_keys[i], scale_defaults[i]);
+        if (percent < 0 || percent > 100) {
+            VIBRATORWARN("invalid scale %" PRId32 " of intensity %d",
+                percent, i);
+            percent = scale_defaults[i];
+        }
+
+        for (int j = 0; j <= VIBRATOR_MAX_AMPLITUDE; j++)
+            config->scale[i][j] = j * percent / 100;
+    }
+
+    max_ms = property_get_int32(KVDB_KEY_VIBRATOR_MAX_MS, 0);
+    config->max_ms = MAX(max_ms, 0);
+
+    vibrator_seq_publish(&g_vibrator_config_seq, &g_vibrator_config, config,
+        sizeof(vibrator_config_t));
+    VIBRATORINFO("config magnitudes %" PRId32 ", %" PRId32 ", %" PRId32
+                 ", max %" PRIu32 " ms",
+        light, medium, strong, config->max_ms);
+}
+
+/****************************************************************************
+ * Name: vibrator_config_limit()
+ *
+ * Description:
+ *   cap the length of a one-shot vibration
+ *
+ * Input Parameters:
+ *   timeout_ms - the requested length in ms
+ *
+ * Returned Value:
+ *   the length to be played
+ *
+ ****************************************************************************/
+
+static uint32_t vibrator_config_limit(uint32_t timeout_ms)
+{
+    unsigned int start;
+    uint32_t max_ms;
+
+    do {
+        start = vibrator_seq_begin(&g_vibrator_config_seq);
+        max_ms = g_vibrator_config.max_ms;
+    } while (vibrator_seq_retry(&g_vibrator_config_seq, start));
+
+    return max_ms > 0 ? MIN(timeout_ms, max_ms) : timeout_ms;
+}
+
+/****************************************************************************
+ * Name: ff_magnitude()
+ *
+ * Description:
+ *   map a vibration amplitude onto the device magnitude range
+ *
+ * Input Parameters:
+ *   amplitude - vibration instensity, range[0,255]
+ *
+ * Returned Value:
+ *   the magnitude, from the light to the strong magnitude of the
+ *   configuration
+ *
+ ****************************************************************************/
+
+static int16_t ff_magnitude(uint8_t amplitude)
+{
+    unsigned int start;
+    int16_t magnitude;
+
+    do {
+        start = vibrator_seq_begin(&g_vibrator_config_seq);
+        magnitude = g_vibrator_config.magnitude[amplitude];
+    } while (vibrator_seq_retry(&g_vibrator_config_seq, start));
+
+    return magnitude;
+}
+
+/****************************************************************************
+ * Name: ff_drive_envelope()
+ *
+ * Description:
+ *   shape the start of a constant drive with the overdrive pre-pulse of the
+ *   device, the envelope starts at the kick level and settles to the effect
+ *   level within kick_ms
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   envelope - the envelope of the effect to be shaped
+ *   duration - playing length of the effect in ms
+ *
+ ****************************************************************************/
+
+static void ff_drive_envelope(ff_dev_t* ff_dev, struct ff_envelope* envelope,
+    uint32_t duration)
+{
+    vibrator_drive_t* drive = &ff_dev->drive;
+
+    if (drive->kick_ms == 0 || drive->kick_ms >= duration)
+        return;
+
+    envelope->attack_length = drive->kick_ms;
+    envelope->attack_level = ff_magnitude(drive->kick_amplitude);
+}
+
+/****************************************************************************
+ * Name: ff_constant()
+ *
+ * Description:
+ *   fill in a constant drive. A device without FF_CONSTANT but with
+ *   FF_RUMBLE gets a rumble effect driving both motors at the level, it has
+ *   no envelope and so no overdrive.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   effect - the zeroed effect to be filled in
+ *   level - the level of the drive
+ *   length - playing length in ms
+ *   kick - shape the start with the overdrive of the device
+ *
+ ****************************************************************************/
+
+static void ff_constant(ff_dev_t* ff_dev, struct ff_effect* effect,
+    int16_t level, uint32_t length, bool kick)
+{
+    effect->replay.length = length;
+    if (ff_dev->rumble) {
+        effect->type = FF_RUMBLE;
+        effect->u.rumble.strong_magnitude = (uint16_t)MAX(level, 0) << 1;
+        effect->u.rumble.weak_magnitude = effect->u.rumble.strong_magnitude;
+        return;
+    }
+
+    effect->type = FF_CONSTANT;
+    effect->u.constant.level = level;
+    if (kick)
+        ff_drive_envelope(ff_dev, &effect->u.constant.envelope, length);
+}
+
+/****************************************************************************
+ * Name: ff_brake()
+ *
+ * Description:
+ *   schedule the active brake of the device right after the drive ends,
+ *   either a reverse-phase or a zero drive lasting brake_ms
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   delay - milliseconds until the drive ends
+ *
+ * Returned Value:
+ *   return the ret of file system operations
+ *
+ ****************************************************************************/
+
+static int ff_brake(ff_dev_t* ff_dev, uint32_t delay)
+{
+    vibrator_drive_t* drive = &ff_dev->drive;
+    struct ff_effect effect;
+    struct ff_event_s play;
+    int ret;
+
+    if (drive->brake_ms == 0 || delay > UINT16_MAX)
+        return 0;
+
+    memset(&effect, 0, sizeof(effect));
+    effect.type = FF_CONSTANT;
+    effect.id = ff_dev->brake_id;
+    if (drive->brake_mode == VIBRATOR_BRAKE_REVERSE)
+        effect.u.constant.level = -ff_magnitude(drive->brake_amplitude);
+    effect.replay.delay = delay;
+    effect.replay.length = drive->brake_ms;
+
+    ret = ff_ioctl(ff_dev, EVIOCSFF, (unsigned long)&effect);
+    if (ret < 0) {
+        VIBRATORERR("ioctl EVIOCSFF brake failed, errno = %d", errno);
+        return ret;
+    }
+
+    ff_dev->brake_id = effect.id;
+
+    memset(&play, 0, sizeof(play));
+    play.code = ff_dev->brake_id;
+    play.value = 1;
+    ret = ff_write(ff_dev, &play);
+    if (ret < 0) {
+        VIBRATORERR("write brake failed, errno = %d", errno);
+        return ret;
+    }
+
+    ff_dev->brake_armed = true;
+    ff_dev->brake_at = uv_now(ff_dev->loop) + delay;
+    return ret;
+}
+
+/****************************************************************************
+ * Name: ff_brake_cancel()
+ *
+ * Description:
+ *   cancel a brake that has been scheduled for a drive which is replaced
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *
+ ****************************************************************************/
+
+static void ff_brake_cancel(ff_dev_t* ff_dev)
+{
+    struct ff_event_s play;
+
+    if (!ff_dev->brake_armed)
+        return;
+
+    memset(&play, 0, sizeof(play));
+    play.code = ff_dev->brake_id;
+    play.value = 0;
+    if (ff_write(ff_dev, &play) < 0)
+        VIBRATORERR("write brake stop failed, errno = %d", errno);
+
+    ff_dev->brake_armed = false;
+}
+
+/****************************************************************************
+ * Name: ff_brake_pending()
+ *
+ * Description:
+ *   tell whether the drive of the device is still running towards a brake
+ *   that has not started yet, a stop then brakes at once
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *
+ * Returned Value:
+ *   true if the brake is still ahead
+ *
+ ****************************************************************************/
+
+static bool ff_brake_pending(ff_dev_t* ff_dev)
+{
+    return ff_dev->brake_armed && uv_now(ff_dev->loop) <= ff_dev->brake_at;
+}
+
+/****************************************************************************
+ * Name: ff_play()
+ *
+ * Description:
+ *    operate the driver's interface, vibrator device control
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   effect_id - ID of the predefined effect will be played. If effectId is
+ *               valid(non-negative value), the timeout_ms value will be
+ *               ignored, and the real playing length will be set in
+ *               playLengtMs and returned to VibratorService. If effectId is
+ *               invalid, value in param timeout_ms will be used as the play
+ *               length for playing a constant effect.
+ *   timeout_ms - playing length, non-zero means playing, zero means stop
+ *                playing.
+ *   play_length_ms - the playing length in ms unit which will be returned to
+ *                    VibratorService if the request is playing a predefined
+ *                    effect.
+ *   shape - VIBRATOR_SHAPE_* bits, overdrive and brake of a constant effect
+ *
+ * Returned Value:
+ *   return the ret of file system operations
+ *
+ ****************************************************************************/
+
+static int ff_play(ff_dev_t* ff_dev, int effect_id, uint32_t timeout_ms,
+    long* play_length_ms, int shape)
+{
+    int16_t data[VIBRATOR_CUSTOM_DATA_LEN] = { 0, 0, 0 };
+    struct ff_effect effect;
+    struct ff_event_s play;
+    int ret;
+
+    memset(&play, 0, sizeof(play));
+    ff_brake_cancel(ff_dev);
+    ff_dev->curr_updatable = false;
+
+    if (timeout_ms != 0) {
+
+        /* predefined effects are not mapped onto the motors of a rumble
+           device */
+
+        if (effect_id != VIBRATOR_INVALID_VALUE && ff_dev->rumble)
+            return -ENOTSUP;
+
+        /* if curr_app_id is valid, then remove the effect from the device
+           first */
+
+        if (ff_dev->curr_app_id != VIBRATOR_INVALID_VALUE) {
+            ret = ff_ioctl(ff_dev, EVIOCRMFF, (unsigned long)ff_dev->curr_app_id);
+            if (ret < 0) {
+                VIBRATORERR("ioctl EVIOCRMFF failed, errno = %d", errno);
+                goto errout;
+            }
+            ff_dev->curr_app_id = VIBRATOR_INVALID_VALUE;
+        }
+
+        /* if effect_id is valid, then upload the predefined effect with
+           effect_id, else upload a constant effect with timeout_ms */
+
+        memset(&effect, 0, sizeof(effect));
+        if (effect_id != VIBRATOR_INVALID_VALUE) {
+            data[0] = effect_id;
+            effect.type = FF_PERIODIC;
+            effect.u.periodic.waveform = FF_CUSTOM;
+            effect.u.periodic.magnitude = ff_dev->curr_magnitude;
+            effect.u.periodic.custom_data = data;
+            effect.u.periodic.custom_len = sizeof(int16_t) * VIBRATOR_CUSTOM_DATA_LEN;
+        } else {
+            ff_constant(ff_dev, &effect, ff_dev->curr_magnitude, timeout_ms,
+                shape & VIBRATOR_SHAPE_KICK);
+        }
+
+        effect.id = ff_dev->curr_app_id;
+        effect.replay.delay = 0;
+
+        ret = ff_ioctl(ff_dev, EVIOCSFF, (unsigned long)&effect);
+        if (ret < 0) {
+            VIBRATORERR("ioctl EVIOCSFF failed, errno = %d", errno);
+            goto errout;
+        }
+
+        /* update the curr_app_id with the ID obtained from device driver */
+
+        ff_dev->curr_app_id = effect.id;
+        ff_dev->curr_app_type = effect.type;
+
+        /* return the effect play length to vibrator service */
+
+        if (effect_id != VIBRATOR_INVALID_VALUE && play_length_ms != NULL) {
+            *play_length_ms = data[1] * 1000 + data[2];
+            VIBRATORINFO("*play_length_ms = %ld", *play_length_ms);
+        }
+
+        if (ff_dev->curr_app_id == VIBRATOR_INVALID_VALUE)
+            return ret;
+
+        /* write the play event to vibrator device */
+
+        play.value = 1;
+        play.code = ff_dev->curr_app_id;
+        ret = ff_write(ff_dev, &play);
+        if (ret < 0) {
+            VIBRATORERR("write failed, errno = %d", errno);
+            ret = ff_ioctl(ff_dev, EVIOCRMFF, (unsigned long)ff_dev->curr_app_id);
+            if (ret < 0)
+                VIBRATORERR("ioctl EVIOCRMFF failed, errno = %d", errno);
+            goto errout;
+        }
+
+        if (effect_id == VIBRATOR_INVALID_VALUE && (shape & VIBRATOR_SHAPE_BRAKE))
+            ff_brake(ff_dev, timeout_ms);
+    } else if (ff_dev->curr_app_id != VIBRATOR_INVALID_VALUE) {
+
+        /* stop vibration if timeout_ms is zero and curr_app_id is valid */
+
+        ret = ff_ioctl(ff_dev, EVIOCRMFF, (unsigned long)ff_dev->curr_app_id);
+        if (ret < 0) {
+            VIBRATORERR("ioctl EVIOCRMFF failed, errno = %d", errno);
+            goto errout;
+        }
+        ff_dev->curr_app_id = VIBRATOR_INVALID_VALUE;
+    }
+    return 0;
+
+errout:
+    ff_dev->curr_app_id = VIBRATOR_INVALID_VALUE;
+    return ret;
+}
+
+/****************************************************************************
+ * Name: ff_set_amplitude()
+ *
+ * Description:
+ *   operate the driver's interface, set gain to vibrator device
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   amplitude - vibration instensity, range[0,255]
+ *
+ * Returned Value:
+ *   return the ret of write
+ *
+ ****************************************************************************/
+
+static int ff_set_amplitude(ff_dev_t* ff_dev, uint8_t amplitude)
+{
+    struct ff_event_s gain;
+    int tmp;
+    int ret;
+
+    memset(&gain, 0, sizeof(gain));
+
+    tmp = ff_magnitude(amplitude);
+
+    gain.code = FF_GAIN;
+    gain.value = tmp;
+
+    /* without FF_GAIN the level baked into the effects is all there is */
+
+    if (!ff_dev->gain) {
+        ff_dev->curr_magnitude = tmp;
+        return 0;
+    }
+
+    ret = ff_write(ff_dev, &gain);
+    if (ret < 0) {
+        VIBRATORERR("write FF_GAIN failed, errno = %d", errno);
+        return ret;
+    }
+
+    ff_dev->curr_magnitude = tmp;
+
+    return ret;
+}
+
+/****************************************************************************
+ * Name: ff_upload_play()
+ *
+ * Description:
+ *   upload an effect whose level is baked in and start it at once. An
+ *   effect of the same type left by the previous request is updated in
+ *   place instead of being removed first, and the gain is only written
+ *   when the level changes.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   effect - the effect to be played, its id is filled in here
+ *   amplitude - scaled amplitude the level was made from, range[0,255]
+ *
+ * Returned Value:
+ *   return the ret of file system operations
+ *
+ ****************************************************************************/
+
+static int ff_upload_play(ff_dev_t* ff_dev, struct ff_effect* effect,
+    uint8_t amplitude)
+{
+    struct ff_event_s play;
+    int ret;
+
+    ff_brake_cancel(ff_dev);
+    ff_dev->curr_updatable = false;
+    memset(ff_dev->curr_rumble, 0, sizeof(ff_dev->curr_rumble));
+
+    /* drivers only update an effect in place with one of the same type */
+
+    if (ff_dev->curr_app_id != VIBRATOR_INVALID_VALUE
+        && ff_dev->curr_app_type != effect->type) {
+        ret = ff_ioctl(ff_dev, EVIOCRMFF, (unsigned long)ff_dev->curr_app_id);
+        if (ret < 0) {
+            VIBRATORERR("ioctl EVIOCRMFF failed, errno = %d", errno);
+            goto errout;
+        }
+        ff_dev->curr_app_id = VIBRATOR_INVALID_VALUE;
+    }
+
+    effect->id = ff_dev->curr_app_id;
+    ret = ff_ioctl(ff_dev, EVIOCSFF, (unsigned long)effect);
+    if (ret < 0) {
+        VIBRATORERR("ioctl EVIOCSFF failed, errno = %d", errno);
+        goto errout;
+    }
+
+    ff_dev->curr_app_id = effect->id;
+    ff_dev->curr_app_type = effect->type;
+
+    memset(&play, 0, sizeof(play));
+    play.code = ff_dev->curr_app_id;
+    play.value = 1;
+    ret = ff_write(ff_dev, &play);
+    if (ret < 0) {
+        VIBRATORERR("write failed, errno = %d", errno);
+        goto errout;
+    }
+
+    ff_dev->curr_effect = *effect;
+    ff_dev->curr_updatable = true;
+
+    /* Many haptic drivers reset their amplitude when enabled, the gain is
+       written after the play event */
+
+    if (ff_dev->curr_magnitude != ff_magnitude(amplitude))
+        return ff_set_amplitude(ff_dev, amplitude);
+
+    return 0;
+
+errout:
+    if (ff_dev->curr_app_id != VIBRATOR_INVALID_VALUE)
+        ff_ioctl(ff_dev, EVIOCRMFF, (unsigned long)ff_dev->curr_app_id);
+
+    ff_dev->curr_app_id = VIBRATOR_INVALID_VALUE;
+    return ret;
+}
+
+/****************************************************************************
+ * Name: ff_oneshot()
+ *
+ * Description:
+ *   play a constant effect whose level and replay length are baked in at
+ *   upload, with the overdrive and the brake around it.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   timeout_ms - playing length, non-zero
+ *   amplitude - scaled amplitude, range[0,255]
+ *
+ * Returned Value:
+ *   return the ret of file system operations
+ *
+ ****************************************************************************/
+
+static int ff_oneshot(ff_dev_t* ff_dev, uint32_t timeout_ms, uint8_t amplitude)
+{
+    struct ff_effect effect;
+    int ret;
+
+    memset(&effect, 0, sizeof(effect));
+    ff_constant(ff_dev, &effect, ff_magnitude(amplitude), timeout_ms, true);
+
+    ret = ff_upload_play(ff_dev, &effect, amplitude);
+    if (ret < 0)
+        return ret;
+
+    ff_brake(ff_dev, timeout_ms);
+    return 0;
+}
+
+/****************************************************************************
+ * Name: ff_square()
+ *
+ * Description:
+ *   play an interval pattern as one periodic square effect. The offset
+ *   lifts the wave so that it swings between the level and zero, the
+ *   driver then switches the motor on and off by itself until the replay
+ *   length runs out.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   period - on time plus off time in ms, the two halves are equal
+ *   length - playing length in ms, a whole number of periods
+ *   amplitude - scaled amplitude, range[0,255]
+ *
+ * Returned Value:
+ *   return the ret of file system operations
+ *
+ ****************************************************************************/
+
+static int ff_square(ff_dev_t* ff_dev, uint32_t period, uint32_t length,
+    uint8_t amplitude)
+{
+    int16_t level = ff_magnitude(amplitude);
+    struct ff_effect effect;
+
+    memset(&effect, 0, sizeof(effect));
+    effect.type = FF_PERIODIC;
+    effect.u.periodic.waveform = FF_SQUARE;
+    effect.u.periodic.period = period;
+    effect.u.periodic.magnitude = level / 2;
+    effect.u.periodic.offset = level - level / 2;
+    effect.replay.length = length;
+
+    return ff_upload_play(ff_dev, &effect, amplitude);
+}
+
+/****************************************************************************
+ * Name: ff_rumble()
+ *
+ * Description:
+ *   play a rumble effect with its own magnitude for each motor
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   timeout_ms - playing length, non-zero
+ *   strong - scaled amplitude of the strong motor, range[0,255]
+ *   weak - scaled amplitude of the weak motor, range[0,255]
+ *
+ * Returned Value:
+ *   return the ret of file system operations
+ *
+ ****************************************************************************/
+
+static int ff_rumble(ff_dev_t* ff_dev, uint32_t timeout_ms, uint8_t strong,
+    uint8_t weak)
+{
+    struct ff_effect effect;
+    int ret;
+
+    memset(&effect, 0, sizeof(effect));
+    effect.type = FF_RUMBLE;
+    effect.u.rumble.strong_magnitude = strong * 257;
+    effect.u.rumble.weak_magnitude = weak * 257;
+    effect.replay.length = timeout_ms;
+
+    ret = ff_upload_play(ff_dev, &effect, MAX(strong, weak));
+    if (ret >= 0) {
+        ff_dev->curr_rumble[0] = strong;
+        ff_dev->curr_rumble[1] = weak;
+    }
+
+    return ret;
+}
+
+/****************************************************************************
+ * Name: ff_update()
+ *
+ * Description:
+ *   rewrite the level of the effect started by ff_upload_play() while it
+ *   plays. The effect is uploaded again under its own id and is not
+ *   played again, no gain is written. A rumble played with its own levels
+ *   keeps the ratio of its motors, the louder one is set to the amplitude.
+ *   Both motors of a vibration mapped onto a rumble are set to the level.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   amplitude - scaled amplitude, range[0,255]
+ *
+ * Returned Value:
+ *   -ENOENT if no such effect is playing, otherwise the ret of ioctl
+ *
+ ****************************************************************************/
+
+static int ff_update(ff_dev_t* ff_dev, uint8_t amplitude)
+{
+    struct ff_effect* effect = &ff_dev->curr_effect;
+    uint64_t now = uv_now(ff_dev->loop);
+    int16_t level = ff_magnitude(amplitude);
+    int peak = MAX(ff_dev->curr_rumble[0], ff_dev->curr_rumble[1]);
+    int ret;
+
+    if (!ff_dev->curr_updatable || ff_dev->busy_until <= now)
+        return -ENOENT;
+
+    /* drivers restart the replay of an updated effect, the remaining length
+       keeps the end of the drive, and the brake behind it, in place */
+
+    effect->replay.length = MIN(ff_dev->busy_until - now, UINT16_MAX);
+    if (effect->type == FF_CONSTANT) {
+        effect->u.constant.level = level;
+        memset(&effect->u.constant.envelope, 0, sizeof(struct ff_envelope));
+    } else if (effect->type == FF_RUMBLE && peak > 0) {
+        effect->u.rumble.strong_magnitude
+            = ff_dev->curr_rumble[0] * amplitude / peak * 257;
+        effect->u.rumble.weak_magnitude
+            = ff_dev->curr_rumble[1] * amplitude / peak * 257;
+    } else if (effect->type == FF_RUMBLE) {
+        effect->u.rumble.strong_magnitude = (uint16_t)level << 1;
+        effect->u.rumble.weak_magnitude = effect->u.rumble.strong_magnitude;
+    } else {
+        effect->u.periodic.magnitude = level / 2;
+        effect->u.periodic.offset = level - level / 2;
+    }
+
+    ret = ff_ioctl(ff_dev, EVIOCSFF, (unsigned long)effect);
+    if (ret < 0) {
+        VIBRATORERR("ioctl EVIOCSFF update failed, errno = %d", errno);
+        ff_dev->curr_updatable = false;
+    }
+
+    return ret;
+}
+
+/****************************************************************************
+ * Name: ff_slot_upload()
+ *
+ * Description:
+ *   upload a waveform step into an effect slot without playing it. The
+ *   level is baked into the effect, so playing the slot later only needs
+ *   the play event.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   slot - the slot to be filled
+ *   step - index of the waveform step held by the slot
+ *   amplitude - scaled amplitude of the step, range[0,255]
+ *   duration - playing length of the step in ms
+ *   shape - VIBRATOR_SHAPE_KICK if the step starts from rest
+ *
+ * Returned Value:
+ *   return the ret of ioctl
+ *
+ ****************************************************************************/
+
+static int ff_slot_upload(ff_dev_t* ff_dev, int slot, int step,
+    uint8_t amplitude, uint16_t duration, int shape)
+{
+    struct ff_effect effect;
+    int ret;
+
+    memset(&effect, 0, sizeof(effect));
+    effect.type = FF_CONSTANT;
+    effect.id = ff_dev->slot_id[slot];
+    effect.u.constant.level = ff_magnitude(amplitude);
+    effect.replay.length = duration;
+    effect.replay.delay = 0;
+    if (shape & VIBRATOR_SHAPE_KICK)
+        ff_drive_envelope(ff_dev, &effect.u.constant.envelope, duration);
+
+    ret = ff_ioctl(ff_dev, EVIOCSFF, (unsigned long)&effect);
+    if (ret < 0) {
+        VIBRATORERR("ioctl EVIOCSFF slot %d failed, errno = %d", slot, errno);
+        ff_dev->slot_step[slot] = VIBRATOR_INVALID_VALUE;
+        return ret;
+    }
+
+    ff_dev->slot_id[slot] = effect.id;
+    ff_dev->slot_step[slot] = step;
+    return ret;
+}
+
+/****************************************************************************
+ * Name: ff_slot_play()
+ *
+ * Description:
+ *   start or stop the effect held by a slot
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   slot - the slot to be played
+ *   value - 1 to play, 0 to stop
+ *
+ * Returned Value:
+ *   return the ret of write
+ *
+ ****************************************************************************/
+
+static int ff_slot_play(ff_dev_t* ff_dev, int slot, int value)
+{
+    struct ff_event_s play;
+    int ret;
+
+    memset(&play, 0, sizeof(play));
+    play.code = ff_dev->slot_id[slot];
+    play.value = value;
+
+    ret = ff_write(ff_dev, &play);
+    if (ret < 0)
+        VIBRATORERR("write slot %d failed, errno = %d", slot, errno);
+
+    return ret;
+}
+
+/****************************************************************************
+ * Name: ff_slot_reset()
+ *
+ * Description:
+ *   stop both slots and forget the steps they hold, the effects stay
+ *   allocated in the driver so that they can be updated in place
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *
+ ****************************************************************************/
+
+static void ff_slot_reset(ff_dev_t* ff_dev)
+{
+    bool brake = ff_brake_pending(ff_dev);
+    int i;
+
+    for (i = 0; i < VIBRATOR_SLOT_NUM; i++) {
+        if (ff_dev->slot_step[i] != VIBRATOR_INVALID_VALUE)
+            ff_slot_play(ff_dev, i, 0);
+        ff_dev->slot_step[i] = VIBRATOR_INVALID_VALUE;
+    }
+
+    /* the drive is cut short, its brake starts now instead of being lost,
+       a drive that replaces it cancels the brake again */
+
+    if (brake)
+        ff_brake(ff_dev, 0);
+    else
+        ff_brake_cancel(ff_dev);
+
+    ff_dev->slot_next = 0;
+}
+
+/****************************************************************************
+ * Name: play_effect()
+ *
+ * Description:
+ *    play the predefined effect.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   effect_id - ID of the predefined effect will be played.
+ *   es - effect intensity.
+ *   play_length_ms - the playing length in ms unit which will be returned to
+ *                    VibratorService if the request is playing a predefined
+ *                    effect.
+ *
+ * Returned Value:
+ *   return the ret of ff_play
+ *
+ ****************************************************************************/
+
+static int play_effect(ff_dev_t* ff_dev, int effect_id,
+    vibrator_effect_strength_e es, long* play_length_ms)
+{
+    if (es >= VIBRATION_LIGHT && es <= VIBRATION_STRONG)
+        ff_dev->curr_magnitude = vibrator_config_strength(es);
+
+    return ff_play(ff_dev, effect_id, VIBRATOR_INVALID_VALUE,
+        play_length_ms, 0);
+}
+
+/****************************************************************************
+ * Name: play_primitive()
+ *
+ * Description:
+ *    play the predefined effect with the specified amplitude.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   effect_id - ID of the predefined effect will be played.
+ *   amplitude - effect amplitude(0-1.0).
+ *   play_length_ms - the playing length in ms unit which will be returned to
+ *                    VibratorService if the request is playing a predefined
+ *                    effect.
+ *
+ * Returned Value:
+ *   return the ret of ff_play
+ *
+ ****************************************************************************/
+
+static int play_primitive(ff_dev_t* ff_dev, int effect_id,
+    float amplitude, long* play_length_ms)
+{
+    int tmp;
+
+    tmp = (uint8_t)(amplitude * VIBRATOR_MAX_AMPLITUDE);
+    ff_dev->curr_magnitude = ff_magnitude(tmp);
+
+    return ff_play(ff_dev, effect_id, VIBRATOR_INVALID_VALUE,
+        play_length_ms, 0);
+}
+
+/****************************************************************************
+ * Name: on()
+ *
+ * Description:
+ *    turn on vibrator.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   timeout_ms - number of milliseconds to vibrate
+ *   shape - VIBRATOR_SHAPE_* bits
+ *
+ * Returned Value:
+ *   return the ret of ff_play
+ *
+ ****************************************************************************/
+
+static int on(ff_dev_t* ff_dev, uint32_t timeout_ms, int shape)
+{
+    return ff_play(ff_dev, VIBRATOR_INVALID_VALUE, timeout_ms, NULL, shape);
+}
+
+/****************************************************************************
+ * Name: off()
+ *
+ * Description:
+ *    turn off vibrator.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *
+ * Returned Value:
+ *   return the ret of ff_play
+ *
+ ****************************************************************************/
+
+static int off(ff_dev_t* ff_dev)
+{
+    return ff_play(ff_dev, VIBRATOR_INVALID_VALUE, 0, NULL, 0);
+}
+
+/****************************************************************************
+ * Name: scale()
+ *
+ * Description:
+ *    scale the amplitude with the given intensity, through the lookup
+ *    table of the configuration.
+ *
+ * Input Parameters:
+ *   amplitude - vibration amplitude, range 0 - 255
+ *   intensity - vibration intensity
+ *
+ * Returned Value:
+ *   return the scaled vibration amplitude
+ *
+ ****************************************************************************/
+
+static int scale(int amplitude, vibrator_intensity_e intensity)
+{
+    unsigned int start;
+    uint8_t scaled;
+
+    if (intensity < VIBRATION_INTENSITY_LOW
+        || intensity > VIBRATION_INTENSITY_HIGH)
+        return VIBRATOR_MAX_AMPLITUDE;
+
+    amplitude = MIN(MAX(amplitude, 0), VIBRATOR_MAX_AMPLITUDE);
+    do {
+        start = vibrator_seq_begin(&g_vibrator_config_seq);
+        scaled = g_vibrator_config.scale[intensity][amplitude];
+    } while (vibrator_seq_retry(&g_vibrator_config_seq, start));
+
+    return scaled;
+}
+
+/****************************************************************************
+ * Name: should_vibrate()
+ *
+ * Description:
+ *    confirm whether vibration is allowed.
+ *
+ * Input Parameters:
+ *   intensity - vibration intensity
+ *
+ * Returned Value:
+ *   true: allowed, false: not allowed
+ *
+ ****************************************************************************/
+
+static bool should_vibrate(vibrator_intensity_e intensity)
+{
+    if (intensity == VIBRATION_INTENSITY_OFF)
+        return false;
+    return true;
+}
+
+/****************************************************************************
+ * Name: timeline_timing()
+ *
+ * Description:
+ *   read a step of the timeline, from the loaded waveform or in place from
+ *   a shared memory region
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   index - index of the step
+ *
+ ****************************************************************************/
+
+static inline uint32_t timeline_timing(threadargs* thread_args, int index)
+{
+    const vibrator_step_t* steps = thread_args->timeline.steps;
+
+    return steps != NULL ? steps[index].timing : thread_args->wave.timings[index];
+}
+
+static inline uint8_t timeline_amplitude(threadargs* thread_args, int index)
+{
+    const vibrator_step_t* steps = thread_args->timeline.steps;
+
+    return steps != NULL ? steps[index].amplitude
+                         : thread_args->wave.amplitudes[index];
+}
+
+/****************************************************************************
+ * Name: should_repeat()
+ *
+ * Description:
+ *    confirm whether waveform repeat is allowed.
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *
+ * Returned Value:
+ *   true: allowed, false: not allowed
+ *
+ ****************************************************************************/
+
+static bool should_repeat(threadargs* thread_args)
+{
+    vibrator_timeline_t* timeline = &thread_args->timeline;
+    int repeat = timeline->repeat;
+    int ret = false;
+
+    if (repeat < 0)
+        return ret;
+
+    while (repeat < timeline->length) {
+        if (timeline_timing(thread_args, repeat) != 0
+            && timeline_amplitude(thread_args, repeat) > 0) {
+            ret = true;
+            break;
+        }
+        repeat++;
+    }
+
+    return ret;
+}
+
+/****************************************************************************
+ * Name: vibrator_set_busy()
+ *
+ * Description:
+ *   record how long the device stays occupied by the playback just started
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   duration - playing length in ms, VIBRATOR_BUSY_FOREVER if the playback
+ *              only ends when it is stopped, zero if the device is idle
+ *
+ ****************************************************************************/
+
+static void vibrator_set_busy(ff_dev_t* ff_dev, uint64_t duration)
+{
+    if (duration == VIBRATOR_BUSY_FOREVER)
+        ff_dev->busy_until = VIBRATOR_BUSY_FOREVER;
+    else
+        ff_dev->busy_until = uv_now(ff_dev->loop) + duration;
+}
+
+/****************************************************************************
+ * Name: vibrator_busy_remaining()
+ *
+ * Description:
+ *   get the remaining time of the current playback
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *
+ * Returned Value:
+ *   remaining time in ms, zero means the device is idle
+ *
+ ****************************************************************************/
+
+static uint64_t vibrator_busy_remaining(ff_dev_t* ff_dev)
+{
+    uint64_t now = uv_now(ff_dev->loop);
+
+    if (ff_dev->busy_until <= now)
+        return 0;
+
+    return ff_dev->busy_until - now;
+}
+
+#if CONFIG_VIBRATOR_APPS > 0
+/****************************************************************************
+ * Name: vibrator_app_name()
+ *
+ * Description:
+ *   give an application the name of its key until it declares a tag
+ *
+ * Input Parameters:
+ *   app - the application
+ *
+ ****************************************************************************/
+
+static void vibrator_app_name(vibrator_app_t* app)
+{
+    char* tag = app->stats.tag;
+
+    if (app->key == VIBRATOR_APP_REMOTE)
+        strlcpy(tag, "remote", VIBRATOR_APP_TAG_MAX);
+    else if (app->key == VIBRATOR_APP_UNKNOWN)
+        strlcpy(tag, "-", VIBRATOR_APP_TAG_MAX);
+    else if (app->key & VIBRATOR_APP_PID)
+        snprintf(tag, VIBRATOR_APP_TAG_MAX, "pid %" PRIu32,
+            app->key & ~VIBRATOR_APP_PID);
+    else
+        snprintf(tag, VIBRATOR_APP_TAG_MAX, "#%08" PRIx32, app->key);
+}
+
+/****************************************************************************
+ * Name: vibrator_app_get()
+ *
+ * Description:
+ *   find the usage of an application on the device, a new application
+ *   takes a free entry or the one that used the least energy
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   key - the application key of a request
+ *
+ * Returned Value:
+ *   the usage of the application
+ *
+ ****************************************************************************/
+
+static vibrator_app_t* vibrator_app_get(threadargs* thread_args, uint32_t key)
+{
+    vibrator_app_t* victim = NULL;
+    vibrator_app_t* app;
+    int i;
+
+    for (i = 0; i < CONFIG_VIBRATOR_APPS; i++) {
+        app = &thread_args->apps[i];
+        if (app->used && app->key == key)
+            return app;
+
+        if (victim == NULL || (victim->used
+            && (!app->used || app->energy < victim->energy)))
+            victim = app;
+    }
+
+    if (victim->used)
+        VIBRATORWARN("app table full, drop %s", victim->stats.tag);
+
+    if (thread_args->meter.app == victim)
+        thread_args->meter.app = NULL;
+
+    if (thread_args->app_active == victim)
+        thread_args->app_active = NULL;
+
+    memset(victim, 0, sizeof(vibrator_app_t));
+    victim->used = true;
+    victim->key = key;
+    vibrator_app_name(victim);
+    return victim;
+}
+
+/****************************************************************************
+ * Name: vibrator_app_meter()
+ *
+ * Description:
+ *   charge the part of the segment driven since the last call to its
+ *   application
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *
+ ****************************************************************************/
+
+static void vibrator_app_meter(threadargs* thread_args)
+{
+    vibrator_meter_t* meter = &thread_args->meter;
+    uint64_t now = uv_now(thread_args->ff_dev->loop);
+    uint64_t end = MIN(now, meter->until);
+    vibrator_app_t* app = meter->app;
+
+    if (app != NULL && meter->level > 0 && end > meter->since) {
+        app->stats.on_ms += end - meter->since;
+        app->energy += (end - meter->since) * meter->level;
+        app->stats.energy = app->energy / VIBRATOR_MAX_AMPLITUDE;
+    }
+
+    meter->since = now;
+}
+#endif
+
+
+/****************************************************************************
+ * Name: vibrator_app_activate()
+ *
+ * Description:
+ *   charge the segments driven from now on to the application of a
+ *   playback request
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   key - the application key of the request
+ *
+ ****************************************************************************/
+
+static void vibrator_app_activate(threadargs* thread_args, uint32_t key)
+{
+#if CONFIG_VIBRATOR_APPS > 0
+    thread_args->app_active = vibrator_app_get(thread_args, key);
+#endif
+}
+
+/****************************************************************************
+ * Name: vibrator_app_drive()
+ *
+ * Description:
+ *   close the segment being driven and open the next one for the active
+ *   application
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   level - the scaled level the device is driven at, zero when it rests
+ *   duration - the length of the segment in ms, VIBRATOR_BUSY_FOREVER if
+ *              it only ends when it is stopped
+ *
+ ****************************************************************************/
+
+static void vibrator_app_drive(threadargs* thread_args, uint8_t level,
+    uint64_t duration)
+{
+#if CONFIG_VIBRATOR_APPS > 0
+    vibrator_meter_t* meter = &thread_args->meter;
+
+    vibrator_app_meter(thread_args);
+    meter->app = level > 0 ? thread_args->app_active : NULL;
+    meter->level = level;
+    if (duration == VIBRATOR_BUSY_FOREVER)
+        meter->until = VIBRATOR_BUSY_FOREVER;
+    else
+        meter->until = meter->since + duration;
+#endif
+}
+
+/****************************************************************************
+ * Name: vibrator_app_level()
+ *
+ * Description:
+ *   change the level of the segment being driven, keeping its end
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   level - the scaled level the device is driven at
+ *
+ ****************************************************************************/
+
+static void vibrator_app_level(threadargs* thread_args, uint8_t level)
+{
+#if CONFIG_VIBRATOR_APPS > 0
+    vibrator_app_meter(thread_args);
+    thread_args->meter.level = level;
+#endif
+}
+
+/****************************************************************************
+ * Name: vibrator_queue_depth()
+ *
+ * Description:
+ *   get the number of requests outstanding on the device
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *
+ * Returned Value:
+ *   the number of queued requests, plus one if a playback is active
+ *
+ ****************************************************************************/
+
+static int vibrator_queue_depth(threadargs* thread_args)
+{
+    int depth = thread_args->queue.count;
+
+    if (vibrator_busy_remaining(thread_args->ff_dev) > 0)
+        depth++;
+
+    return depth;
+}
+
+/****************************************************************************
+ * Name: vibrator_fill_status()
+ *
+ * Description:
+ *   fill the device load into the reply header
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the reply
+ *
+ ****************************************************************************/
+
+static void vibrator_fill_status(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    uint64_t remaining = vibrator_busy_remaining(thread_args->ff_dev);
+
+    if (remaining > 0)
+        msg->status |= VIBRATOR_STATUS_BUSY;
+
+    msg->depth = vibrator_queue_depth(thread_args);
+    msg->retry_after = MIN(remaining, UINT16_MAX);
+}
+
+/****************************************************************************
+ * Name: receive_stop()
+ *
+ * Description:
+ *   stop vibration, braking the motor if it was being driven
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *
+ * Returned Value:
+ *   return stop ioctl value
+ *
+ ****************************************************************************/
+
+static int receive_stop(ff_dev_t* ff_dev)
+{
+    bool brake = ff_brake_pending(ff_dev);
+    int ret;
+
+    vibrator_set_busy(ff_dev, 0);
+    ret = off(ff_dev);
+
+    /* turning the drive off cancels its brake, a motor stopped while it
+       is driven is braked at once */
+
+    if (brake)
+        ff_brake(ff_dev, 0);
+
+    return ret;
+}
+
+/****************************************************************************
+ * Name: receive_start()
+ *
+ * Description:
+ *   start a constant vibration with timeoutms. A non-zero duration goes
+ *   straight to ff_oneshot(), the waveform timer is not involved.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   timeoutms - number of milliseconds to vibrate
+ *   amplitude - amplitude of the vibration, range[0,255]. The amplitude set
+ *               with VIBRATION_SET_AMPLITUDE is passed by the legacy
+ *               requests, it is never changed here.
+ *
+ * Returned Value:
+ *   return stop ioctl value
+ *
+ ****************************************************************************/
+
+static int receive_start(ff_dev_t* ff_dev, uint32_t timeoutms,
+    uint8_t amplitude)
+{
+    int scale_amplitude;
+    int ret;
+
+    if (!should_vibrate(ff_dev->intensity))
+        return -ENOTSUP;
+
+    scale_amplitude = scale(amplitude, ff_dev->intensity);
+    if (timeoutms != 0)
+        return ff_oneshot(ff_dev, timeoutms, scale_amplitude);
+
+    /* Note: ordering is important here! Many haptic drivers will reset their
+       amplitude when enabled, so we always have to enable first, then set
+       the amplitude. */
+
+    ret = on(ff_dev, timeoutms, VIBRATOR_SHAPE_KICK | VIBRATOR_SHAPE_BRAKE);
+    if (ret < 0) {
+        VIBRATORERR("Error: ioctl failed, errno = %d", errno);
+    }
+
+    return ff_set_amplitude(ff_dev, scale_amplitude);
+}
+
+/****************************************************************************
+ * Name: waveform_next_step()
+ *
+ * Description:
+ *   find the step played after the given one, following the repeat index
+ *   and skipping the steps whose timing is zero
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   index - index of the current step
+ *
+ * Returned Value:
+ *   index of the next step, VIBRATOR_INVALID_VALUE at the end of waveform
+ *
+ ****************************************************************************/
+
+static int waveform_next_step(threadargs* thread_args, int index)
+{
+    vibrator_timeline_t* timeline = &thread_args->timeline;
+    int i;
+
+    for (i = 0; i < timeline->length; i++) {
+        if (++index >= timeline->length) {
+            if (timeline->repeat < 0)
+                return VIBRATOR_INVALID_VALUE;
+            index = timeline->repeat;
+        }
+
+        if (timeline_timing(thread_args, index) != 0)
+            return index;
+    }
+
+    return VIBRATOR_INVALID_VALUE;
+}
+
+/****************************************************************************
+ * Name: waveform_prepare()
+ *
+ * Description:
+ *   upload the next waveform step into the idle slot while the current step
+ *   is playing. A silent next step leaves enough time to upload the step
+ *   behind it at its own boundary, so nothing is uploaded then.
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *
+ ****************************************************************************/
+
+static void waveform_prepare(threadargs* thread_args)
+{
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    uint8_t amplitude;
+    int index;
+
+    index = waveform_next_step(thread_args, thread_args->timeline.count - 1);
+    if (index == VIBRATOR_INVALID_VALUE)
+        return;
+
+    amplitude = scale(timeline_amplitude(thread_args, index), ff_dev->intensity);
+    if (amplitude == 0)
+        return;
+
+    ff_slot_upload(ff_dev, ff_dev->slot_next, index, amplitude,
+        MIN(timeline_timing(thread_args, index), UINT16_MAX),
+        ff_dev->driving ? 0 : VIBRATOR_SHAPE_KICK);
+}
+
+/****************************************************************************
+ * Name: waveform_play_step()
+ *
+ * Description:
+ *   play a waveform step from the slot it was prepared in, uploading it
+ *   first if it could not be prepared ahead of its boundary
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   amplitude - scaled amplitude of the step, range[0,255]
+ *   duration - playing length of the step in ms
+ *   shape - VIBRATOR_SHAPE_* bits of the step
+ *
+ ****************************************************************************/
+
+static void waveform_play_step(threadargs* thread_args, uint8_t amplitude,
+    uint16_t duration, int shape)
+{
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    int slot = ff_dev->slot_next;
+    int step = thread_args->timeline.count;
+
+    if (ff_dev->slot_step[slot] != step) {
+        if (ff_slot_upload(ff_dev, slot, step, amplitude, duration, shape) < 0)
+            return;
+    }
+
+    ff_brake_cancel(ff_dev);
+    ff_slot_play(ff_dev, slot, 1);
+
+    /* Drivers scale every effect by the gain, only touch it when the
+       amplitude actually changes between steps */
+
+    if (ff_dev->curr_magnitude != ff_magnitude(amplitude))
+        ff_set_amplitude(ff_dev, amplitude);
+
+    if (shape & VIBRATOR_SHAPE_BRAKE)
+        ff_brake(ff_dev, duration);
+
+    ff_dev->slot_next = (slot + 1) % VIBRATOR_SLOT_NUM;
+}
+
+/****************************************************************************
+ * Name: waveform_timer_cb()
+ *
+ * Description:
+ *   callback function to wait for a given vibration time
+ *
+ * Input Parameters:
+ *   timer - the handle of the uv timer
+ *
+ ****************************************************************************/
+
+static void waveform_timer_cb(uv_timer_t* timer)
+{
+    threadargs* thread_args = timer->data;
+    vibrator_timeline_t* timeline = &thread_args->timeline;
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    uint32_t duration;
+    uint16_t length;
+    uint8_t amplitude;
+    int shape;
+    int next;
+
+    uv_timer_stop(timer);
+
+    if (timeline->count < timeline->length) {
+        VIBRATORINFO("index(count) = %" PRId32, timeline->count);
+        amplitude = scale(timeline_amplitude(thread_args, timeline->count),
+            ff_dev->intensity);
+        duration = timeline_timing(thread_args, timeline->count);
+        if (amplitude != 0 && duration > 0) {
+
+            /* kick the actuator when it starts from rest and brake it
+               when the next step lets it rest again */
+
+            shape = ff_dev->driving ? 0 : VIBRATOR_SHAPE_KICK;
+            next = waveform_next_step(thread_args, timeline->count);
+            if (next == VIBRATOR_INVALID_VALUE
+                || scale(timeline_amplitude(thread_args, next),
+                       ff_dev->intensity) == 0)
+                shape |= VIBRATOR_SHAPE_BRAKE;
+
+            /* the replay length of an effect is 16 bits wide, a longer
+               step drives for the longest effect and rests until the
+               timer ends it */
+
+            length = MIN(duration, UINT16_MAX);
+            if (ff_dev->double_buffer) {
+                waveform_play_step(thread_args, amplitude, length, shape);
+            } else {
+                on(ff_dev, length, shape);
+                ff_set_amplitude(ff_dev, amplitude);
+            }
+
+            ff_dev->driving = true;
+            vibrator_app_drive(thread_args, amplitude, length);
+        } else if (duration > 0) {
+            ff_dev->driving = false;
+            vibrator_app_drive(thread_args, 0, duration);
+        }
+
+        timeline->count++;
+        timeline->elapsed += duration;
+        if (ff_dev->double_buffer && duration > 0)
+            waveform_prepare(thread_args);
+
+        uv_timer_start(&thread_args->timer, waveform_timer_cb, duration, 0);
+    } else if (timeline->repeat < 0) {
+        VIBRATORINFO("repeat < 0, play waveform exit");
+    } else if (timeline->elapsed == 0) {
+
+        /* the steps of a shared memory region stay writable while they are
+           played, a pass that took no time would spin the loop forever */
+
+        VIBRATORWARN("repeat section takes no time, play waveform exit");
+        vibrator_set_busy(ff_dev, 0);
+    } else {
+        timeline->count = timeline->repeat;
+        timeline->elapsed = 0;
+        uv_timer_start(&thread_args->timer, waveform_timer_cb, 0, 0);
+    }
+}
+
+/****************************************************************************
+ * Name: receive_waveform()
+ *
+ * Description:
+ *   receive waveform from vibrator_upper file
+ *
+ * Input Parameters:
+ *   args - the args of threadargs
+ *
+ ****************************************************************************/
+
+static int receive_waveform(void* args)
+{
+    threadargs* thread_args = args;
+    vibrator_timeline_t* timeline = &thread_args->timeline;
+
+    uint64_t duration = 0;
+    int ret;
+    int i;
+
+    timeline->count = 0;
+    timeline->elapsed = 0;
+
+    if (!should_vibrate(thread_args->ff_dev->intensity))
+        return -ENOTSUP;
+
+    /* the flags come from the client, the repeat section is always checked
+       so that it cannot loop on steps that never take any time */
+
+    if (!should_repeat(thread_args))
+        timeline->repeat = -1;
+
+    /* steps are played from the slots, release the effect of the previous
+       request so that both do not play at once */
+
+    if (thread_args->ff_dev->double_buffer)
+        off(thread_args->ff_dev);
+
+    ret = uv_timer_start(&thread_args->timer, waveform_timer_cb, 0, 0);
+    if (ret < 0)
+        return ret;
+
+    if (timeline->repeat >= 0) {
+        duration = VIBRATOR_BUSY_FOREVER;
+    } else {
+        for (i = 0; i < timeline->length; i++)
+            duration += timeline_timing(thread_args, i);
+    }
+
+    vibrator_set_busy(thread_args->ff_dev, duration);
+    return ret;
+}
+
+/****************************************************************************
+ * Name: interval_timer_cb()
+ *
+ * Description:
+ *   callback function to wait for a given time interval
+ *
+ * Input Parameters:
+ *   timer - the handle of the uv timer
+ *
+ ****************************************************************************/
+
+static void interval_timer_cb(uv_timer_t* timer)
+{
+    threadargs* thread_args = (threadargs*)timer->data;
+    vibrator_waveform_t* wave = &thread_args->wave;
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    int32_t duration = wave->timings[0];
+
+    if (wave->count-- == 0) {
+        uv_timer_stop(timer);
+        return;
+    }
+
+    if (receive_start(ff_dev, duration, ff_dev->curr_amplitude) >= 0) {
+
+        /* the device stays busy until the end of the pattern, an update
+           would stretch the pulse over the gaps behind it */
+
+        ff_dev->curr_updatable = false;
+        vibrator_app_drive(thread_args,
+            scale(ff_dev->curr_amplitude, ff_dev->intensity), duration);
+    }
+}
+
+/****************************************************************************
+ * Name: receive_interval()
+ *
+ * Description:
+ *   receive receive_interval from vibrator_upper file. When the driver
+ *   plays square waves and the on and off times are equal, the whole
+ *   pattern is uploaded once as a periodic effect, otherwise a timer
+ *   starts every pulse.
+ *
+ * Input Parameters:
+ *   args - the args of threadargs
+ *
+ ****************************************************************************/
+
+static int receive_interval(void* args)
+{
+    threadargs* thread_args = (threadargs*)args;
+    vibrator_waveform_t* wave = &thread_args->wave;
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    uint64_t period = wave->timings[0] + wave->timings[1];
+    uint64_t length = period * MAX(wave->count, 0);
+    int ret;
+
+    /* a square wave has a fixed duty cycle of one half, and the replay
+       length of an effect is 16 bits wide */
+
+    if (ff_dev->square && should_vibrate(ff_dev->intensity)
+        && wave->timings[0] == wave->timings[1]
+        && length > 0 && length <= UINT16_MAX) {
+        ret = ff_square(ff_dev, period, length,
+            scale(ff_dev->curr_amplitude, ff_dev->intensity));
+        if (ret >= 0) {
+            vibrator_set_busy(ff_dev, length);
+
+            /* as for the pulses started by the timer, an update is
+               refused, it would restart the wave in the middle of a
+               period and shift the pulses behind it */
+
+            ff_dev->curr_updatable = false;
+
+            /* the driver plays the pulses, half of the pattern is on */
+
+            vibrator_app_drive(thread_args,
+                scale(ff_dev->curr_amplitude, ff_dev->intensity), length / 2);
+        }
+
+        return ret;
+    }
+
+    ret = uv_timer_start(&thread_args->timer, interval_timer_cb, 0, period);
+    if (ret >= 0)
+        vibrator_set_busy(ff_dev, length);
+
+    return ret;
+}
+
+/****************************************************************************
+ * Name: receive_predefined()
+ *
+ * Description:
+ *   receive predefined from vibrator_upper file
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   eff - effect struct, including effect id and effect strength
+ *
+ * Returned Value:
+ *   return the play_effect value
+ *
+ ****************************************************************************/
+
+static int receive_predefined(ff_dev_t* ff_dev, vibrator_effect_t* eff)
+{
+    int32_t play_length;
+    int ret;
+
+    if (!should_vibrate(ff_dev->intensity))
+        return -ENOTSUP;
+
+    ret = play_effect(ff_dev, eff->effect_id, eff->es, (long*)&play_length);
+
+    if (ret >= 0) {
+        eff->play_length = play_length;
+        vibrator_set_busy(ff_dev, MAX(play_length, 0));
+    }
+
+    return ret;
+}
+
+/****************************************************************************
+ * Name: receive_primitive()
+ *
+ * Description:
+ *   receive play primitive from vibrator_upper file
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   eff - effect struct, including effect id and effect strength
+ *
+ * Returned Value:
+ *   return the play_effect value
+ *
+ ****************************************************************************/
+
+static int receive_primitive(ff_dev_t* ff_dev, vibrator_effect_t* eff)
+{
+    int32_t play_length;
+    int ret;
+
+    if (!should_vibrate(ff_dev->intensity))
+        return -ENOTSUP;
+
+    ret = play_primitive(ff_dev, eff->effect_id, eff->amplitude, (long*)&play_length);
+
+    if (ret >= 0) {
+        eff->play_length = play_length;
+        vibrator_set_busy(ff_dev, MAX(play_length, 0));
+    }
+
+    return ret;
+}
+
+/****************************************************************************
+ * Name: receive_set_intensity()
+ *
+ * Description:
+ *   recevice set vibrator intensity operation from vibrator_upper file
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   intensity - vibration intensity
+ *
+ * Returned Value:
+ *   return the ret of write
+ *
+ ****************************************************************************/
+
+static int receive_set_intensity(ff_dev_t* ff_dev,
+    vibrator_intensity_e intensity)
+{
+    int ret;
+
+    ff_dev->intensity = intensity;
+    ret = property_set_int32(KVDB_KEY_VIBRATOR_MODE, ff_dev->intensity);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return OK;
+}
+
+/****************************************************************************
+ * Name: receive_get_intensity()
+ *
+ * Description:
+ *   recevice get vibrator intensity operation from vibrator_upper file
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   intensity - vibration intensity
+ *
+ * Returned Value:
+ *   return OK(success)
+ *
+ ****************************************************************************/
+
+static int receive_get_intensity(ff_dev_t* ff_dev,
+    vibrator_intensity_e* intensity)
+{
+    ff_dev->intensity = property_get_int32(KVDB_KEY_VIBRATOR_MODE,
+        ff_dev->intensity);
+    *intensity = ff_dev->intensity;
+    return OK;
+}
+
+/****************************************************************************
+ * Name: receive_set_amplitude()
+ *
+ * Description:
+ *   recevice set vibrator amplitude operation from vibrator_upper file
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   amplitude - vibration amplitude, range 0 - 255
+ *
+ * Returned Value:
+ *   return the ret of write
+ *
+ ****************************************************************************/
+
+static int receive_set_amplitude(ff_dev_t* ff_dev, uint8_t amplitude)
+{
+    ff_dev->curr_amplitude = amplitude;
+    return ff_set_amplitude(ff_dev, amplitude);
+}
+
+/****************************************************************************
+ * Name: receive_get_capabilities()
+ *
+ * Description:
+ *   recevice get vibrator capabilities operation from vibrator_upper file
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   capabilities - buffer that store capabilities
+ *
+ * Returned Value:
+ *   0 means success
+ *
+ ****************************************************************************/
+
+static int receive_get_capabilities(ff_dev_t* ff_dev, int32_t* capabilities)
+{
+    *capabilities = ff_dev->capabilities;
+    return OK;
+}
+
+/****************************************************************************
+ * Name: receive_get_stats()
+ *
+ * Description:
+ *   get the scheduler statistics of the device
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   stats - buffer that stores the statistics
+ *
+ * Returned Value:
+ *   0 means success
+ *
+ ****************************************************************************/
+
+static int receive_get_stats(threadargs* thread_args, vibrator_stats_t* stats)
+{
+    vibrator_transport_t* transport;
+
+    *stats = thread_args->queue.stats;
+    stats->queue_depth = vibrator_queue_depth(thread_args);
+
+    /* the counters of the transport threads are read without a lock, a
+       count may lag behind by the wakeup in progress */
+
+    for (int i = 0; i < VIBRATOR_COUNT; i++) {
+        transport = &g_vibrator_transports[i];
+        stats->wakeups += transport->wakeups;
+        stats->frames += transport->frames;
+        stats->batch_peak = MAX(stats->batch_peak, transport->batch_peak);
+        stats->accept_peak = MAX(stats->accept_peak, transport->accept_peak);
+    }
+
+    return OK;
+}
+
+/****************************************************************************
+ * Name: receive_get_state()
+ *
+ * Description:
+ *   get the internal state of the device, its slot cache and the active
+ *   timeline
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   state - buffer that stores the state
+ *
+ * Returned Value:
+ *   0 means success
+ *
+ ****************************************************************************/
+
+static int receive_get_state(threadargs* thread_args, vibrator_state_t* state)
+{
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    vibrator_queue_t* queue = &thread_args->queue;
+    vibrator_timeline_t* timeline = &thread_args->timeline;
+
+    static_assert(VIBRATOR_SLOT_NUM == VIBRATOR_STATE_SLOTS,
+        "vibrator_state_t does not match the slot cache");
+
+    memset(state, 0, sizeof(vibrator_state_t));
+    state->capabilities = ff_dev->capabilities;
+    state->busy_ms = MIN(vibrator_busy_remaining(ff_dev), UINT32_MAX);
+    state->active_client = (uintptr_t)queue->active_owner;
+    state->active_token = queue->active_token;
+    state->timeline_length = timeline->length;
+    state->timeline_repeat = timeline->repeat;
+    state->timeline_count = timeline->count;
+    state->timeline_region = timeline->steps != NULL;
+    state->effect_id = ff_dev->curr_app_id;
+    state->effect_type = ff_dev->curr_app_type;
+    state->magnitude = ff_dev->curr_magnitude;
+    state->brake_id = ff_dev->brake_id;
+    for (int i = 0; i < VIBRATOR_SLOT_NUM; i++) {
+        state->slot_id[i] = ff_dev->slot_id[i];
+        state->slot_step[i] = ff_dev->slot_step[i];
+    }
+
+    state->slot_next = ff_dev->slot_next;
+    state->amplitude = ff_dev->curr_amplitude;
+    state->intensity = ff_dev->intensity;
+    state->queue_count = queue->count;
+    state->active_priority = queue->active_priority;
+    state->double_buffer = ff_dev->double_buffer;
+    state->driving = ff_dev->driving;
+    state->brake_armed = ff_dev->brake_armed;
+    state->updatable = ff_dev->curr_updatable;
+    return OK;
+}
+
+/****************************************************************************
+ * Name: vibrator_drive_init()
+ *
+ * Description:
+ *   load the overdrive and brake parameters of the device, the Kconfig
+ *   defaults can be tuned per device through KVDB
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *
+ ****************************************************************************/
+
+static void vibrator_drive_init(ff_dev_t* ff_dev)
+{
+    vibrator_drive_t* drive = &ff_dev->drive;
+
+    drive->kick_ms = property_get_int32(KVDB_KEY_VIBRATOR_KICK_MS,
+        CONFIG_VIBRATOR_KICK_MS);
+    drive->kick_amplitude = property_get_int32(KVDB_KEY_VIBRATOR_KICK_AMPLITUDE,
+        CONFIG_VIBRATOR_KICK_AMPLITUDE);
+    drive->brake_ms = property_get_int32(KVDB_KEY_VIBRATOR_BRAKE_MS,
+        CONFIG_VIBRATOR_BRAKE_MS);
+    drive->brake_mode = property_get_int32(KVDB_KEY_VIBRATOR_BRAKE_MODE,
+        VIBRATOR_BRAKE_MODE);
+    drive->brake_amplitude = property_get_int32(KVDB_KEY_VIBRATOR_BRAKE_AMPLITUDE,
+        CONFIG_VIBRATOR_BRAKE_AMPLITUDE);
+
+    VIBRATORINFO("kick %d ms at %d, brake %d ms at %d, mode %d",
+        drive->kick_ms, drive->kick_amplitude, drive->brake_ms,
+        drive->brake_amplitude, drive->brake_mode);
+}
+
+/****************************************************************************
+ * Name: vibrator_init()
+ *
+ * Description:
+ *   open the vibrator file descriptor
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   index - the index of the device
+ *
+ * Returned Value:
+ *   0 means success, otherwise it means failure
+ *
+ ****************************************************************************/
+
+static int vibrator_init(ff_dev_t* ff_dev, int index)
+{
+    unsigned char ffbitmask[1 + FF_MAX / 8 / sizeof(unsigned char)];
+    char path[PATH_MAX];
+    int max_effects = 0;
+    int ret;
+
+    ff_dev->curr_app_id = VIBRATOR_INVALID_VALUE;
+    ff_dev->curr_updatable = false;
+    ff_dev->curr_magnitude = vibrator_config_strength(VIBRATION_STRONG);
+    ff_dev->intensity = VIBRATION_INTENSITY_OFF;
+    ff_dev->curr_amplitude = VIBRATOR_MAX_AMPLITUDE;
+    ff_dev->capabilities = 0;
+    ff_dev->busy_until = 0;
+    ff_dev->double_buffer = false;
+    ff_dev->square = false;
+    ff_dev->rumble = false;
+    ff_dev->gain = false;
+    ff_dev->driving = false;
+    ff_dev->brake_armed = false;
+    ff_dev->brake_id = VIBRATOR_INVALID_VALUE;
+    ff_dev->slot_next = 0;
+    for (int i = 0; i < VIBRATOR_SLOT_NUM; i++) {
+        ff_dev->slot_id[i] = VIBRATOR_INVALID_VALUE;
+        ff_dev->slot_step[i] = VIBRATOR_INVALID_VALUE;
+    }
+
+#ifdef CONFIG_VIBRATOR_MOCK
+    ff_dev->mock_effects = 0;
+    if (index == 0)
+        strlcpy(path, CONFIG_VIBRATOR_MOCK_LOG, sizeof(path));
+    else
+        snprintf(path, sizeof(path), "%s.%d", CONFIG_VIBRATOR_MOCK_LOG, index);
+
+    ff_dev->fd = open(path, O_CLOEXEC | O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#else
+    property_get(KVDB_KEY_VIBRATOR_DEVICE, path, VIBRATOR_DEV_FS);
+    snprintf(path + strlen(path), sizeof(path) - strlen(path), "%d", index);
+    ff_dev->fd = open(path, O_CLOEXEC | O_RDWR);
+#endif
+    if (ff_dev->fd < 0) {
+        VIBRATORERR("vibrator %s open failed, errno = %d", path, errno);
+        return -ENODEV;
+    }
+
+    memset(ffbitmask, 0, sizeof(ffbitmask));
+    ret = ff_ioctl(ff_dev, EVIOCGBIT, (unsigned long)ffbitmask);
+    if (ret < 0) {
+        VIBRATORERR("ioctl EVIOCGBIT failed, errno = %d", errno);
+        return ret;
+    }
+
+    if (test_bit(FF_CONSTANT, ffbitmask) || test_bit(FF_PERIODIC, ffbitmask)) {
+        if (test_bit(FF_CUSTOM, ffbitmask))
+            ff_dev->capabilities |= CAP_AMPLITUDE_CONTROL;
+        if (test_bit(FF_GAIN, ffbitmask)) {
+            ff_dev->capabilities |= CAP_PERFORM_CALLBACK;
+            ff_dev->capabilities |= CAP_COMPOSE_EFFECTS;
+        }
+    } else if (test_bit(FF_RUMBLE, ffbitmask)) {
+
+        /* constant drives are played on both motors of a rumble device */
+
+        ff_dev->capabilities |= CAP_AMPLITUDE_CONTROL;
+        ff_dev->rumble = true;
+    } else {
+        return -ENODEV;
+    }
+
+    if (test_bit(FF_RUMBLE, ffbitmask))
+        ff_dev->capabilities |= CAP_RUMBLE;
+
+    ff_dev->gain = test_bit(FF_GAIN, ffbitmask);
+
+    /* interval patterns are handed to the driver as one square wave */
+
+    ff_dev->square = test_bit(FF_PERIODIC, ffbitmask)
+        && test_bit(FF_SQUARE, ffbitmask);
+
+    /* waveform steps are double-buffered when the driver can hold the two
+       slots next to the effect used by the other requests */
+
+    ret = ff_ioctl(ff_dev, EVIOCGEFFECTS, (unsigned long)&max_effects);
+    if (ret >= 0 && max_effects > VIBRATOR_SLOT_NUM)
+        ff_dev->double_buffer = test_bit(FF_CONSTANT, ffbitmask);
+
+    vibrator_drive_init(ff_dev);
+
+    /* a rumble motor can neither be reversed nor held */
+
+    if (ff_dev->rumble)
+        ff_dev->drive.brake_ms = 0;
+
+    /* the brake needs an effect of its own besides the ones above */
+
+    if (ff_dev->drive.brake_ms > 0 && ret < 0) {
+        VIBRATORWARN("effect count unknown, brake disabled");
+        ff_dev->drive.brake_ms = 0;
+    } else if (ff_dev->drive.brake_ms > 0
+        && max_effects <= (ff_dev->double_buffer ? VIBRATOR_SLOT_NUM + 1 : 1)) {
+        VIBRATORWARN("%d effects are too few for the brake", max_effects);
+        ff_dev->drive.brake_ms = 0;
+    }
+
+#if CONFIG_VIBRATOR_ALWAYS_ON > 0
+    /* always-on effects are predefined effects that stay uploaded next to
+       all of the above */
+
+    for (int i = 0; i < CONFIG_VIBRATOR_ALWAYS_ON; i++)
+        ff_dev->always_on_id[i] = VIBRATOR_INVALID_VALUE;
+
+    if (!test_bit(FF_CUSTOM, ffbitmask) || ff_dev->rumble) {
+        VIBRATORWARN("always-on effects need FF_CUSTOM");
+    } else if (ret >= 0 && max_effects < 1 + CONFIG_VIBRATOR_ALWAYS_ON
+        + (ff_dev->double_buffer ? VIBRATOR_SLOT_NUM : 0)
+        + (ff_dev->drive.brake_ms > 0)) {
+        VIBRATORWARN("%d effects are too few for always-on", max_effects);
+    } else {
+        ff_dev->capabilities |= CAP_ALWAYS_ON_CONTROL;
+    }
+#endif
+
+    ff_dev->intensity = property_get_int32(KVDB_KEY_VIBRATOR_MODE,
+        ff_dev->intensity);
+    return OK;
+}
+
+/****************************************************************************
+ * Name: vibrator_engine_stop()
+ *
+ * Description:
+ *   stop the timer driven playback engine and the effects it left in the
+ *   double-buffered slots
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *
+ ****************************************************************************/
+
+static void vibrator_engine_stop(threadargs* thread_args)
+{
+    uv_timer_stop(&thread_args->timer);
+    uv_timer_stop(&thread_args->update.timer);
+    thread_args->ff_dev->driving = false;
+    vibrator_app_drive(thread_args, 0, 0);
+
+    if (thread_args->ff_dev->double_buffer)
+        ff_slot_reset(thread_args->ff_dev);
+}
+
+/****************************************************************************
+ * Name: vibrator_update_flush()
+ *
+ * Description:
+ *   write the newest update level to the device
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *
+ * Returned Value:
+ *   return the ff_update value
+ *
+ ****************************************************************************/
+
+static int vibrator_update_flush(threadargs* thread_args)
+{
+    vibrator_update_t* update = &thread_args->update;
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    int ret;
+
+    if (!should_vibrate(ff_dev->intensity))
+        return -ENOTSUP;
+
+    update->last = uv_now(ff_dev->loop);
+    ret = ff_update(ff_dev, scale(update->amplitude, ff_dev->intensity));
+    if (ret >= 0) {
+        thread_args->queue.stats.update_writes++;
+        vibrator_app_level(thread_args,
+            scale(update->amplitude, ff_dev->intensity));
+    }
+
+    return ret;
+}
+
+/****************************************************************************
+ * Name: update_timer_cb()
+ *
+ * Description:
+ *   callback function to write the update coalesced since the last write
+ *
+ * Input Parameters:
+ *   timer - the handle of the uv timer
+ *
+ ****************************************************************************/
+
+static void update_timer_cb(uv_timer_t* timer)
+{
+    vibrator_update_flush((threadargs*)timer->data);
+}
+
+/****************************************************************************
+ * Name: vibrator_queue_insert()
+ *
+ * Description:
+ *   insert a playback request into the device queue, ordered by priority
+ *   and by arrival within the same priority. With VIBRATOR_FLAG_COALESCE
+ *   the newest waiting request of the same priority and the same client is
+ *   replaced instead, a client never discards the request of another one.
+ *   Datagram clients share their endpoint and are told apart by their
+ *   application key.
+ *
+ * Input Parameters:
+ *   queue - the device queue
+ *   msg - the request to be queued
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   OK if the request is queued, -EBUSY if the queue is full
+ *
+ ****************************************************************************/
+
+static int vibrator_queue_insert(vibrator_queue_t* queue, vibrator_msg_t* msg,
+    void* owner)
+{
+    uint64_t now = uv_now(queue->timer.loop);
+    vibrator_cmd_t* cmd;
+    uint64_t deadline = 0;
+    int i;
+
+    if (msg->deadline > 0)
+        deadline = now + msg->deadline;
+
+    if (msg->flags & VIBRATOR_FLAG_COALESCE) {
+        for (i = queue->count - 1; i >= 0; i--) {
+            cmd = &queue->cmds[i];
+            if (cmd->msg.priority == msg->priority && cmd->owner == owner
+                && cmd->msg.app == msg->app) {
+                cmd->msg = *msg;
+                cmd->deadline = deadline;
+                cmd->queued = now;
+                cmd->owner = owner;
+                queue->stats.coalesced++;
+                return OK;
+            }
+        }
+    }
+
+    if (queue->count >= CONFIG_VIBRATOR_QUEUE_DEPTH) {
+        VIBRATORWARN("device queue full, reject request type %d", msg->type);
+        queue->stats.rejected++;
+        return -EBUSY;
+    }
+
+    for (i = queue->count; i > 0; i--) {
+        if (queue->cmds[i - 1].msg.priority >= msg->priority)
+            break;
+        queue->cmds[i] = queue->cmds[i - 1];
+    }
+
+    cmd = &queue->cmds[i];
+    cmd->msg = *msg;
+    cmd->deadline = deadline;
+    cmd->queued = now;
+    cmd->owner = owner;
+
+    queue->count++;
+    queue->stats.queued++;
+    queue->stats.queue_peak = MAX(queue->stats.queue_peak, queue->count + 1);
+    return OK;
+}
+
+/****************************************************************************
+ * Name: vibrator_queue_flush()
+ *
+ * Description:
+ *   drop the requests of an application waiting on the device, those of
+ *   the other applications keep their order
+ *
+ * Input Parameters:
+ *   queue - the device queue
+ *   app - the application key of the requests to be dropped
+ *
+ ****************************************************************************/
+
+static void vibrator_queue_flush(vibrator_queue_t* queue, uint32_t app)
+{
+    int count = 0;
+
+    for (int i = 0; i < queue->count; i++) {
+        if (queue->cmds[i].msg.app != app)
+            queue->cmds[count++] = queue->cmds[i];
+    }
+
+    queue->count = count;
+    if (count == 0)
+        uv_timer_stop(&queue->timer);
+}
+
+/****************************************************************************
+ * Name: vibrator_timeline_load()
+ *
+ * Description:
+ *   load the timeline of the playback engine from a validated request,
+ *   only the steps in use are copied
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   wave - the waveform of the request
+ *   steps - number of timings and amplitudes in use
+ *
+ ****************************************************************************/
+
+static void vibrator_timeline_load(threadargs* thread_args,
+    const vibrator_waveform_t* wave, uint8_t steps)
+{
+    vibrator_waveform_t* dest = &thread_args->wave;
+
+    dest->repeat = wave->repeat;
+    dest->length = wave->length;
+    dest->count = wave->count;
+    memcpy(dest->amplitudes, wave->amplitudes, steps);
+    memcpy(dest->timings, wave->timings, steps * sizeof(uint32_t));
+
+    thread_args->timeline.steps = NULL;
+    thread_args->timeline.length = wave->length;
+    thread_args->timeline.repeat = wave->repeat;
+    thread_args->timeline.count = 0;
+}
+
+/****************************************************************************
+ * Name: check_waveform()
+ *
+ * Description:
+ *   validators of the operation table, called before a request is queued
+ *   or executed so that a queued request cannot fail on its arguments
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request to be checked
+ *
+ * Returned Value:
+ *   OK, -EINVAL if the arguments are out of range
+ *
+ ****************************************************************************/
+
+static int check_waveform(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    vibrator_waveform_t* wave = &msg->wave;
+
+    if (wave->length > WAVEFORM_MAXNUM)
+        return -EINVAL;
+
+    if ((msg->flags & VIBRATOR_FLAG_PREVALIDATED)
+        && (wave->repeat < -1 || wave->repeat >= wave->length))
+        return -EINVAL;
+
+    return OK;
+}
+
+static int check_interval(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    if (msg->wave.timings[0] == 0 || msg->wave.count < 0)
+        return -EINVAL;
+
+    return OK;
+}
+
+static int check_update(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    return thread_args->ff_dev->curr_updatable ? OK : -ENOENT;
+}
+
+static int check_rumble(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    if (!(thread_args->ff_dev->capabilities & CAP_RUMBLE))
+        return -ENOTSUP;
+
+    return msg->rumble.timeoutms == 0 ? -EINVAL : OK;
+}
+
+static int check_effect(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    return msg->effect.es > VIBRATION_DEFAULTES ? -EINVAL : OK;
+}
+
+static int check_primitive(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    float amplitude = msg->effect.amplitude;
+
+    return amplitude >= 0.0f && amplitude <= 1.0f ? OK : -EINVAL;
+}
+
+static int check_intensity(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    return msg->intensity > VIBRATION_INTENSITY_OFF ? -EINVAL : OK;
+}
+
+static int check_start_amplitude(threadargs* thread_args,
+    vibrator_msg_t* msg)
+{
+    int16_t amplitude = msg->start.amplitude;
+
+    if (amplitude < VIBRATOR_AMPLITUDE_DEVICE || amplitude > UINT8_MAX)
+        return -EINVAL;
+
+    return OK;
+}
+
+/****************************************************************************
+ * Name: op_waveform()
+ *
+ * Description:
+ *   handlers of the operation table. A handler with VIBRATOR_OP_PREEMPT is
+ *   called once the playback engine is stopped.
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request, the reply is built in place
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   the result of the request
+ *
+ ****************************************************************************/
+
+static int op_waveform(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_timeline_load(thread_args, &msg->wave, msg->wave.length);
+    return receive_waveform(thread_args);
+}
+
+static int op_interval(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_timeline_load(thread_args, &msg->wave, 2);
+    return receive_interval(thread_args);
+}
+
+static int op_effect(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    int ret;
+
+    ret = receive_predefined(thread_args->ff_dev, &msg->effect);
+    if (ret >= 0) {
+        vibrator_app_drive(thread_args,
+            thread_args->ff_dev->curr_magnitude >> 7,
+            MAX(msg->effect.play_length, 0));
+    }
+
+    return ret;
+}
+
+static int op_primitive(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    int ret;
+
+    ret = receive_primitive(thread_args->ff_dev, &msg->effect);
+    if (ret >= 0) {
+        vibrator_app_drive(thread_args,
+            thread_args->ff_dev->curr_magnitude >> 7,
+            MAX(msg->effect.play_length, 0));
+    }
+
+    return ret;
+}
+
+static int op_start(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    int ret;
+
+    msg->timeoutms = vibrator_config_limit(msg->timeoutms);
+    ret = receive_start(ff_dev, msg->timeoutms, ff_dev->curr_amplitude);
+    if (ret >= 0) {
+        vibrator_set_busy(ff_dev, msg->timeoutms);
+        vibrator_app_drive(thread_args,
+            scale(ff_dev->curr_amplitude, ff_dev->intensity), msg->timeoutms);
+    }
+
+    return ret;
+}
+
+static int op_start_amplitude(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    vibrator_start_t* start = &msg->start;
+    uint8_t amplitude;
+    int ret;
+
+    amplitude = start->amplitude < 0 ? ff_dev->curr_amplitude
+                                     : start->amplitude;
+    start->timeoutms = vibrator_config_limit(start->timeoutms);
+
+    /* like a silent waveform step, a one-shot scaled to zero rests for its
+       duration instead of driving the actuator at zero */
+
+    if (start->timeoutms != 0 && should_vibrate(ff_dev->intensity)
+        && scale(amplitude, ff_dev->intensity) == 0) {
+        vibrator_set_busy(ff_dev, start->timeoutms);
+        vibrator_app_drive(thread_args, 0, start->timeoutms);
+        return OK;
+    }
+
+    ret = receive_start(ff_dev, start->timeoutms, amplitude);
+    if (ret >= 0) {
+        vibrator_set_busy(ff_dev, start->timeoutms);
+        vibrator_app_drive(thread_args, scale(amplitude, ff_dev->intensity),
+            start->timeoutms);
+    }
+
+    return ret;
+}
+
+static int op_stop(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    int ret;
+
+    /* the requests queued by other applications play once the device
+       stops, a playback that never ends would hold them forever */
+
+    vibrator_queue_flush(&thread_args->queue, msg->app);
+    ret = receive_stop(thread_args->ff_dev);
+    vibrator_queue_dispatch(thread_args);
+    return ret;
+}
+
+static int op_set_amplitude(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    int ret;
+
+    ret = receive_set_amplitude(ff_dev, msg->amplitude);
+    if (ret >= 0)
+        vibrator_app_level(thread_args,
+            scale(msg->amplitude, ff_dev->intensity));
+
+    return ret;
+}
+
+static int op_get_capabilities(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    return receive_get_capabilities(thread_args->ff_dev, &msg->capabilities);
+}
+
+static int op_set_intensity(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    return receive_set_intensity(thread_args->ff_dev, msg->intensity);
+}
+
+static int op_get_intensity(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    return receive_get_intensity(thread_args->ff_dev,
+        (vibrator_intensity_e*)&msg->intensity);
+}
+
+static int op_get_status(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    return OK;
+}
+
+static int op_get_stats(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    return receive_get_stats(thread_args, &msg->stats);
+}
+
+static int op_get_state(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    return receive_get_state(thread_args, &msg->state);
+}
+
+static int op_rumble(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    vibrator_rumble_t* rumble = &msg->rumble;
+    int ret;
+
+    if (!should_vibrate(ff_dev->intensity))
+        return -ENOTSUP;
+
+    rumble->timeoutms = vibrator_config_limit(rumble->timeoutms);
+    ret = ff_rumble(ff_dev, rumble->timeoutms,
+        scale(rumble->strong, ff_dev->intensity),
+        scale(rumble->weak, ff_dev->intensity));
+    if (ret >= 0) {
+        vibrator_set_busy(ff_dev, rumble->timeoutms);
+        vibrator_app_drive(thread_args,
+            scale(MAX(rumble->strong, rumble->weak), ff_dev->intensity),
+            rumble->timeoutms);
+    }
+
+    return ret;
+}
+
+static int op_update(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_update_t* update = &thread_args->update;
+    uint64_t now = uv_now(thread_args->ff_dev->loop);
+
+    thread_args->queue.stats.updates++;
+    update->amplitude = msg->amplitude;
+
+    /* a write is already due, it takes the newest level */
+
+    if (uv_is_active((uv_handle_t*)&update->timer))
+        return OK;
+
+    if (now - update->last >= CONFIG_VIBRATOR_UPDATE_INTERVAL)
+        return vibrator_update_flush(thread_args);
+
+    return uv_timer_start(&update->timer, update_timer_cb,
+        update->last + CONFIG_VIBRATOR_UPDATE_INTERVAL - now, 0);
+}
+
+/****************************************************************************
+ * Name: vibrator_register_op()
+ *
+ * Description:
+ *   add the descriptor of an operation type, so that a feature brings its
+ *   own request without touching the dispatch
+ *
+ * Input Parameters:
+ *   type - the request type
+ *   validate - the validator, may be NULL
+ *   handle - the handler
+ *   flags - VIBRATOR_OP_*
+ *
+ * Returned Value:
+ *   OK, -EINVAL if the type is out of range, -EEXIST if it is taken
+ *
+ ****************************************************************************/
+
+static int vibrator_register_op(uint8_t type, vibrator_op_validate_t validate,
+    vibrator_op_handle_t handle, uint8_t flags)
+{
+    vibrator_op_t* op;
+
+    if (type == VIBRATION_NONE || type >= VIBRATOR_OP_MAX || handle == NULL)
+        return -EINVAL;
+
+    op = &g_vibrator_ops[type];
+    if (op->handle != NULL)
+        return -EEXIST;
+
+    op->validate = validate;
+    op->handle = handle;
+    op->flags = flags;
+    return OK;
+}
+
+/****************************************************************************
+ * Name: vibrator_op_get()
+ *
+ * Description:
+ *   find the descriptor of a request type
+ *
+ * Input Parameters:
+ *   type - the request type
+ *
+ * Returned Value:
+ *   the descriptor, NULL if the type is not registered
+ *
+ ****************************************************************************/
+
+static const vibrator_op_t* vibrator_op_get(uint8_t type)
+{
+    if (type >= VIBRATOR_OP_MAX || g_vibrator_ops[type].handle == NULL)
+        return NULL;
+
+    return &g_vibrator_ops[type];
+}
+
+/****************************************************************************
+ * Name: vibrator_is_playback()
+ *
+ * Description:
+ *   confirm whether the request occupies the device
+ *
+ * Input Parameters:
+ *   type - the request type
+ *
+ * Returned Value:
+ *   true: playback request, false: control or query request
+ *
+ ****************************************************************************/
+
+static bool vibrator_is_playback(uint8_t type)
+{
+    const vibrator_op_t* op = vibrator_op_get(type);
+
+    return op != NULL && (op->flags & VIBRATOR_OP_PLAYBACK);
+}
+
+#if CONFIG_VIBRATOR_HISTORY > 0
+/****************************************************************************
+ * Name: vibrator_history_hash()
+ *
+ * Description:
+ *   FNV-1a hash of the parameters of a request, taken before its reply is
+ *   built in place
+ *
+ * Input Parameters:
+ *   msg - the request
+ *
+ * Returned Value:
+ *   the hash
+ *
+ ****************************************************************************/
+
+static uint32_t vibrator_history_hash(const vibrator_msg_t* msg)
+{
+    const uint8_t* data = (const uint8_t*)msg;
+    size_t len = MIN(msg->request_len, sizeof(vibrator_msg_t));
+    uint32_t hash = VIBRATOR_FNV_BASIS;
+
+    for (size_t i = VIBRATOR_MSG_HEADER; i < len; i++)
+        hash = (hash ^ data[i]) * VIBRATOR_FNV_PRIME;
+
+    return hash;
+}
+
+/****************************************************************************
+ * Name: vibrator_history_record()
+ *
+ * Description:
+ *   write a playback or stop request over the oldest record of the ring,
+ *   other requests are not recorded
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request
+ *   owner - the connection the request arrived on
+ *   hash - the hash of the parameters of the request
+ *   queued - the time the request entered the queue, 0 if it did not wait
+ *   start - the uv_hrtime() its execution started at, 0 if not executed
+ *   result - the result of the request
+ *
+ ****************************************************************************/
+
+static void vibrator_history_record(threadargs* thread_args,
+    const vibrator_msg_t* msg, void* owner, uint32_t hash, uint64_t queued,
+    uint64_t start, int result)
+{
+    const vibrator_op_t* op = vibrator_op_get(msg->type);
+    uint64_t now = uv_now(thread_args->ff_dev->loop);
+    vibrator_history_t* entry;
+
+    if (op == NULL || op->flags == 0)
+        return;
+
+    entry = &thread_args->history[thread_args->history_seq
+        % CONFIG_VIBRATOR_HISTORY];
+    entry->time_ms = now;
+    entry->client = (uintptr_t)owner;
+    entry->hash = hash;
+    entry->latency_us = start > 0 ? (uv_hrtime() - start) / 1000 : 0;
+    entry->wait_ms = queued > 0 ? MIN(now - queued, UINT16_MAX) : 0;
+    entry->result = result;
+    entry->type = msg->type;
+    entry->priority = msg->priority;
+    entry->preempted_by = VIBRATION_NONE;
+    thread_args->history_seq++;
+
+    if (result >= 0 && (op->flags & VIBRATOR_OP_PLAYBACK))
+        thread_args->history_active = thread_args->history_seq;
+}
+
+/****************************************************************************
+ * Name: vibrator_history_preempt()
+ *
+ * Description:
+ *   mark the record of the active playback as interrupted, unless the ring
+ *   has moved past it
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   type - the type of the interrupting request
+ *
+ ****************************************************************************/
+
+static void vibrator_history_preempt(threadargs* thread_args, uint8_t type)
+{
+    uint32_t active = thread_args->history_active;
+
+    if (active == 0
+        || thread_args->history_seq - active >= CONFIG_VIBRATOR_HISTORY)
+        return;
+
+    thread_args->history[(active - 1) % CONFIG_VIBRATOR_HISTORY].preempted_by
+        = type;
+    thread_args->history_active = 0;
+}
+
+/****************************************************************************
+ * Name: op_get_history()
+ *
+ * Description:
+ *   read a page of the history, newest record first
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request, the reply is built in place
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   OK
+ *
+ ****************************************************************************/
+
+static int op_get_history(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_history_page_t* page = &msg->history;
+    uint32_t seq = thread_args->history_seq;
+    uint32_t count = MIN(seq, CONFIG_VIBRATOR_HISTORY);
+
+    page->count = 0;
+    for (uint32_t i = page->start; i < count
+        && page->count < VIBRATOR_HISTORY_PAGE; i++) {
+        page->entries[page->count++]
+            = thread_args->history[(seq - 1 - i) % CONFIG_VIBRATOR_HISTORY];
+    }
+
+    return OK;
+}
+
+/****************************************************************************
+ * Name: vibrator_history_init()
+ *
+ * Description:
+ *   register the operation that reads the history
+ *
+ * Returned Value:
+ *   OK, a negated errno if the operation type is taken
+ *
+ ****************************************************************************/
+
+static int vibrator_history_init(void)
+{
+    return vibrator_register_op(VIBRATION_GET_HISTORY, NULL, op_get_history, 0);
+}
+#endif
+
+#if CONFIG_VIBRATOR_APPS > 0
+/****************************************************************************
+ * Name: vibrator_app_count()
+ *
+ * Description:
+ *   count a playback or stop request and its failure to its application,
+ *   other requests are not counted
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request, its result is set
+ *
+ ****************************************************************************/
+
+static void vibrator_app_count(threadargs* thread_args,
+    const vibrator_msg_t* msg)
+{
+    const vibrator_op_t* op = vibrator_op_get(msg->type);
+    vibrator_app_t* app;
+
+    if (op == NULL || op->flags == 0)
+        return;
+
+    app = vibrator_app_get(thread_args, msg->app);
+    app->stats.requests++;
+    if (msg->result < 0)
+        app->stats.errors++;
+}
+
+/****************************************************************************
+ * Name: check_app_tag()
+ *
+ * Description:
+ *   a tag is declared under the key hashed from it, keys taken from the
+ *   credentials of a client keep their name
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request
+ *
+ * Returned Value:
+ *   OK, -EINVAL if the key of the request is not a hashed tag
+ *
+ ****************************************************************************/
+
+static int check_app_tag(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    if (msg->app == VIBRATOR_APP_UNKNOWN || (msg->app & VIBRATOR_APP_PID))
+        return -EINVAL;
+
+    return OK;
+}
+
+/****************************************************************************
+ * Name: op_app_tag()
+ *
+ * Description:
+ *   name the application of the request with the tag it declared
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   OK
+ *
+ ****************************************************************************/
+
+static int op_app_tag(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_app_t* app = vibrator_app_get(thread_args, msg->app);
+
+    msg->app_tag[VIBRATOR_APP_TAG_MAX - 1] = '\0';
+    strlcpy(app->stats.tag, msg->app_tag, VIBRATOR_APP_TAG_MAX);
+    return OK;
+}
+
+/****************************************************************************
+ * Name: op_get_apps()
+ *
+ * Description:
+ *   read a page of the usage of the applications on the device, the
+ *   segment being driven is charged first
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request, the reply is built in place
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   OK
+ *
+ ****************************************************************************/
+
+static int op_get_apps(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_app_page_t* page = &msg->apps;
+    uint32_t index = 0;
+    int i;
+
+    vibrator_app_meter(thread_args);
+
+    page->count = 0;
+    for (i = 0; i < CONFIG_VIBRATOR_APPS
+        && page->count < VIBRATOR_APP_PAGE; i++) {
+        if (!thread_args->apps[i].used)
+            continue;
+
+        if (index++ >= page->start)
+            page->entries[page->count++] = thread_args->apps[i].stats;
+    }
+
+    return OK;
+}
+
+/****************************************************************************
+ * Name: op_reset_apps()
+ *
+ * Description:
+ *   clear the counters of the applications on the device, their keys and
+ *   tags are kept
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   OK
+ *
+ ****************************************************************************/
+
+static int op_reset_apps(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_app_t* app;
+    int i;
+
+    vibrator_app_meter(thread_args);
+
+    for (i = 0; i < CONFIG_VIBRATOR_APPS; i++) {
+        app = &thread_args->apps[i];
+        app->energy = 0;
+        app->stats.requests = 0;
+        app->stats.errors = 0;
+        app->stats.on_ms = 0;
+        app->stats.energy = 0;
+    }
+
+    return OK;
+}
+
+/****************************************************************************
+ * Name: vibrator_apps_init()
+ *
+ * Description:
+ *   register the operations that tag applications and read their usage
+ *
+ * Returned Value:
+ *   OK, a negated errno if an operation type is taken
+ *
+ ****************************************************************************/
+
+static int vibrator_apps_init(void)
+{
+    int ret;
+
+    ret = vibrator_register_op(VIBRATION_APP_TAG, check_app_tag, op_app_tag,
+        0);
+    if (ret < 0)
+        return ret;
+
+    ret = vibrator_register_op(VIBRATION_GET_APPS, NULL, op_get_apps, 0);
+    if (ret < 0)
+        return ret;
+
+    return vibrator_register_op(VIBRATION_RESET_APPS, NULL, op_reset_apps, 0);
+}
+#endif
+
+/****************************************************************************
+ * Name: vibrator_op_execute()
+ *
+ * Description:
+ *   execute a request with the handler of its type
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request, the reply is built in place
+ *   owner - the connection the request arrived on
+ *   queued - the time the request entered the queue, 0 if it did not wait
+ *
+ * Returned Value:
+ *   the result of the handler, -EINVAL if the type is not registered
+ *
+ ****************************************************************************/
+
+static int vibrator_op_execute(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner, uint64_t queued)
+{
+    const vibrator_op_t* op = vibrator_op_get(msg->type);
+#if CONFIG_VIBRATOR_HISTORY > 0
+    uint32_t hash = vibrator_history_hash(msg);
+    uint64_t start = uv_hrtime();
+#endif
+    int ret;
+
+    if (op == NULL)
+        return -EINVAL;
+
+    if (op->flags & VIBRATOR_OP_PREEMPT) {
+#if CONFIG_VIBRATOR_HISTORY > 0
+        if (vibrator_busy_remaining(thread_args->ff_dev) > 0)
+            vibrator_history_preempt(thread_args, msg->type);
+#endif
+        vibrator_engine_stop(thread_args);
+    }
+
+    if (op->flags & VIBRATOR_OP_PLAYBACK)
+        vibrator_app_activate(thread_args, msg->app);
+
+    ret = op->handle(thread_args, msg, owner);
+    VIBRATORINFO("execute type %d ret = %d", msg->type, ret);
+#if CONFIG_VIBRATOR_HISTORY > 0
+    vibrator_history_record(thread_args, msg, owner, hash, queued, start, ret);
+#endif
+    return ret;
+}
+
+/****************************************************************************
+ * Name: vibrator_queue_execute()
+ *
+ * Description:
+ *   execute a playback request on the device, preempting the active one
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request to be executed
+ *   owner - the connection the request arrived on
+ *   queued - the time the request entered the queue, 0 if it did not wait
+ *
+ * Returned Value:
+ *   return the vibrator_op_execute value
+ *
+ ****************************************************************************/
+
+static int vibrator_queue_execute(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner, uint64_t queued)
+{
+    vibrator_queue_t* queue = &thread_args->queue;
+
+    if (vibrator_busy_remaining(thread_args->ff_dev) > 0)
+        queue->stats.preempted++;
+
+    queue->active_priority = msg->priority;
+    queue->active_owner = owner;
+    queue->active_token = msg->token;
+    return vibrator_op_execute(thread_args, msg, owner, queued);
+}
+
+/****************************************************************************
+ * Name: vibrator_queue_dispatch()
+ *
+ * Description:
+ *   start the next waiting request once the device is idle, dropping the
+ *   requests whose deadline has passed, and arm the queue timer for the
+ *   end of the playback that was started
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *
+ ****************************************************************************/
+
+static void vibrator_queue_dispatch(threadargs* thread_args)
+{
+    vibrator_queue_t* queue = &thread_args->queue;
+    ff_dev_t* ff_dev = thread_args->ff_dev;
+    vibrator_cmd_t* cmd = &queue->cmds[0];
+    uint64_t remaining;
+
+    while (queue->count > 0) {
+        remaining = vibrator_busy_remaining(ff_dev);
+        if (remaining > 0)
+            break;
+
+        /* the request is executed from the queue, the handler loads what
+           it keeps before the entry is dropped */
+
+        if (cmd->deadline > 0 && cmd->deadline < uv_now(ff_dev->loop)) {
+            VIBRATORINFO("queued request type %d expired", cmd->msg.type);
+            queue->stats.expired++;
+#if CONFIG_VIBRATOR_HISTORY > 0
+            vibrator_history_record(thread_args, &cmd->msg, cmd->owner,
+                vibrator_history_hash(&cmd->msg), cmd->queued, 0, -ETIMEDOUT);
+#endif
+        } else {
+
+            /* the result is kept in the history, the client was answered
+               when the request was queued */
+
+            VIBRATORINFO("dispatch queued request type %d", cmd->msg.type);
+            vibrator_queue_execute(thread_args, &cmd->msg, cmd->owner,
+                cmd->queued);
+        }
+
+        queue->count--;
+        memmove(&queue->cmds[0], &queue->cmds[1],
+            queue->count * sizeof(vibrator_cmd_t));
+    }
+
+    remaining = vibrator_busy_remaining(ff_dev);
+    if (queue->count > 0 && ff_dev->busy_until != VIBRATOR_BUSY_FOREVER)
+        uv_timer_start(&queue->timer, queue_timer_cb, remaining, 0);
+    else
+        uv_timer_stop(&queue->timer);
+}
+
+/****************************************************************************
+ * Name: queue_timer_cb()
+ *
+ * Description:
+ *   callback function invoked when the active playback is expected to end
+ *
+ * Input Parameters:
+ *   timer - the handle of the uv timer
+ *
+ ****************************************************************************/
+
+static void queue_timer_cb(uv_timer_t* timer)
+{
+    vibrator_queue_dispatch(timer->data);
+}
+
+/****************************************************************************
+ * Name: vibrator_registry_add()
+ *
+ * Description:
+ *   store a playback request so that its owner can play it by handle
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the playback request to be registered
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   the handle of the registered request, -ENOSPC if the registry is full
+ *
+ ****************************************************************************/
+
+static int vibrator_registry_add(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_registry_t* entry;
+
+    if (!vibrator_is_playback(msg->type))
+        return -EINVAL;
+
+    for (int i = 0; i < CONFIG_VIBRATOR_REGISTRY_SIZE; i++) {
+        entry = &thread_args->registry[i];
+        if (entry->owner == NULL) {
+            entry->owner = owner;
+            entry->msg = *msg;
+            entry->msg.flags &= ~VIBRATOR_FLAG_REGISTER;
+            return i;
+        }
+    }
+
+    VIBRATORWARN("registry full, reject request type %d", msg->type);
+    return -ENOSPC;
+}
+
+/****************************************************************************
+ * Name: vibrator_registry_get()
+ *
+ * Description:
+ *   find a registered request of a connection
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   handle - the handle returned by vibrator_registry_add
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   the registered entry, NULL if the handle is not owned by the connection
+ *
+ ****************************************************************************/
+
+static vibrator_registry_t* vibrator_registry_get(threadargs* thread_args,
+    int32_t handle, void* owner)
+{
+    if (handle < 0 || handle >= CONFIG_VIBRATOR_REGISTRY_SIZE
+        || thread_args->registry[handle].owner != owner)
+        return NULL;
+
+    return &thread_args->registry[handle];
+}
+
+/****************************************************************************
+ * Name: vibrator_play_handle()
+ *
+ * Description:
+ *   turn a VIBRATION_PLAY_HANDLE request into the registered playback
+ *   request, keeping the scheduling fields and the token of its header
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request, rewritten in place
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   OK, -EINVAL if the handle is unknown
+ *
+ ****************************************************************************/
+
+static int vibrator_play_handle(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_registry_t* entry;
+
+    entry = vibrator_registry_get(thread_args, msg->handle, owner);
+    if (entry == NULL)
+        return -EINVAL;
+
+    msg->type = entry->msg.type;
+    msg->flags |= entry->msg.flags & VIBRATOR_FLAG_PREVALIDATED;
+    memcpy((uint8_t*)msg + VIBRATOR_MSG_HEADER,
+        (uint8_t*)&entry->msg + VIBRATOR_MSG_HEADER,
+        sizeof(vibrator_msg_t) - VIBRATOR_MSG_HEADER);
+    return OK;
+}
+
+/****************************************************************************
+ * Name: vibrator_cancel_token()
+ *
+ * Description:
+ *   stop the playback started with a token, or drop it from the queue. The
+ *   playback started afterwards by any request is left untouched.
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   token - the token of the playback
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   OK if the playback was stopped or dropped, -ESRCH if it is not current
+ *
+ ****************************************************************************/
+
+static int vibrator_cancel_token(threadargs* thread_args, uint32_t token,
+    void* owner)
+{
+    vibrator_queue_t* queue = &thread_args->queue;
+    int ret = -ESRCH;
+    int i;
+
+    for (i = 0; i < queue->count; i++) {
+        if (queue->cmds[i].owner == owner && queue->cmds[i].msg.token == token) {
+            queue->count--;
+            memmove(&queue->cmds[i], &queue->cmds[i + 1],
+                (queue->count - i) * sizeof(vibrator_cmd_t));
+            return OK;
+        }
+    }
+
+    if (queue->active_owner == owner && queue->active_token == token
+        && vibrator_busy_remaining(thread_args->ff_dev) > 0) {
+#if CONFIG_VIBRATOR_HISTORY > 0
+        vibrator_history_preempt(thread_args, VIBRATION_CANCEL_TOKEN);
+#endif
+        vibrator_engine_stop(thread_args);
+        ret = receive_stop(thread_args->ff_dev);
+        queue->active_owner = NULL;
+    }
+
+    return ret;
+}
+
+#if CONFIG_VIBRATOR_REGIONS > 0
+/****************************************************************************
+ * Name: vibrator_region_get()
+ *
+ * Description:
+ *   find a shared memory region of a connection
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   region - the handle returned when the region was registered
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   the region, NULL if the handle is not owned by the connection
+ *
+ ****************************************************************************/
+
+static vibrator_shm_t* vibrator_region_get(threadargs* thread_args,
+    int32_t region, void* owner)
+{
+    if (region < 0 || region >= CONFIG_VIBRATOR_REGIONS
+        || thread_args->regions[region].steps == NULL
+        || thread_args->regions[region].owner != owner)
+        return NULL;
+
+    return &thread_args->regions[region];
+}
+
+/****************************************************************************
+ * Name: vibrator_region_unmap()
+ *
+ * Description:
+ *   unmap a shared memory region, stopping the playback that reads from it
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   shm - the region
+ *
+ ****************************************************************************/
+
+static void vibrator_region_unmap(threadargs* thread_args, vibrator_shm_t* shm)
+{
+    vibrator_timeline_t* timeline = &thread_args->timeline;
+
+    if (timeline->steps >= shm->steps
+        && timeline->steps < shm->steps + shm->count) {
+        vibrator_engine_stop(thread_args);
+        receive_stop(thread_args->ff_dev);
+        timeline->steps = NULL;
+        timeline->length = 0;
+    }
+
+    munmap((void*)shm->steps, shm->count * sizeof(vibrator_step_t));
+    shm->steps = NULL;
+    shm->owner = NULL;
+}
+
+/****************************************************************************
+ * Name: check_region()
+ *
+ * Description:
+ *   validators of the region operations
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request to be checked
+ *
+ * Returned Value:
+ *   OK, -EINVAL if the arguments are out of range, -EPERM if the name is
+ *   outside VIBRATOR_REGION_PREFIX
+ *
+ ****************************************************************************/
+
+static int check_region(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    vibrator_region_t* region = &msg->region;
+
+    if (region->size == 0 || region->size % sizeof(vibrator_step_t) != 0
+        || strnlen(region->name, sizeof(region->name)) == sizeof(region->name))
+        return -EINVAL;
+
+    /* the object is opened with the privileges of the server, a client
+       only names the objects set apart for it */
+
+    if (strncmp(region->name, VIBRATOR_REGION_PREFIX,
+            sizeof(VIBRATOR_REGION_PREFIX) - 1) != 0
+        || strchr(region->name + 1, '/') != NULL)
+        return -EPERM;
+
+    return OK;
+}
+
+static int check_play_region(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    vibrator_region_play_t* play = &msg->region_play;
+    vibrator_shm_t* shm;
+
+    if (play->region < 0 || play->region >= CONFIG_VIBRATOR_REGIONS)
+        return -EINVAL;
+
+    shm = &thread_args->regions[play->region];
+    if (shm->steps == NULL || play->length == 0 || play->length > INT16_MAX
+        || play->offset > shm->count || play->length > shm->count - play->offset
+        || play->repeat < -1 || play->repeat >= (int32_t)play->length)
+        return -EINVAL;
+
+    return OK;
+}
+
+/****************************************************************************
+ * Name: op_register_region()
+ *
+ * Description:
+ *   handlers of the region operations. A region is mapped read-only and
+ *   played in place, its steps are read again at every step boundary.
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request, the reply is built in place
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   the result of the request
+ *
+ ****************************************************************************/
+
+static int op_register_region(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_shm_t* shm;
+    struct stat st;
+    void* base;
+    int fd;
+
+    for (int i = 0; i < CONFIG_VIBRATOR_REGIONS; i++) {
+        shm = &thread_args->regions[i];
+        if (shm->steps != NULL)
+            continue;
+
+        fd = shm_open(msg->region.name, O_RDONLY, 0);
+        if (fd < 0) {
+            VIBRATORERR("shm_open %s failed, errno = %d", msg->region.name, errno);
+            return -errno;
+        }
+
+        /* a mapping beyond the end of the object faults when it is read */
+
+        if (fstat(fd, &st) < 0 || msg->region.size > st.st_size) {
+            VIBRATORERR("region %s smaller than %" PRIu32, msg->region.name,
+                msg->region.size);
+            close(fd);
+            return -EINVAL;
+        }
+
+        base = mmap(NULL, msg->region.size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            VIBRATORERR("mmap %s failed, errno = %d", msg->region.name, errno);
+            return -errno;
+        }
+
+        shm->steps = base;
+        shm->count = msg->region.size / sizeof(vibrator_step_t);
+        shm->owner = owner;
+        return i;
+    }
+
+    VIBRATORWARN("no region left, reject %s", msg->region.name);
+    return -ENOSPC;
+}
+
+static int op_release_region(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_shm_t* shm;
+
+    shm = vibrator_region_get(thread_args, msg->handle, owner);
+    if (shm == NULL)
+        return -EINVAL;
+
+    vibrator_region_unmap(thread_args, shm);
+    return OK;
+}
+
+static int op_play_region(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    vibrator_region_play_t* play = &msg->region_play;
+    vibrator_timeline_t* timeline = &thread_args->timeline;
+    vibrator_shm_t* shm;
+
+    /* the region may have been released while the request was queued */
+
+    shm = vibrator_region_get(thread_args, play->region, owner);
+    if (shm == NULL || check_play_region(thread_args, msg) < 0)
+        return -EINVAL;
+
+    timeline->steps = shm->steps + play->offset;
+    timeline->length = play->length;
+    timeline->repeat = play->repeat;
+    timeline->count = 0;
+    return receive_waveform(thread_args);
+}
+
+/****************************************************************************
+ * Name: vibrator_region_init()
+ *
+ * Description:
+ *   register the operations of the shared memory regions
+ *
+ * Returned Value:
+ *   OK, a negated errno if an operation type is taken
+ *
+ ****************************************************************************/
+
+static int vibrator_region_init(void)
+{
+    int ret;
+
+    ret = vibrator_register_op(VIBRATION_REGISTER_REGION, check_region,
+        op_register_region, 0);
+    if (ret < 0)
+        return ret;
+
+    ret = vibrator_register_op(VIBRATION_RELEASE_REGION, NULL,
+        op_release_region, 0);
+    if (ret < 0)
+        return ret;
+
+    return vibrator_register_op(VIBRATION_PLAY_REGION, check_play_region,
+        op_play_region, VIBRATOR_OP_PLAYBACK | VIBRATOR_OP_PREEMPT);
+}
+#endif
+
+#if CONFIG_VIBRATOR_ALWAYS_ON > 0
+/****************************************************************************
+ * Name: ff_always_on()
+ *
+ * Description:
+ *   upload a predefined effect bound to a hardware trigger of the driver.
+ *   It is never played from here, the driver plays it on the trigger
+ *   without waking the AP. An effect already bound to the same always-on
+ *   id is updated in place.
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   always_on - the always-on id, trigger, effect id and strength
+ *
+ * Returned Value:
+ *   return the ret of ioctl
+ *
+ ****************************************************************************/
+
+static int ff_always_on(ff_dev_t* ff_dev, vibrator_always_on_t* always_on)
+{
+    int16_t data[VIBRATOR_CUSTOM_DATA_LEN] = { always_on->effect_id, 0, 0 };
+    struct ff_effect effect;
+    int ret;
+
+    memset(&effect, 0, sizeof(effect));
+    effect.type = FF_PERIODIC;
+    effect.id = ff_dev->always_on_id[always_on->id];
+    effect.trigger.button = always_on->trigger;
+    effect.u.periodic.waveform = FF_CUSTOM;
+    effect.u.periodic.custom_data = data;
+    effect.u.periodic.custom_len = sizeof(int16_t) * VIBRATOR_CUSTOM_DATA_LEN;
+
+    effect.u.periodic.magnitude = vibrator_config_strength(
+        MIN(always_on->es, VIBRATION_STRONG));
+
+    ret = ff_ioctl(ff_dev, EVIOCSFF, (unsigned long)&effect);
+    if (ret < 0) {
+        VIBRATORERR("ioctl EVIOCSFF always-on failed, errno = %d", errno);
+        return ret;
+    }
+
+    ff_dev->always_on_id[always_on->id] = effect.id;
+    return OK;
+}
+
+/****************************************************************************
+ * Name: ff_always_off()
+ *
+ * Description:
+ *   remove the effect bound to an always-on id, the trigger is released
+ *
+ * Input Parameters:
+ *   ff_dev - structure for operating the ff device driver
+ *   id - the always-on id
+ *
+ * Returned Value:
+ *   return the ret of ioctl
+ *
+ ****************************************************************************/
+
+static int ff_always_off(ff_dev_t* ff_dev, uint8_t id)
+{
+    int ret;
+
+    if (ff_dev->always_on_id[id] == VIBRATOR_INVALID_VALUE)
+        return OK;
+
+    ret = ff_ioctl(ff_dev, EVIOCRMFF, (unsigned long)ff_dev->always_on_id[id]);
+    if (ret < 0) {
+        VIBRATORERR("ioctl EVIOCRMFF always-on failed, errno = %d", errno);
+        return ret;
+    }
+
+    ff_dev->always_on_id[id] = VIBRATOR_INVALID_VALUE;
+    return OK;
+}
+
+/****************************************************************************
+ * Name: check_always_on()
+ *
+ * Description:
+ *   validator of the always-on operations
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request to be checked
+ *
+ * Returned Value:
+ *   OK, -ENOTSUP without CAP_ALWAYS_ON_CONTROL, -EINVAL if the arguments
+ *   are out of range
+ *
+ ****************************************************************************/
+
+static int check_always_on(threadargs* thread_args, vibrator_msg_t* msg)
+{
+    if (!(thread_args->ff_dev->capabilities & CAP_ALWAYS_ON_CONTROL))
+        return -ENOTSUP;
+
+    if (msg->always_on.id >= CONFIG_VIBRATOR_ALWAYS_ON)
+        return -EINVAL;
+
+    if (msg->type == VIBRATION_ALWAYS_ON_ENABLE
+        && msg->always_on.es > VIBRATION_DEFAULTES)
+        return -EINVAL;
+
+    return OK;
+}
+
+/****************************************************************************
+ * Name: op_always_on_enable()
+ *
+ * Description:
+ *   handlers of the always-on operations. The effects are not owned by a
+ *   connection, they stay armed until they are disabled.
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   the result of the request
+ *
+ ****************************************************************************/
+
+static int op_always_on_enable(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    return ff_always_on(thread_args->ff_dev, &msg->always_on);
+}
+
+static int op_always_on_disable(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    return ff_always_off(thread_args->ff_dev, msg->always_on.id);
+}
+
+/****************************************************************************
+ * Name: vibrator_always_on_init()
+ *
+ * Description:
+ *   register the operations of the always-on effects
+ *
+ * Returned Value:
+ *   OK, a negated errno if an operation type is taken
+ *
+ ****************************************************************************/
+
+static int vibrator_always_on_init(void)
+{
+    int ret;
+
+    ret = vibrator_register_op(VIBRATION_ALWAYS_ON_ENABLE, check_always_on,
+        op_always_on_enable, 0);
+    if (ret < 0)
+        return ret;
+
+    return vibrator_register_op(VIBRATION_ALWAYS_ON_DISABLE, check_always_on,
+        op_always_on_disable, 0);
+}
+#endif
+
+/****************************************************************************
+ * Name: vibrator_session_release()
+ *
+ * Description:
+ *   release the registered requests, regions and queued playbacks of a
+ *   closed session, and forget it as the owner of the other queued
+ *   requests and of the active playback
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   owner - the closed connection
+ *
+ ****************************************************************************/
+
+static void vibrator_session_release(threadargs* thread_args, void* owner)
+{
+    vibrator_queue_t* queue = &thread_args->queue;
+    int count = 0;
+
+    for (int i = 0; i < CONFIG_VIBRATOR_REGISTRY_SIZE; i++) {
+        if (thread_args->registry[i].owner == owner)
+            thread_args->registry[i].owner = NULL;
+    }
+
+#if CONFIG_VIBRATOR_REGIONS > 0
+    for (int i = 0; i < CONFIG_VIBRATOR_REGIONS; i++) {
+        if (thread_args->regions[i].steps != NULL
+            && thread_args->regions[i].owner == owner)
+            vibrator_region_unmap(thread_args, &thread_args->regions[i]);
+    }
+#endif
+
+    /* the asynchronous playbacks of the session carry a token and are
+       dropped with it, a plain request still plays after its one-shot
+       connection closed */
+
+    for (int i = 0; i < queue->count; i++) {
+        if (queue->cmds[i].owner == owner) {
+            if (queue->cmds[i].msg.token != 0)
+                continue;
+
+            queue->cmds[i].owner = NULL;
+        }
+
+        queue->cmds[count++] = queue->cmds[i];
+    }
+
+    queue->count = count;
+    if (count == 0)
+        uv_timer_stop(&queue->timer);
+
+    if (queue->active_owner == owner)
+        queue->active_owner = NULL;
+}
+
+/****************************************************************************
+ * Name: op_unregister()
+ *
+ * Description:
+ *   handlers of the session operations
+ *
+ * Input Parameters:
+ *   thread_args - the threadargs of the device
+ *   msg - the request, the reply is built in place
+ *   owner - the connection the request arrived on
+ *
+ * Returned Value:
+ *   the result of the request
+ *
+ ****************************************************************************/
+
+static int op_unregister(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    if (vibrator_registry_get(thread_args, msg->handle, owner) == NULL)
+        return -EINVAL;
+
+    thread_args->registry[msg->handle].owner = NULL;
+    return OK;
+}
+
+static int op_cancel_token(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    int ret;
+
+    ret = vibrator_cancel_token(thread_args, msg->token, owner);
+    vibrator_queue_dispatch(thread_args);
+    return ret;
+}
+
+/****************************************************************************
+ * Name: vibrator_session_init()
+ *
+ * Description:
+ *   register the operations of the sessions. VIBRATION_PLAY_HANDLE has no
+ *   descriptor, it is resolved to the registered request before dispatch.
+ *
+ * Returned Value:
+ *   OK, a negated errno if an operation type is taken
+ *
+ ****************************************************************************/
+
+static int vibrator_session_init(void)
+{
+    int ret;
+
+    ret = vibrator_register_op(VIBRATION_UNREGISTER, NULL, op_unregister, 0);
+    if (ret < 0)
+        return ret;
+
+    return vibrator_register_op(VIBRATION_CANCEL_TOKEN, NULL,
+        op_cancel_token, 0);
+}
+
+#ifdef CONFIG_VIBRATOR_POLICY
+/****************************************************************************
+ * Name: vibrator_policy_categories()
+ *
+ * Description:
+ *   compile a comma separated list of category names into a mask, unknown
+ *   names are skipped
+ *
+ * Input Parameters:
+ *   list - the list, modified in place
+ *
+ * Returned Value:
+ *   the mask of the categories, bit n for vibrator_category_e n
+ *
+ ****************************************************************************/
+
+static uint32_t vibrator_policy_categories(char* list)
+{
+    uint32_t mask = 0;
+    char* save = NULL;
+    char* name;
+    size_t i;
+
+    for (name = strtok_r(list, ", ", &save); name != NULL;
+         name = strtok_r(NULL, ", ", &save)) {
+        for (i = 0; i < nitems(g_vibrator_categories); i++) {
+            if (strcmp(name, g_vibrator_categories[i]) == 0)
+                break;
+        }
+
+        if (i < nitems(g_vibrator_categories))
+            mask |= 1u << i;
+        else
+            VIBRATORWARN("unknown policy category %s", name);
+    }
+
+    return mask;
+}
+
+/****************************************************************************
+ * Name: vibrator_policy_schedule()
+ *
+ * Description:
+ *   compile the do-not-disturb schedule, a comma separated list of
+ *   HH:MM-HH:MM windows of the local day
+ *
+ * Input Parameters:
+ *   policy - the table being compiled
+ *   list - the schedule, modified in place
+ *
+ ****************************************************************************/
+
+static void vibrator_policy_schedule(vibrator_policy_t* policy, char* list)
+{
+    vibrator_window_t* window;
+    unsigned int h1, m1, h2, m2;
+    char* save = NULL;
+    char* item;
+
+    for (item = strtok_r(list, ", ", &save); item != NULL;
+         item = strtok_r(NULL, ", ", &save)) {
+        if (sscanf(item, "%u:%u-%u:%u", &h1, &m1, &h2, &m2) != 4
+            || h1 > 23 || m1 > 59 || h2 > 23 || m2 > 59) {
+            VIBRATORWARN("invalid policy window %s", item);
+            continue;
+        }
+
+        if (policy->windows == VIBRATOR_POLICY_WINDOWS) {
+            VIBRATORWARN("too many policy windows, skip %s", item);
+            break;
+        }
+
+        window = &policy->window[policy->windows++];
+        window->start = h1 * 60 + m1;
+        window->end = h2 * 60 + m2;
+    }
+}
+
+/****************************************************************************
+ * Name: vibrator_policy_apps()
+ *
+ * Description:
+ *   compile the application overrides, a comma separated list of tag:allow
+ *   or tag:deny. The tag "remote" names the clients of the remote core.
+ *
+ * Input Parameters:
+ *   policy - the table being compiled
+ *   list - the overrides, modified in place
+ *
+ ****************************************************************************/
+
+static void vibrator_policy_apps(vibrator_policy_t* policy, char* list)
+{
+    vibrator_override_t* override;
+    char* save = NULL;
+    char* action;
+    char* item;
+
+    for (item = strtok_r(list, ", ", &save); item != NULL;
+         item = strtok_r(NULL, ", ", &save)) {
+        action = strchr(item, ':');
+        if (action == NULL || action == item
+            || action - item >= VIBRATOR_APP_TAG_MAX
+            || (strcmp(action + 1, "allow") != 0
+                && strcmp(action + 1, "deny") != 0)) {
+            VIBRATORWARN("invalid policy override %s", item);
+            continue;
+        }
+
+        if (policy->overrides == CONFIG_VIBRATOR_POLICY_OVERRIDES) {
+            VIBRATORWARN("too many policy overrides, skip %s", item);
+            break;
+        }
+
+        *action++ = '\0';
+        override = &policy->override[policy->overrides++];
+        override->key = strcmp(item, "remote") == 0 ? VIBRATOR_APP_REMOTE
+                                                     : vibrator_app_key(item);
+        override->allow = strcmp(action, "allow") == 0;
+    }
+}
+
+/****************************************************************************
+ * Name: vibrator_policy_load()
+ *
+ * Description:
+ *   compile the policy keys into the staging table and publish it
+ *
+ ****************************************************************************/
+
+static void vibrator_policy_load(void)
+{
+    vibrator_policy_t* policy = &g_vibrator_policy_next;
+    char value[PROP_VALUE_MAX];
+
+    memset(policy, 0, sizeof(vibrator_policy_t));
+    policy->dnd = property_get_int32(KVDB_KEY_VIBRATOR_POLICY_DND, 0) != 0;
+
+    property_get(KVDB_KEY_VIBRATOR_POLICY_SCHEDULE, value, "");
+    vibrator_policy_schedule(policy, value);
+
+    property_get(KVDB_KEY_VIBRATOR_POLICY_ALLOW, value, VIBRATOR_POLICY_ALLOW);
+    policy->allow = vibrator_policy_categories(value);
+
+    property_get(KVDB_KEY_VIBRATOR_POLICY_DENY, value, "");
+    policy->deny = vibrator_policy_categories(value);
+
+    property_get(KVDB_KEY_VIBRATOR_POLICY_APPS, value, "");
+    vibrator_policy_apps(policy, value);
+
+    vibrator_seq_publish(&g_vibrator_policy_seq, &g_vibrator_policy, policy,
+        sizeof(vibrator_policy_t));
+    VIBRATORINFO("policy dnd %d, %d windows, allow 0x%" PRIx32
+                 ", deny 0x%" PRIx32 ", %d overrides",
+        policy->dnd, policy->windows, policy->allow, policy->deny,
+        policy->overrides);
+}
+
+/****************************************************************************
+ * Name: vibrator_policy_dnd()
+ *
+ * Description:
+ *   tell whether do-not-disturb is on, switched on or by the schedule
+ *
+ * Input Parameters:
+ *   policy - the published table
+ *
+ * Returned Value:
+ *   true if do-not-disturb is on
+ *
+ ****************************************************************************/
+
+static bool vibrator_policy_dnd(const vibrator_policy_t* policy)
+{
+    const vibrator_window_t* window;
+    time_t now;
+    struct tm tm;
+    uint16_t minute;
+
+    if (policy->dnd)
+        return true;
+
+    if (policy->windows == 0)
+        return false;
+
+    now = time(NULL);
+    localtime_r(&now, &tm);
+    minute = tm.tm_hour * 60 + tm.tm_min;
+
+    for (int i = 0; i < MIN(policy->windows, VIBRATOR_POLICY_WINDOWS); i++) {
+        window = &policy->window[i];
+        if (window->start <= window->end
+            ? minute >= window->start && minute < window->end
+            : minute >= window->start || minute < window->end)
+            return true;
+    }
+
+    return false;
+}
+
+/****************************************************************************
+ * Name: vibrator_policy_decide()
+ *
+ * Description:
+ *   decide whether a playback request may play. An override of its
+ *   application decides first, then a denied category, then
+ *   do-not-disturb lets only the allowed categories pass.
+ *
+ * Input Parameters:
+ *   policy - the published table
+ *   msg - the playback request
+ *
+ * Returned Value:
+ *   OK, -EPERM if the policy refuses the request
+ *
+ ****************************************************************************/
+
+static int vibrator_policy_decide(const vibrator_policy_t* policy,
+    const vibrator_msg_t* msg)
+{
+    uint32_t category = 1u << MIN(msg->category, 31);
+    int overrides = MIN(policy->overrides, CONFIG_VIBRATOR_POLICY_OVERRIDES);
+
+    for (int i = 0; i < overrides; i++) {
+        if (policy->override[i].key == msg->app)
+            return policy->override[i].allow ? OK : -EPERM;
+    }
+
+    if (policy->deny & category)
+        return -EPERM;
+
+    if (!(policy->allow & category) && vibrator_policy_dnd(policy))
+        return -EPERM;
+
+    return OK;
 }
 
 /****************************************************************************
- * Name: scale()
+ * Name: vibrator_policy_check()
  *
  * Description:
- *    scale the amplitude with the given intensity.
+ *   check a playback request against the published policy
  *
  * Input Parameters:
- *   amplitude - vibration amplitude, range 0 - 255
- *   intensity - vibration intensity
+ *   msg - the playback request
  *
  * Returned Value:
- *   return the scaled vibration amplitude
+ *   OK, -EPERM if the policy refuses the request
  *
  ****************************************************************************/
 
-static int scale(int amplitude, vibrator_intensity_e intensity)
+static int vibrator_policy_check(const vibrator_msg_t* msg)
 {
-    int scale_amplitude;
+    unsigned int start;
+    int ret;
 
-    switch (intensity) {
-    case VIBRATION_INTENSITY_LOW:
-        scale_amplitude = amplitude * 0.3;
-        break;
-    case VIBRATION_INTENSITY_MEDIUM:
-        scale_amplitude = amplitude * 0.6;
-        break;
-    case VIBRATION_INTENSITY_HIGH:
-        scale_amplitude = amplitude * 1;
-        break;
-    default:
-        scale_amplitude = VIBRATOR_MAX_AMPLITUDE;
-    }
+    do {
+        start = vibrator_seq_begin(&g_vibrator_policy_seq);
+        ret = vibrator_policy_decide(&g_vibrator_policy, msg);
+    } while (vibrator_seq_retry(&g_vibrator_policy_seq, start));
 
-    return scale_amplitude;
+    return ret;
 }
 
 /****************************************************************************
- * Name: should_vibrate()
+ * Name: vibrator_policy_init()
  *
  * Description:
- *    confirm whether vibration is allowed.
+ *   compile the policy and monitor its keys, without the monitor the
+ *   policy is only compiled at start
  *
  * Input Parameters:
- *   intensity - vibration intensity
- *
- * Returned Value:
- *   true: allowed, false: not allowed
+ *   loop - the loop that compiles the policy again
  *
  ****************************************************************************/
 
-static bool should_vibrate(vibrator_intensity_e intensity)
+static void vibrator_policy_init(uv_loop_t* loop)
 {
-    if (intensity == VIBRATION_INTENSITY_OFF)
-        return false;
-    return true;
+    vibrator_policy_load();
+    vibrator_monitor_start(loop, &g_vibrator_policy_monitor,
+        KVDB_KEY_VIBRATOR_POLICY, vibrator_policy_load);
 }
+#endif
 
 /****************************************************************************
- * Name: should_repeat()
+ * Name: vibrator_sched_submit()
  *
  * Description:
- *    confirm whether waveform repeat is allowed.
+ *   scheduler stage between decode and execution. The request is checked
+ *   by the validator of its type, control and query requests are then
+ *   executed immediately. A playback request is checked against the
+ *   policy, then executed immediately if the device is idle or its
+ *   priority is not lower than the active playback, otherwise it waits in
+ *   the bounded device queue.
  *
  * Input Parameters:
- *   repeat - the index into the timings array at which to repeat
- *   timings - motor vibration time
- *   len - length of timings array
+ *   thread_args - the threadargs of the device
+ *   msg - the received request, the reply is built in place
+ *   owner - the connection the request arrived on
  *
  * Returned Value:
- *   true: allowed, false: not allowed
+ *   the result of the request, -EINVAL if the request is unknown or its
+ *   arguments are out of range, -EPERM if the policy refuses it, -EBUSY if
+ *   it could not be queued
  *
  ****************************************************************************/
 
-static bool should_repeat(int repeat, uint32_t timings[],
-    uint8_t amplitude[], uint8_t len)
+static int vibrator_sched_submit(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
 {
-    int ret = false;
+    vibrator_queue_t* queue = &thread_args->queue;
+    const vibrator_op_t* op;
+    int ret;
 
-    if (repeat < 0)
+    if (msg->type < VIBRATION_OP_COUNT
+        && msg->request_len < g_vibrator_op_len[msg->type].request_len)
+        return -EINVAL;
+
+    if (msg->type == VIBRATION_PLAY_HANDLE) {
+        ret = vibrator_play_handle(thread_args, msg, owner);
+        if (ret < 0)
+            return ret;
+    }
+
+    op = vibrator_op_get(msg->type);
+    if (op == NULL)
+        return -EINVAL;
+
+    if (op->validate != NULL) {
+        ret = op->validate(thread_args, msg);
+        if (ret < 0) {
+#if CONFIG_VIBRATOR_HISTORY > 0
+            if (!(msg->flags & VIBRATOR_FLAG_REGISTER))
+                vibrator_history_record(thread_args, msg, owner,
+                    vibrator_history_hash(msg), 0, 0, ret);
+#endif
+            return ret;
+        }
+    }
+
+    if (msg->flags & VIBRATOR_FLAG_REGISTER)
+        return vibrator_registry_add(thread_args, msg, owner);
+
+    if (!(op->flags & VIBRATOR_OP_PLAYBACK))
+        return vibrator_op_execute(thread_args, msg, owner, 0);
+
+#ifdef CONFIG_VIBRATOR_POLICY
+    ret = vibrator_policy_check(msg);
+    if (ret < 0) {
+#if CONFIG_VIBRATOR_HISTORY > 0
+        vibrator_history_record(thread_args, msg, owner,
+            vibrator_history_hash(msg), 0, 0, ret);
+#endif
         return ret;
+    }
+#endif
 
-    while (repeat < len) {
-        if (timings[repeat] != 0 && amplitude[repeat] > 0) {
-            ret = true;
-            break;
+    if (vibrator_busy_remaining(thread_args->ff_dev) == 0
+        || msg->priority >= queue->active_priority) {
+        ret = vibrator_queue_execute(thread_args, msg, owner, 0);
+        queue->stats.queue_peak = MAX(queue->stats.queue_peak,
+            vibrator_queue_depth(thread_args));
+    } else {
+        ret = vibrator_queue_insert(queue, msg, owner);
+#if CONFIG_VIBRATOR_HISTORY > 0
+        if (ret < 0)
+            vibrator_history_record(thread_args, msg, owner,
+                vibrator_history_hash(msg), 0, 0, ret);
+#endif
+        if (ret >= 0) {
+            msg->status |= VIBRATOR_STATUS_QUEUED;
+            if (msg->type == VIBRATION_EFFECT || msg->type == VIBRATION_PRIMITIVE)
+                msg->effect.play_length = 0;
         }
-        repeat++;
     }
 
+    vibrator_queue_dispatch(thread_args);
     return ret;
 }
 
 /****************************************************************************
- * Name: receive_stop()
+ * Name: vibrator_job_run()
  *
  * Description:
- *   stop vibration
+ *   execute a request on the device and build its reply in place, or
+ *   release the session of a closed connection when there is no request.
+ *   A request refused by its transport already carries a result and is
+ *   only answered.
  *
  * Input Parameters:
- *   ff_dev - structure for operating the ff device driver
+ *   thread_args - the threadargs of the device
+ *   msg - the request, NULL to release the session of owner
+ *   owner - the connection the request arrived on
  *
- * Returned Value:
- *   return stop ioctl value
+ ****************************************************************************/
+
+static void vibrator_job_run(threadargs* thread_args, vibrator_msg_t* msg,
+    void* owner)
+{
+    if (msg == NULL) {
+        vibrator_session_release(thread_args, owner);
+        return;
+    }
+
+    if (msg->result == 0)
+        msg->result = vibrator_sched_submit(thread_args, msg, owner);
+
+#if CONFIG_VIBRATOR_APPS > 0
+    vibrator_app_count(thread_args, msg);
+#endif
+
+    if (!(msg->flags & VIBRATOR_FLAG_NOREPLY))
+        vibrator_fill_status(thread_args, msg);
+}
+
+#ifdef CONFIG_VIBRATOR_THREADS
+/****************************************************************************
+ * Name: vibrator_jobs_push()
+ *
+ * Description:
+ *   append a job to the queue of a device engine, called by the transport
+ *   threads
+ *
+ * Input Parameters:
+ *   jobs - the job queue
+ *   job - the job to be appended
  *
  ****************************************************************************/
 
-static int receive_stop(ff_dev_t* ff_dev)
+static void vibrator_jobs_push(vibrator_jobs_t* jobs, vibrator_job_t* job)
 {
-    return off(ff_dev);
+    vibrator_job_t* prev;
+
+    atomic_store_explicit(&job->next, NULL, memory_order_relaxed);
+    prev = atomic_exchange_explicit(&jobs->head, job, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, job, memory_order_release);
 }
 
 /****************************************************************************
- * Name: receive_start()
+ * Name: vibrator_jobs_pop()
  *
  * Description:
- *   start a constant vibration with timeoutms
+ *   take the oldest job from the queue, called by the device engine only.
+ *   A producer that has exchanged head but not linked its job yet makes
+ *   the queue look empty, its wakeup follows once the job is linked.
  *
  * Input Parameters:
- *   ff_dev - structure for operating the ff device driver
- *   timeoutms - number of milliseconds to vibrate
+ *   jobs - the job queue
  *
  * Returned Value:
- *   return stop ioctl value
+ *   the job, NULL if none is ready
  *
  ****************************************************************************/
 
-static int receive_start(ff_dev_t* ff_dev, uint32_t timeoutms)
+static vibrator_job_t* vibrator_jobs_pop(vibrator_jobs_t* jobs)
 {
-    int scale_amplitude;
-    int ret;
-
-    if (!should_vibrate(ff_dev->intensity))
-        return -ENOTSUP;
+    vibrator_job_t* tail = jobs->tail;
+    vibrator_job_t* next;
 
-    scale_amplitude = scale(ff_dev->curr_amplitude, ff_dev->intensity);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &jobs->stub) {
+        if (next == NULL)
+            return NULL;
 
-    /* Note: ordering is important here! Many haptic drivers will reset their
-       amplitude when enabled, so we always have to enable first, then set
-       the amplitude. */
+        jobs->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
 
-    ret = on(ff_dev, timeoutms);
-    if (ret < 0) {
-        VIBRATORERR("Error: ioctl failed, errno = %d", errno);
+    if (next != NULL) {
+        jobs->tail = next;
+        return tail;
     }
 
-    return ff_set_amplitude(ff_dev, scale_amplitude);
+    if (tail != atomic_load_explicit(&jobs->head, memory_order_acquire))
+        return NULL;
+
+    /* tail is the last job, put the stub behind it so that it can be
+       taken without emptying the queue */
+
+    vibrator_jobs_push(jobs, &jobs->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next == NULL)
+        return NULL;
+
+    jobs->tail = next;
+    return tail;
 }
 
 /****************************************************************************
- * Name: waveform_timer_cb()
+ * Name: jobs_async_cb()
  *
  * Description:
- *   callback function to wait for a given vibration time
+ *   run the jobs handed over by the transport threads on a device engine.
+ *   The job of a request to every device waits until all engines have
+ *   reached it, so that their playbacks start together.
  *
  * Input Parameters:
- *   timer - the handle of the uv timer
+ *   async - the wakeup handle of the job queue
  *
  ****************************************************************************/
 
-static void waveform_timer_cb(uv_timer_t* timer)
+static void jobs_async_cb(uv_async_t* async)
 {
-    threadargs* thread_args = timer->data;
-    vibrator_waveform_t* wave = &thread_args->wave;
-    ff_dev_t* ff_dev = thread_args->ff_dev;
-    uint16_t duration;
-    uint8_t amplitude;
+    threadargs* thread_args = async->data;
+    vibrator_job_t* job;
 
-    uv_timer_stop(timer);
+    while ((job = vibrator_jobs_pop(&thread_args->jobs)) != NULL) {
+        if (job->barrier != NULL)
+            pthread_barrier_wait(job->barrier);
 
-    if (wave->count < wave->length) {
-        VIBRATORINFO("index(count) = %d", wave->count);
-        amplitude = scale(wave->amplitudes[wave->count], ff_dev->intensity);
-        duration = wave->timings[wave->count++];
-        if (amplitude != 0 && duration > 0) {
-            on(ff_dev, duration);
-            ff_set_amplitude(ff_dev, amplitude);
-        }
-        uv_timer_start(&thread_args->timer, waveform_timer_cb, duration, 0);
-    } else if (wave->repeat < 0) {
-        VIBRATORINFO("repeat < 0, play waveform exit");
-    } else {
-        wave->count = wave->repeat;
-        uv_timer_start(&thread_args->timer, waveform_timer_cb, 0, 0);
+        vibrator_job_run(thread_args, job->msg, job->owner);
+        sem_post(&job->done);
     }
 }
 
 /****************************************************************************
- * Name: receive_waveform()
+ * Name: vibrator_jobs_submit()
  *
  * Description:
- *   receive waveform from vibrator_upper file
+ *   queue a job on the engine of a device, called by the transport threads
  *
  * Input Parameters:
- *   args - the args of threadargs
+ *   thread_args - the threadargs of the device
+ *   job - the job, done is initialized here
+ *   msg - the request, NULL to release the session of owner
+ *   owner - the connection the request arrived on
+ *   barrier - the barrier of a request to every device, NULL otherwise
  *
  ****************************************************************************/
 
-static int receive_waveform(void* args)
+static void vibrator_jobs_submit(threadargs* thread_args, vibrator_job_t* job,
+    vibrator_msg_t* msg, void* owner, pthread_barrier_t* barrier)
 {
-    threadargs* thread_args = args;
-    vibrator_waveform_t* wave = &thread_args->wave;
-
-    wave->count = 0;
-
-    if (!should_vibrate(thread_args->ff_dev->intensity))
-        return -ENOTSUP;
-
-    if (!should_repeat(wave->repeat, wave->timings,
-            wave->amplitudes, wave->length))
-        wave->repeat = -1;
-
-    return uv_timer_start(&thread_args->timer, waveform_timer_cb, 0, 0);
+    job->msg = msg;
+    job->owner = owner;
+    job->barrier = barrier;
+    sem_init(&job->done, 0, 0);
+    vibrator_jobs_push(&thread_args->jobs, job);
 }
 
 /****************************************************************************
- * Name: interval_timer_cb()
+ * Name: vibrator_jobs_wait()
  *
  * Description:
- *   callback function to wait for a given time interval
+ *   wait until a device engine has run a job
  *
  * Input Parameters:
- *   timer - the handle of the uv timer
+ *   job - the submitted job
  *
  ****************************************************************************/
 
-static void interval_timer_cb(uv_timer_t* timer)
+static void vibrator_jobs_wait(vibrator_job_t* job)
 {
-    threadargs* thread_args = (threadargs*)timer->data;
-    vibrator_waveform_t* wave = &thread_args->wave;
-    ff_dev_t* ff_dev = thread_args->ff_dev;
-    int32_t duration = wave->timings[0];
-
-    if (wave->count-- == 0) {
-        uv_timer_stop(timer);
-        return;
-    }
+    while (sem_wait(&job->done) < 0 && errno == EINTR)
+        ;
 
-    receive_start(ff_dev, duration);
+    sem_destroy(&job->done);
 }
 
 /****************************************************************************
- * Name: receive_interval()
+ * Name: transport_thread()
  *
  * Description:
- *   receive receive_interval from vibrator_upper file
+ *   run the loop of a transport
  *
- * Input Parameters:
- *   args - the args of threadargs
+ ****************************************************************************/
+
+static void* transport_thread(void* arg)
+{
+    vibrator_transport_t* transport = arg;
+
+    uv_run(transport->loop, UV_RUN_DEFAULT);
+    return NULL;
+}
+
+#if CONFIG_VIBRATOR_DEVICES > 1
+/****************************************************************************
+ * Name: engine_thread()
+ *
+ * Description:
+ *   run the loop of a device engine after the first
  *
  ****************************************************************************/
 
-static int receive_interval(void* args)
+static void* engine_thread(void* arg)
 {
-    threadargs* thread_args = (threadargs*)args;
+    threadargs* thread_args = arg;
 
-    return uv_timer_start(&thread_args->timer, interval_timer_cb, 0,
-        thread_args->wave.timings[0] + thread_args->wave.timings[1]);
+    uv_run(thread_args->ff_dev->loop, UV_RUN_DEFAULT);
+    return NULL;
 }
+#endif
 
 /****************************************************************************
- * Name: receive_predefined()
+ * Name: vibrator_engine_start()
  *
  * Description:
- *   receive predefined from vibrator_upper file
+ *   raise the calling thread, which runs the engine of the first device, to
+ *   its priority, open the job queue of every device on the loop of its
+ *   engine, start a thread for every other engine and for every transport
  *
  * Input Parameters:
- *   ff_dev - structure for operating the ff device driver
- *   eff - effect struct, including effect id and effect strength
+ *   thread_args - the threadargs of all devices
  *
  * Returned Value:
- *   return the play_effect value
+ *   OK, a negated errno on failure
  *
  ****************************************************************************/
 
-static int receive_predefined(ff_dev_t* ff_dev, vibrator_effect_t* eff)
+static int vibrator_engine_start(threadargs* thread_args)
 {
-    int32_t play_length;
+    struct sched_param param;
+    pthread_attr_t attr;
     int ret;
 
-    if (!should_vibrate(ff_dev->intensity))
-        return -ENOTSUP;
+    ret = pthread_setschedprio(pthread_self(), CONFIG_VIBRATOR_ENGINE_PRIORITY);
+    if (ret != 0)
+        VIBRATORWARN("engine priority not set: %d", ret);
 
-    ret = play_effect(ff_dev, eff->effect_id, eff->es, (long*)&play_length);
+    for (int i = 0; i < CONFIG_VIBRATOR_DEVICES; i++) {
+        vibrator_jobs_t* jobs = &thread_args[i].jobs;
 
-    if (ret >= 0)
-        eff->play_length = play_length;
+        atomic_init(&jobs->stub.next, NULL);
+        atomic_init(&jobs->head, &jobs->stub);
+        jobs->tail = &jobs->stub;
+        jobs->async.data = &thread_args[i];
+        ret = uv_async_init(thread_args[i].ff_dev->loop, &jobs->async,
+            jobs_async_cb);
+        if (ret < 0)
+            return ret;
+    }
 
-    return ret;
+#if CONFIG_VIBRATOR_DEVICES > 1
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, CONFIG_VIBRATOR_ENGINE_STACKSIZE);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    param.sched_priority = CONFIG_VIBRATOR_ENGINE_PRIORITY;
+    pthread_attr_setschedparam(&attr, &param);
+
+    for (int i = 1; i < CONFIG_VIBRATOR_DEVICES; i++) {
+#ifdef CONFIG_VIBRATOR_STATIC_ALLOC
+        pthread_attr_setstack(&attr, g_vibrator_engine_stacks[i - 1],
+            sizeof(g_vibrator_engine_stacks[i - 1]));
+#endif
+        ret = pthread_create(&thread_args[i].thread, &attr, engine_thread,
+            &thread_args[i]);
+        if (ret != 0) {
+            VIBRATORERR("engine %d thread failed: %d", i, ret);
+            pthread_attr_destroy(&attr);
+            return -ret;
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+#endif
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, CONFIG_VIBRATOR_TRANSPORT_STACKSIZE);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    param.sched_priority = CONFIG_VIBRATOR_TRANSPORT_PRIORITY;
+    pthread_attr_setschedparam(&attr, &param);
+
+    for (int i = 0; i < VIBRATOR_COUNT; i++) {
+#ifdef CONFIG_VIBRATOR_STATIC_ALLOC
+        pthread_attr_setstack(&attr, g_vibrator_transport_stacks[i],
+            sizeof(g_vibrator_transport_stacks[i]));
+#endif
+        ret = pthread_create(&g_vibrator_transports[i].thread, &attr,
+            transport_thread, &g_vibrator_transports[i]);
+        if (ret != 0) {
+            VIBRATORERR("transport %d thread failed: %d", i, ret);
+            break;
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    return -ret;
 }
+#endif
 
+#if CONFIG_VIBRATOR_DEVICES > 1
 /****************************************************************************
- * Name: receive_primitive()
+ * Name: vibrator_submit_all()
  *
  * Description:
- *   receive play primitive from vibrator_upper file
+ *   hand a request to the engines of all devices and wait for their
+ *   replies. The devices after the first execute copies of the request,
+ *   with CONFIG_VIBRATOR_THREADS the engines meet on a barrier before
+ *   they execute it. The reply is the one of the first device, its result
+ *   the first failure of any device.
  *
  * Input Parameters:
- *   ff_dev - structure for operating the ff device driver
- *   eff - effect struct, including effect id and effect strength
+ *   ctx - the connection the request arrived on
+ *   msg - the request
  *
- * Returned Value:
- *   return the play_effect value
+ ****************************************************************************/
+
+static void vibrator_submit_all(vibrator_context_t* ctx, vibrator_msg_t* msg)
+{
+    vibrator_msg_t* group = ctx->transport->group;
+#ifdef CONFIG_VIBRATOR_THREADS
+    vibrator_job_t jobs[CONFIG_VIBRATOR_DEVICES];
+    pthread_barrier_t barrier;
+#endif
+
+    for (int i = 1; i < CONFIG_VIBRATOR_DEVICES; i++)
+        group[i - 1] = *msg;
+
+#ifdef CONFIG_VIBRATOR_THREADS
+    pthread_barrier_init(&barrier, NULL, CONFIG_VIBRATOR_DEVICES);
+    pthread_mutex_lock(&g_vibrator_group_lock);
+    vibrator_jobs_submit(&ctx->thread_args[0], &jobs[0], msg, ctx, &barrier);
+    for (int i = 1; i < CONFIG_VIBRATOR_DEVICES; i++)
+        vibrator_jobs_submit(&ctx->thread_args[i], &jobs[i], &group[i - 1],
+            ctx, &barrier);
+
+    pthread_mutex_unlock(&g_vibrator_group_lock);
+
+    for (int i = 0; i < CONFIG_VIBRATOR_DEVICES; i++)
+        uv_async_send(&ctx->thread_args[i].jobs.async);
+
+    for (int i = 0; i < CONFIG_VIBRATOR_DEVICES; i++)
+        vibrator_jobs_wait(&jobs[i]);
+
+    pthread_barrier_destroy(&barrier);
+#else
+    vibrator_job_run(&ctx->thread_args[0], msg, ctx);
+    for (int i = 1; i < CONFIG_VIBRATOR_DEVICES; i++)
+        vibrator_job_run(&ctx->thread_args[i], &group[i - 1], ctx);
+#endif
+
+    for (int i = 1; i < CONFIG_VIBRATOR_DEVICES; i++) {
+        if (msg->result >= 0 && group[i - 1].result < 0)
+            msg->result = group[i - 1].result;
+    }
+}
+#endif
+
+/****************************************************************************
+ * Name: vibrator_submit()
+ *
+ * Description:
+ *   hand a decoded request to the engine of its device and wait for its
+ *   reply, called by the transports. Without CONFIG_VIBRATOR_THREADS the
+ *   engines share the loop and the request is executed at once. A request
+ *   of another protocol version is refused with -EPROTO, a request to an
+ *   unknown device is answered by the first device with -ENODEV,
+ *   registrations and regions are refused for VIBRATOR_DEVICE_ALL as
+ *   their handles differ per device. A request that names no application,
+ *   or that names a process or remote key on a connection with
+ *   credentials, is charged to the peer of its connection.
+ *
+ * Input Parameters:
+ *   ctx - the connection the request arrived on
+ *   msg - the request, NULL to release the session of the connection on
+ *         every device
  *
  ****************************************************************************/
 
-static int receive_primitive(ff_dev_t* ff_dev, vibrator_effect_t* eff)
+static void vibrator_submit(vibrator_context_t* ctx, vibrator_msg_t* msg)
 {
-    int32_t play_length;
-    int ret;
+#ifdef CONFIG_VIBRATOR_THREADS
+    vibrator_job_t job;
+#endif
+    threadargs* thread_args;
 
-    if (!should_vibrate(ff_dev->intensity))
-        return -ENOTSUP;
+    if (msg == NULL) {
+        for (int i = 0; i < CONFIG_VIBRATOR_DEVICES; i++) {
+#ifdef CONFIG_VIBRATOR_THREADS
+            vibrator_jobs_submit(&ctx->thread_args[i], &job, NULL, ctx, NULL);
+            uv_async_send(&ctx->thread_args[i].jobs.async);
+            vibrator_jobs_wait(&job);
+#else
+            vibrator_job_run(&ctx->thread_args[i], NULL, ctx);
+#endif
+        }
 
-    ret = play_primitive(ff_dev, eff->effect_id, eff->amplitude, (long*)&play_length);
+        return;
+    }
 
-    if (ret >= 0)
-        eff->play_length = play_length;
+    /* a client built against another message layout would be misread */
 
-    return ret;
+    if (msg->version != VIBRATOR_MSG_VERSION) {
+        VIBRATORERR("protocol version %d, expected %d", msg->version,
+            VIBRATOR_MSG_VERSION);
+        if (msg->result == 0)
+            msg->result = -EPROTO;
+    }
+
+    /* on a connection with credentials only a hashed tag is taken from the
+       client, a process or remote key it names is replaced by its own */
+
+    if (msg->app == VIBRATOR_APP_UNKNOWN
+        || (ctx->peer != VIBRATOR_APP_UNKNOWN
+            && (msg->app & VIBRATOR_APP_PID)))
+        msg->app = ctx->peer;
+
+    if (msg->device == VIBRATOR_DEVICE_ALL) {
+        if (msg->result == 0 && ((msg->flags & VIBRATOR_FLAG_REGISTER)
+            || msg->type == VIBRATION_PLAY_HANDLE
+            || msg->type == VIBRATION_REGISTER_REGION))
+            msg->result = -EINVAL;
+
+#if CONFIG_VIBRATOR_DEVICES > 1
+        if (msg->result == 0) {
+            vibrator_submit_all(ctx, msg);
+            return;
+        }
+#endif
+
+        msg->device = 0;
+    } else if (msg->device >= CONFIG_VIBRATOR_DEVICES) {
+        if (msg->result == 0)
+            msg->result = -ENODEV;
+
+        msg->device = 0;
+    }
+
+    thread_args = &ctx->thread_args[msg->device];
+
+#ifdef CONFIG_VIBRATOR_THREADS
+    vibrator_jobs_submit(thread_args, &job, msg, ctx, NULL);
+    uv_async_send(&thread_args->jobs.async);
+    vibrator_jobs_wait(&job);
+#else
+    vibrator_job_run(thread_args, msg, ctx);
+#endif
 }
 
 /****************************************************************************
- * Name: receive_set_intensity()
+ * Name: vibrator_context_alloc()
  *
  * Description:
- *   recevice set vibrator intensity operation from vibrator_upper file
- *
- * Input Parameters:
- *   ff_dev - structure for operating the ff device driver
- *   intensity - vibration intensity
+ *   allocate the context of a client connection, from the static pool with
+ *   CONFIG_VIBRATOR_STATIC_ALLOC and from the heap otherwise
  *
  * Returned Value:
- *   return the ret of write
+ *   the context, NULL if none is left
  *
  ****************************************************************************/
 
-static int receive_set_intensity(ff_dev_t* ff_dev,
-    vibrator_intensity_e intensity)
+static vibrator_context_t* vibrator_context_alloc(threadargs* thread_args)
 {
-    int ret;
-
-    ff_dev->intensity = intensity;
-    ret = property_set_int32(KVDB_KEY_VIBRATOR_MODE, ff_dev->intensity);
-    if (ret < 0) {
-        return ret;
+#ifdef CONFIG_VIBRATOR_STATIC_ALLOC
+    vibrator_context_t* ctx = NULL;
+
+#ifdef CONFIG_VIBRATOR_THREADS
+    pthread_mutex_lock(&g_vibrator_conns_lock);
+#endif
+    for (int i = 0; i < CONFIG_VIBRATOR_CONNECTIONS; i++) {
+        if (g_vibrator_conns[i].thread_args == NULL) {
+            ctx = &g_vibrator_conns[i];
+            ctx->thread_args = thread_args;
+            break;
+        }
     }
+#ifdef CONFIG_VIBRATOR_THREADS
+    pthread_mutex_unlock(&g_vibrator_conns_lock);
+#endif
+
+    return ctx;
+#else
+    return malloc(sizeof(vibrator_context_t));
+#endif
+}
 
-    return OK;
+static void vibrator_context_free(vibrator_context_t* ctx)
+{
+#ifdef CONFIG_VIBRATOR_STATIC_ALLOC
+#ifdef CONFIG_VIBRATOR_THREADS
+    pthread_mutex_lock(&g_vibrator_conns_lock);
+#endif
+    ctx->thread_args = NULL;
+#ifdef CONFIG_VIBRATOR_THREADS
+    pthread_mutex_unlock(&g_vibrator_conns_lock);
+#endif
+#else
+    free(ctx);
+#endif
+}
+
+static void connection_close_cb(uv_handle_t* handle)
+{
+    vibrator_context_free(handle->data);
 }
 
 /****************************************************************************
- * Name: receive_get_intensity()
+ * Name: connection_process()
  *
  * Description:
- *   recevice get vibrator intensity operation from vibrator_upper file
+ *   execute every complete request buffered on a connection. A session
+ *   keeps its connection open and may send requests back to back, so the
+ *   stream is split by the request_len of each header. A request is
+ *   decoded and answered in place in the receive buffer, it is only moved
+ *   out when another request behind it would be overwritten by the reply.
  *
  * Input Parameters:
- *   ff_dev - structure for operating the ff device driver
- *   intensity - vibration intensity
+ *   ctx - the connection
  *
  * Returned Value:
- *   return OK(success)
+ *   the number of requests executed, -EPROTO if a header is malformed
  *
  ****************************************************************************/
 
-static int receive_get_intensity(ff_dev_t* ff_dev,
-    vibrator_intensity_e* intensity)
+static int connection_process(vibrator_context_t* ctx)
 {
-    ff_dev->intensity = property_get_int32(KVDB_KEY_VIBRATOR_MODE,
-        ff_dev->intensity);
-    *intensity = ff_dev->intensity;
-    return OK;
+    vibrator_msg_t* msg;
+    int count = 0;
+    size_t len;
+    int ret;
+
+    while (ctx->rx_len >= VIBRATOR_MSG_HEADER) {
+        len = ctx->rx.request_len;
+        if (len < VIBRATOR_MSG_HEADER || len > sizeof(vibrator_msg_t))
+            return -EPROTO;
+
+        if (ctx->rx_len < len)
+            break;
+
+        ctx->rx_len -= len;
+        if (ctx->rx_len > 0) {
+            msg = &ctx->transport->msg;
+            memcpy(msg, &ctx->rx, len);
+            memmove(&ctx->rx, (uint8_t*)&ctx->rx + len, ctx->rx_len);
+        } else {
+            msg = &ctx->rx;
+        }
+
+        VIBRATORINFO("recv client: len = %zu, type = %d", len, msg->type);
+        count++;
+        msg->status = 0;
+        msg->result = 0;
+        vibrator_submit(ctx, msg);
+        if (msg->flags & VIBRATOR_FLAG_NOREPLY)
+            continue;
+
+        ret = send(ctx->sock, msg, msg->response_len, 0);
+        if (ret < 0) {
+            VIBRATORERR("send fail, errno = %d", errno);
+        }
+    }
+
+    return count;
 }
 
 /****************************************************************************
- * Name: receive_set_amplitude()
+ * Name: connection_poll_cb()
  *
  * Description:
- *   recevice set vibrator amplitude operation from vibrator_upper file
- *
- * Input Parameters:
- *   ff_dev - structure for operating the ff device driver
- *   amplitude - vibration amplitude, range 0 - 255
- *
- * Returned Value:
- *   return the ret of write
+ *   drain a readable connection until the socket is empty or the batch
+ *   budget is spent, so that a burst of requests costs one wakeup
  *
  ****************************************************************************/
 
-static int receive_set_amplitude(ff_dev_t* ff_dev, uint8_t amplitude)
+static void connection_poll_cb(uv_poll_t* handle, int status, int events)
 {
-    ff_dev->curr_amplitude = amplitude;
-    return ff_set_amplitude(ff_dev, amplitude);
+    vibrator_context_t* ctx = handle->data;
+    vibrator_transport_t* transport = ctx->transport;
+    uint32_t batch = 0;
+    int ret;
+
+    if (events & UV_READABLE) {
+        for (int i = 0; i < CONFIG_VIBRATOR_BATCH_BUDGET; i++) {
+            ret = recv(ctx->sock, (uint8_t*)&ctx->rx + ctx->rx_len,
+                sizeof(vibrator_msg_t) - ctx->rx_len, MSG_DONTWAIT);
+            if (ret <= 0)
+                break;
+
+            ctx->rx_len += ret;
+            ret = connection_process(ctx);
+            if (ret < 0) {
+                VIBRATORERR("malformed request, close client");
+                events |= UV_DISCONNECT;
+                break;
+            }
+
+            batch += ret;
+        }
+
+        transport->wakeups++;
+        transport->frames += batch;
+        transport->batch_peak = MAX(transport->batch_peak, batch);
+    }
+
+    if (events & UV_DISCONNECT) {
+        VIBRATORINFO("client disconnect");
+        vibrator_submit(ctx, NULL);
+        uv_poll_stop(handle);
+        close(ctx->sock);
+        uv_close((uv_handle_t*)&ctx->poll_handle, connection_close_cb);
+    }
 }
 
 /****************************************************************************
- * Name: receive_get_capabilities()
+ * Name: connection_peer()
  *
  * Description:
- *   recevice get vibrator capabilities operation from vibrator_upper file
+ *   get the application key of a client from the credentials of its
+ *   connection
  *
  * Input Parameters:
- *   ff_dev - structure for operating the ff device driver
- *   capabilities - buffer that store capabilities
+ *   fd - the accepted socket
  *
  * Returned Value:
- *   0 means success
+ *   the key of the process of the client, VIBRATOR_APP_UNKNOWN if the
+ *   socket does not carry credentials
  *
  ****************************************************************************/
 
-static int receive_get_capabilities(ff_dev_t* ff_dev, int32_t* capabilities)
+static uint32_t connection_peer(uv_os_sock_t fd)
 {
-    *capabilities = ff_dev->capabilities;
-    return OK;
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0
+        && cred.pid > 0)
+        return VIBRATOR_APP_PID | cred.pid;
+#endif
+
+    return VIBRATOR_APP_UNKNOWN;
 }
 
 /****************************************************************************
- * Name: vibrator_init()
+ * Name: connection_open()
  *
  * Description:
- *   open the vibrator file descriptor
+ *   start serving an accepted client connection
  *
  * Input Parameters:
- *   ff_dev - structure for operating the ff device driver
+ *   server_ctx - the listening context the client connected to
+ *   client_fd - the accepted socket
  *
  * Returned Value:
- *   0 means success, otherwise it means failure
+ *   OK, a negated errno if the connection is closed again
  *
  ****************************************************************************/
 
-static int vibrator_init(ff_dev_t* ff_dev)
+static int connection_open(vibrator_context_t* server_ctx,
+    uv_os_sock_t client_fd)
 {
-    unsigned char ffbitmask[1 + FF_MAX / 8 / sizeof(unsigned char)];
+    vibrator_context_t* client_ctx;
     int ret;
 
-    ff_dev->curr_app_id = VIBRATOR_INVALID_VALUE;
-    ff_dev->curr_magnitude = VIBRATOR_STRONG_MAGNITUDE;
-    ff_dev->intensity = VIBRATION_INTENSITY_OFF;
-    ff_dev->curr_amplitude = VIBRATOR_MAX_AMPLITUDE;
-    ff_dev->capabilities = 0;
-
-    ff_dev->fd = open(VIBRATOR_DEV_FS, O_CLOEXEC | O_RDWR);
-    if (ff_dev->fd < 0) {
-        VIBRATORERR("vibrator open failed, errno = %d", errno);
-        return -ENODEV;
+    client_ctx = vibrator_context_alloc(server_ctx->thread_args);
+    if (client_ctx == NULL) {
+        VIBRATORWARN("no connection context left, close client");
+        close(client_fd);
+        return -ENOMEM;
     }
 
-    memset(ffbitmask, 0, sizeof(ffbitmask));
-    ret = ioctl(ff_dev->fd, EVIOCGBIT, ffbitmask);
+    ret = uv_poll_init_socket(server_ctx->transport->loop,
+        &client_ctx->poll_handle, client_fd);
     if (ret < 0) {
-        VIBRATORERR("ioctl EVIOCGBIT failed, errno = %d", errno);
+        VIBRATORERR("uv poll init socket failed: %d\n", ret);
+        close(client_fd);
+        vibrator_context_free(client_ctx);
         return ret;
     }
 
-    if (test_bit(FF_CONSTANT, ffbitmask) || test_bit(FF_PERIODIC, ffbitmask)) {
-        if (test_bit(FF_CUSTOM, ffbitmask))
-            ff_dev->capabilities |= CAP_AMPLITUDE_CONTROL;
-        if (test_bit(FF_GAIN, ffbitmask)) {
-            ff_dev->capabilities |= CAP_PERFORM_CALLBACK;
-            ff_dev->capabilities |= CAP_COMPOSE_EFFECTS;
-        }
-    } else {
-        return -ENODEV;
+    client_ctx->sock = client_fd;
+    client_ctx->peer = server_ctx->peer;
+    if (client_ctx->peer == VIBRATOR_APP_UNKNOWN)
+        client_ctx->peer = connection_peer(client_fd);
+
+    client_ctx->rx_len = 0;
+    client_ctx->thread_args = server_ctx->thread_args;
+    client_ctx->transport = server_ctx->transport;
+    client_ctx->poll_handle.data = client_ctx;
+    ret = uv_poll_start(&client_ctx->poll_handle, UV_READABLE | UV_DISCONNECT,
+        connection_poll_cb);
+    if (ret < 0) {
+        VIBRATORERR("uv poll start socket failed: %d\n", ret);
+        close(client_fd);
+        vibrator_context_free(client_ctx);
+        return ret;
     }
 
-    ff_dev->intensity = property_get_int32(KVDB_KEY_VIBRATOR_MODE,
-        ff_dev->intensity);
     return OK;
 }
 
 /****************************************************************************
- * Name: vibrator_mode_select()
+ * Name: server_poll_cb()
  *
  * Description:
- *   choose vibrator operation mode
- *
- * Input Parameters:
- *   vibrator - structure for operating the vibrator
- *   args - the threadargs
+ *   accept the pending connections until none is left or the batch budget
+ *   is spent
  *
  ****************************************************************************/
 
-static int vibrator_mode_select(vibrator_msg_t* msg, void* args)
+static void server_poll_cb(uv_poll_t* handle, int status, int events)
 {
-    threadargs* thread_args;
-    ff_dev_t* ff_dev;
-    uv_timer_t* timer;
-    int ret;
-
-    if (args == NULL) {
-        VIBRATORERR("mode select args is NULL");
-        return -EINVAL;
-    }
+    vibrator_context_t* server_ctx = handle->data;
+    vibrator_transport_t* transport = server_ctx->transport;
+    uv_os_sock_t client_fd;
+    uint32_t batch = 0;
 
-    thread_args = (threadargs*)args;
-    ff_dev = thread_args->ff_dev;
-    timer = &thread_args->timer;
+    for (int i = 0; i < CONFIG_VIBRATOR_BATCH_BUDGET; i++) {
+        client_fd = accept(server_ctx->sock, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                VIBRATORERR("accept failed %d: %d", client_fd, errno);
+            break;
+        }
 
-    switch (msg->type) {
-    case VIBRATION_WAVEFORM: {
-        uv_timer_stop(timer);
-        thread_args->wave = msg->wave;
-        ret = receive_waveform(thread_args);
-        VIBRATORINFO("receive waveform ret = %d", ret);
-        break;
-    }
-    case VIBRATION_INTERVAL: {
-        uv_timer_stop(timer);
-        thread_args->wave = msg->wave;
-        ret = receive_interval(thread_args);
-        VIBRATORINFO("receive interval ret = %d", ret);
-        break;
-    }
-    case VIBRATION_EFFECT: {
-        uv_timer_stop(timer);
-        ret = receive_predefined(ff_dev, &msg->effect);
-        VIBRATORINFO("receive predefined ret = %d", ret);
-        break;
-    }
-    case VIBRATION_STOP: {
-        uv_timer_stop(timer);
-        ret = receive_stop(ff_dev);
-        VIBRATORINFO("receive stop ret = %d", ret);
-        break;
-    }
-    case VIBRATION_START: {
-        uv_timer_stop(timer);
-        ret = receive_start(ff_dev, msg->timeoutms);
-        VIBRATORINFO("receive start ret = %d", ret);
-        break;
-    }
-    case VIBRATION_PRIMITIVE: {
-        uv_timer_stop(timer);
-        ret = receive_primitive(ff_dev, &msg->effect);
-        VIBRATORINFO("receive primitive ret = %d", ret);
-        break;
-    }
-    case VIBRATION_SET_INTENSITY: {
-        ret = receive_set_intensity(ff_dev, msg->intensity);
-        VIBRATORINFO("receive set intensity = %d", ret);
-        break;
-    }
-    case VIBRATION_GET_INTENSITY: {
-        ret = receive_get_intensity(ff_dev, (vibrator_intensity_e*)&msg->intensity);
-        VIBRATORINFO("receive get intensity = %d", msg->intensity);
-        break;
-    }
-    case VIBRATION_SET_AMPLITUDE: {
-        ret = receive_set_amplitude(ff_dev, msg->amplitude);
-        VIBRATORINFO("receive set amplitude = %d", ret);
-        break;
-    }
-    case VIBRATION_GET_CAPABLITY: {
-        ret = receive_get_capabilities(ff_dev, &msg->capabilities);
-        VIBRATORINFO("receive get capabilities = %d", (int)msg->capabilities);
-        break;
-    }
-    default: {
-        ret = -EINVAL;
-        break;
-    }
+        if (connection_open(server_ctx, client_fd) >= 0)
+            batch++;
     }
 
-    return ret;
+    transport->accept_peak = MAX(transport->accept_peak, batch);
 }
 
-static void connection_close_cb(uv_handle_t* handle)
-{
-    vibrator_context_t* ctx = handle->data;
-    free(ctx);
-}
+/****************************************************************************
+ * Name: dgram_poll_cb()
+ *
+ * Description:
+ *   serve the requests sent to the datagram endpoint, one request per
+ *   datagram. The reply goes back to the address of the sender unless the
+ *   request carries VIBRATOR_FLAG_NOREPLY.
+ *
+ ****************************************************************************/
 
-static void connection_poll_cb(uv_poll_t* handle, int status, int events)
+static void dgram_poll_cb(uv_poll_t* handle, int status, int events)
 {
     vibrator_context_t* ctx = handle->data;
-    vibrator_msg_t* msg = &ctx->thread_args->msg;
+    vibrator_transport_t* transport = ctx->transport;
+    vibrator_msg_t* msg = &ctx->rx;
+    struct sockaddr_un from;
+    socklen_t fromlen;
+    uint32_t batch = 0;
+    int ret;
 
-    if (events & UV_READABLE) {
-        int ret = recv(ctx->sock, msg, sizeof(vibrator_msg_t), 0);
-        if (ret >= msg->request_len) {
-            VIBRATORINFO("recv client: recv len = %d, type = %d", ret, msg->type);
-            msg->result = vibrator_mode_select(msg, ctx->thread_args);
-            ret = send(ctx->sock, msg, msg->response_len, 0);
-            if (ret < 0) {
-                VIBRATORERR("send fail, errno = %d", errno);
-            }
+    for (int i = 0; i < CONFIG_VIBRATOR_BATCH_BUDGET; i++) {
+        fromlen = sizeof(from);
+        ret = recvfrom(ctx->sock, msg, sizeof(vibrator_msg_t), MSG_DONTWAIT,
+            (struct sockaddr*)&from, &fromlen);
+        if (ret < 0)
+            break;
+
+        if (ret < VIBRATOR_MSG_HEADER || ret < msg->request_len
+            || msg->request_len < VIBRATOR_MSG_HEADER) {
+            VIBRATORERR("malformed datagram, len = %d", ret);
+            continue;
         }
-    }
 
-    if (events & UV_DISCONNECT) {
-        VIBRATORINFO("client disconnect");
-        uv_poll_stop(handle);
-        close(ctx->sock);
-        uv_close((uv_handle_t*)&ctx->poll_handle, connection_close_cb);
+        VIBRATORINFO("recv datagram: len = %d, type = %d", ret, msg->type);
+        batch++;
+
+        /* registered effects and regions are released with their session,
+           which a datagram client does not have */
+
+        msg->status = 0;
+        msg->result = 0;
+        if ((msg->flags & VIBRATOR_FLAG_REGISTER)
+            || msg->type == VIBRATION_REGISTER_REGION)
+            msg->result = -ENOTSUP;
+
+        vibrator_submit(ctx, msg);
+        if (msg->flags & VIBRATOR_FLAG_NOREPLY)
+            continue;
+
+        ret = sendto(ctx->sock, msg, msg->response_len, MSG_DONTWAIT,
+            (struct sockaddr*)&from, fromlen);
+        if (ret < 0) {
+            VIBRATORERR("sendto fail, errno = %d", errno);
+        }
     }
+
+    transport->wakeups++;
+    transport->frames += batch;
+    transport->batch_peak = MAX(transport->batch_peak, batch);
 }
 
-static void server_poll_cb(uv_poll_t* handle, int status, int events)
+/****************************************************************************
+ * Name: dgram_listen()
+ *
+ * Description:
+ *   open the local datagram endpoint, clients that cannot hold a session
+ *   exchange a request with one sendto() and recvfrom() instead of a
+ *   connection
+ *
+ * Input Parameters:
+ *   ctx - the context of the endpoint, its transport is set
+ *   thread_args - the threadargs of the device
+ *
+ * Returned Value:
+ *   OK, a negated errno on failure
+ *
+ ****************************************************************************/
+
+static int dgram_listen(vibrator_context_t* ctx, threadargs* thread_args)
 {
-    vibrator_context_t* server_ctx = handle->data;
-    vibrator_context_t* client_ctx;
-    uv_os_sock_t client_fd;
+    const struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+        .sun_path = PROP_DGRAM_PATH,
+    };
 
-    client_fd = accept(server_ctx->sock, NULL, NULL);
-    if (client_fd < 0) {
-        VIBRATORERR("accept failed %d: %d", client_fd, errno);
-        return;
-    }
+    int ret;
 
-    client_ctx = malloc(sizeof *client_ctx);
-    int ret = uv_poll_init_socket(uv_default_loop(), &client_ctx->poll_handle, client_fd);
-    if (ret < 0) {
-        VIBRATORERR("uv poll init socket failed: %d\n", ret);
-        close(client_fd);
-        free(client_ctx);
-        return;
-    }
+    ctx->thread_args = thread_args;
+    ctx->rx_len = 0;
+    ctx->sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (ctx->sock < 0)
+        return -errno;
 
-    client_ctx->sock = client_fd;
-    client_ctx->thread_args = server_ctx->thread_args;
-    client_ctx->poll_handle.data = client_ctx;
-    ret = uv_poll_start(&client_ctx->poll_handle, UV_READABLE | UV_DISCONNECT,
-        connection_poll_cb);
-    if (ret < 0) {
-        VIBRATORERR("uv poll start socket failed: %d\n", ret);
-        close(client_fd);
-        free(client_ctx);
-        return;
-    }
+    ret = bind(ctx->sock, (const struct sockaddr*)&addr, sizeof(addr));
+    if (ret < 0)
+        return -errno;
+
+    ret = uv_poll_init_socket(ctx->transport->loop, &ctx->poll_handle, ctx->sock);
+    if (ret < 0)
+        return ret;
+
+    ctx->poll_handle.data = ctx;
+    return uv_poll_start(&ctx->poll_handle, UV_READABLE, dgram_poll_cb);
+}
+
+/****************************************************************************
+ * Name: vibrator_footprint()
+ *
+ * Description:
+ *   print the worst-case RAM footprint of the server, the part taken from
+ *   the heap per connection is reported when static allocation is off, the
+ *   watcher arrays libuv grows on the heap are not counted
+ *
+ ****************************************************************************/
+
+static void vibrator_footprint(void)
+{
+    size_t total = (sizeof(ff_dev_t) + sizeof(threadargs))
+        * CONFIG_VIBRATOR_DEVICES
+        + sizeof(vibrator_context_t) * VIBRATOR_ENDPOINTS
+        + sizeof(g_vibrator_transports) + sizeof(g_vibrator_ops)
+        + sizeof(g_vibrator_config) + sizeof(g_vibrator_config_next);
+
+    printf("device       %zu x %d\n", sizeof(ff_dev_t), CONFIG_VIBRATOR_DEVICES);
+    printf("engine       %zu x %d\n", sizeof(threadargs), CONFIG_VIBRATOR_DEVICES);
+    printf("  timeline   %zu\n", sizeof(vibrator_waveform_t));
+    printf("  queue      %zu\n", sizeof(vibrator_queue_t));
+    printf("  registry   %zu\n",
+        sizeof(vibrator_registry_t) * CONFIG_VIBRATOR_REGISTRY_SIZE);
+#if CONFIG_VIBRATOR_REGIONS > 0
+    printf("  regions    %zu, mapped from shared memory\n",
+        sizeof(vibrator_shm_t) * CONFIG_VIBRATOR_REGIONS);
+#endif
+#if CONFIG_VIBRATOR_HISTORY > 0
+    printf("  history    %zu\n",
+        sizeof(vibrator_history_t) * CONFIG_VIBRATOR_HISTORY);
+#endif
+#if CONFIG_VIBRATOR_APPS > 0
+    printf("  apps       %zu\n", sizeof(vibrator_app_t) * CONFIG_VIBRATOR_APPS);
+#endif
+    printf("listeners    %zu\n", sizeof(vibrator_context_t) * VIBRATOR_ENDPOINTS);
+    printf("transports   %zu\n", sizeof(g_vibrator_transports));
+    printf("op table     %zu\n", sizeof(g_vibrator_ops));
+    printf("config       %zu\n",
+        sizeof(g_vibrator_config) + sizeof(g_vibrator_config_next));
+#ifdef CONFIG_VIBRATOR_POLICY
+    total += sizeof(g_vibrator_policy) + sizeof(g_vibrator_policy_next);
+    printf("policy       %zu\n",
+        sizeof(g_vibrator_policy) + sizeof(g_vibrator_policy_next));
+#endif
+#ifdef CONFIG_VIBRATOR_STATIC_ALLOC
+    total += sizeof(g_vibrator_conns) + VIBRATOR_STACKS_SIZE;
+#ifdef CONFIG_VIBRATOR_THREADS
+    printf("stacks       %zu\n", (size_t)VIBRATOR_STACKS_SIZE);
+#endif
+    printf("connections  %zu (%d x %zu)\n", sizeof(g_vibrator_conns),
+        CONFIG_VIBRATOR_CONNECTIONS, sizeof(vibrator_context_t));
+    printf("total        %zu, static\n", total);
+#else
+#ifdef CONFIG_VIBRATOR_THREADS
+    printf("stacks       heap\n");
+#endif
+    printf("connections  heap, %zu each\n", sizeof(vibrator_context_t));
+    printf("total        %zu + connections\n", total);
+#endif
+    printf("libuv        heap, a pointer per socket, not counted\n");
 }
 
 int main(int argc, char* argv[])
 {
-    vibrator_context_t server_context[VIBRATOR_COUNT];
-    threadargs thread_args;
-    ff_dev_t ff_dev;
+    /* the engines grow with the queue, registry, history and apps of every
+       device, they are kept off the stack of the task */
+
+    static vibrator_context_t server_context[VIBRATOR_ENDPOINTS];
+    static threadargs thread_args[CONFIG_VIBRATOR_DEVICES];
+    static ff_dev_t ff_dev[CONFIG_VIBRATOR_DEVICES];
+    int devices = 0;
     int ret;
 
     const int family[] = {
@@ -1025,17 +6167,120 @@ int main(int argc, char* argv[])
         [VIBRATOR_REMOTE] = sizeof(struct sockaddr_rpmsg),
     };
 
-    ret = vibrator_init(&ff_dev);
+    if (argc > 1) {
+        if (strcmp(argv[1], "-m") != 0) {
+            printf("usage: %s [-m]\n", argv[0]);
+            return -EINVAL;
+        }
+
+        vibrator_footprint();
+        return OK;
+    }
+
+    for (int i = 0; i < VIBRATOR_ENDPOINTS; i++)
+        server_context[i].sock = -1;
+
+    vibrator_config_load();
+    vibrator_monitor_start(uv_default_loop(), &g_vibrator_config_monitor,
+        KVDB_KEY_VIBRATOR_CONFIG, vibrator_config_load);
+
+    for (; devices < CONFIG_VIBRATOR_DEVICES; devices++) {
+        ret = vibrator_init(&ff_dev[devices], devices);
+        if (ret < 0) {
+            VIBRATORERR("vibrator %d init failed: %d", devices, ret);
+            goto errout;
+        }
+    }
+
+    ret = vibrator_session_init();
     if (ret < 0) {
-        VIBRATORERR("vibrator init failed: %d", ret);
-        return ret;
+        VIBRATORERR("vibrator session init failed: %d", ret);
+        goto errout;
+    }
+
+#if CONFIG_VIBRATOR_REGIONS > 0
+    ret = vibrator_region_init();
+    if (ret < 0) {
+        VIBRATORERR("vibrator region init failed: %d", ret);
+        goto errout;
+    }
+#endif
+
+#if CONFIG_VIBRATOR_ALWAYS_ON > 0
+    ret = vibrator_always_on_init();
+    if (ret < 0) {
+        VIBRATORERR("vibrator always-on init failed: %d", ret);
+        goto errout;
+    }
+#endif
+
+#if CONFIG_VIBRATOR_HISTORY > 0
+    ret = vibrator_history_init();
+    if (ret < 0) {
+        VIBRATORERR("vibrator history init failed: %d", ret);
+        goto errout;
+    }
+#endif
+
+#if CONFIG_VIBRATOR_APPS > 0
+    ret = vibrator_apps_init();
+    if (ret < 0) {
+        VIBRATORERR("vibrator apps init failed: %d", ret);
+        goto errout;
+    }
+#endif
+
+#ifdef CONFIG_VIBRATOR_POLICY
+    vibrator_policy_init(uv_default_loop());
+#endif
+
+    memset(thread_args, 0, sizeof(thread_args));
+
+    /* the first engine runs on the default loop, with threads every other
+       engine runs a loop of its own */
+
+    for (int i = 0; i < CONFIG_VIBRATOR_DEVICES; i++) {
+        ff_dev[i].loop = uv_default_loop();
+#ifdef CONFIG_VIBRATOR_THREADS
+        if (i > 0) {
+            ret = uv_loop_init(&thread_args[i].own_loop);
+            if (ret < 0) {
+                VIBRATORERR("engine %d loop init failed: %d", i, ret);
+                goto errout;
+            }
+
+            ff_dev[i].loop = &thread_args[i].own_loop;
+        }
+#endif
+
+        thread_args[i].ff_dev = &ff_dev[i];
+        thread_args[i].timer.data = &thread_args[i];
+        thread_args[i].queue.timer.data = &thread_args[i];
+        thread_args[i].update.timer.data = &thread_args[i];
     }
 
-    thread_args.ff_dev = &ff_dev;
-    thread_args.timer.data = &thread_args;
+    /* the transports share the loop of the engine unless they have threads
+       of their own */
 
     for (int i = 0; i < VIBRATOR_COUNT; i++) {
-        server_context[i].thread_args = &thread_args;
+#ifdef CONFIG_VIBRATOR_THREADS
+        ret = uv_loop_init(&g_vibrator_transports[i].own_loop);
+        if (ret < 0) {
+            VIBRATORERR("transport %d loop init failed: %d", i, ret);
+            goto errout;
+        }
+
+        g_vibrator_transports[i].loop = &g_vibrator_transports[i].own_loop;
+#else
+        g_vibrator_transports[i].loop = uv_default_loop();
+#endif
+    }
+
+    for (int i = 0; i < VIBRATOR_COUNT; i++) {
+        server_context[i].thread_args = thread_args;
+        server_context[i].transport = &g_vibrator_transports[VIBRATOR_TRANSPORT(i)];
+        server_context[i].peer = i == VIBRATOR_REMOTE ? VIBRATOR_APP_REMOTE
+                                                      : VIBRATOR_APP_UNKNOWN;
 
         server_context[i].sock = socket(family[i], SOCK_STREAM | SOCK_NONBLOCK, 0);
         if (server_context[i].sock < 0) {
@@ -1048,7 +6293,7 @@ int main(int argc, char* argv[])
             goto errout;
         }
 
-        ret = uv_poll_init_socket(uv_default_loop(), &server_context[i].poll_handle, server_context[i].sock);
+        ret = uv_poll_init_socket(server_context[i].transport->loop, &server_context[i].poll_handle, server_context[i].sock);
         if (ret < 0) {
             goto errout;
         }
@@ -1065,7 +6310,27 @@ int main(int argc, char* argv[])
         }
     }
 
-    uv_timer_init(uv_default_loop(), &thread_args.timer);
+    server_context[VIBRATOR_DGRAM].transport =
+        &g_vibrator_transports[VIBRATOR_TRANSPORT(VIBRATOR_DGRAM)];
+    server_context[VIBRATOR_DGRAM].peer = VIBRATOR_APP_UNKNOWN;
+    ret = dgram_listen(&server_context[VIBRATOR_DGRAM], thread_args);
+    if (ret < 0) {
+        VIBRATORWARN("datagram endpoint unavailable: %d", ret);
+    }
+
+    for (int i = 0; i < CONFIG_VIBRATOR_DEVICES; i++) {
+        uv_timer_init(ff_dev[i].loop, &thread_args[i].timer);
+        uv_timer_init(ff_dev[i].loop, &thread_args[i].queue.timer);
+        uv_timer_init(ff_dev[i].loop, &thread_args[i].update.timer);
+    }
+
+#ifdef CONFIG_VIBRATOR_THREADS
+    ret = vibrator_engine_start(thread_args);
+    if (ret < 0) {
+        VIBRATORERR("vibrator engine start failed: %d", ret);
+        goto errout;
+    }
+#endif
 
     ret = uv_run(uv_default_loop(), UV_RUN_DEFAULT);
     if (ret < 0) {
@@ -1073,12 +6338,14 @@ int main(int argc, char* argv[])
     }
 
 errout:
-    for (int i = 0; i < VIBRATOR_COUNT; i++) {
+    for (int i = 0; i < VIBRATOR_ENDPOINTS; i++) {
         if (server_context[i].sock > 0) {
             close(server_context[i].sock);
         }
     }
 
-    close(ff_dev.fd);
+    while (devices-- > 0)
+        close(ff_dev[devices].fd);
+
     return ret;
 }
@@ -0,0 +1,655 @@
+/****************************************************************************
+ * Copyright (C) 2023 Xiaomi Corperation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define VIBRATOR_SIM_EFFECTS 16
+#define VIBRATOR_SIM_LEVEL_MAX 32767.0
+#define VIBRATOR_SIM_GAIN_MAX 65535.0
+#define VIBRATOR_SIM_DEFAULT_F0 170.0
+#define VIBRATOR_SIM_DEFAULT_Q 15.0
+#define VIBRATOR_SIM_DEFAULT_HOLD_Q 3.0
+#define VIBRATOR_SIM_DEFAULT_TAU 20.0
+#define VIBRATOR_SIM_DEFAULT_RATE 20000
+#define VIBRATOR_SIM_DEFAULT_GAP 200
+#define VIBRATOR_SIM_IDLE_LEVEL 0.01
+#define VIBRATOR_SIM_RISE_LOW 0.1
+#define VIBRATOR_SIM_RISE_HIGH 0.9
+#define VIBRATOR_SIM_LINE_MAX 256
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+typedef enum {
+    SIM_MODEL_LRA = 0,
+    SIM_MODEL_ERM = 1
+} sim_model_e;
+
+typedef enum {
+    SIM_EFFECT_CONSTANT = 0,
+    SIM_EFFECT_PERIODIC,
+    SIM_EFFECT_SQUARE,
+    SIM_EFFECT_CUSTOM
+} sim_effect_type_e;
+
+/* an uploaded effect, as recorded by the mock backend */
+
+struct sim_effect_s {
+    bool valid;
+    bool playing;
+    sim_effect_type_e type;
+    int level;
+    unsigned length;
+    unsigned delay;
+    unsigned attack_length;
+    unsigned attack_level;
+    unsigned fade_length;
+    unsigned fade_level;
+    unsigned period;
+    int offset;
+    uint64_t start;
+};
+
+/* one command of the mock log */
+
+struct sim_cmd_s {
+    uint64_t time;
+    char op[16];
+    int id;
+    char type[16];
+    struct sim_effect_s effect;
+    int value;
+};
+
+struct sim_param_s {
+    sim_model_e model;
+    double f0;
+    double q;
+    double hold_q;
+    double tau;
+    int rate;
+    unsigned gap;
+    FILE* csv;
+};
+
+/* actuator state, the LRA uses x/v as displacement and velocity of the
+   moving mass, the ERM uses x/v as rotor speed and its derivative */
+
+struct sim_state_s {
+    struct sim_effect_s effects[VIBRATOR_SIM_EFFECTS];
+    double gain;
+    double x;
+    double v;
+    double phase;
+};
+
+/* 1 ms trace of a burst of activity between two idle gaps */
+
+struct sim_segment_s {
+    uint64_t start;
+    size_t count;
+    size_t size;
+    float* drive;
+    float* accel;
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static void usage(void)
+{
+    printf("Replay mock vibrator command logs through an actuator model.\n"
+           "Usage: vibrator_sim [arguments...] <log> [<log>...]\n"
+           "\tArguments:\n"
+           "\t[-h       ] Commands help\n"
+           "\t[-m <val> ] Actuator model, lra or erm, default: lra\n"
+           "\t[-f <val> ] LRA resonant frequency in Hz, default: 170\n"
+           "\t[-q <val> ] LRA quality factor, default: 15\n"
+           "\t[-z <val> ] LRA quality factor during a zero-drive brake,\n"
+           "\t            default: 3\n"
+           "\t[-t <val> ] ERM time constant in ms, default: 20\n"
+           "\t[-r <val> ] Integration rate in Hz, default: 20000\n"
+           "\t[-g <val> ] Idle gap in ms that splits a log into segments,\n"
+           "\t            default: 200\n"
+           "\t[-o <csv> ] Write the 1 ms drive and acceleration envelope\n");
+}
+
+/****************************************************************************
+ * Name: sim_parse_cmd()
+ *
+ * Description:
+ *   parse a line of the mock command log
+ *
+ * Input Parameters:
+ *   line - a line of the mock command log
+ *   cmd - buffer that stores the command
+ *
+ * Returned Value:
+ *   true if the line is a valid command
+ *
+ ****************************************************************************/
+
+static bool sim_parse_cmd(const char* line, struct sim_cmd_s* cmd)
+{
+    struct sim_effect_s* e = &cmd->effect;
+    int n;
+
+    memset(cmd, 0, sizeof(*cmd));
+    n = sscanf(line, "%" SCNu64 " %15s", &cmd->time, cmd->op);
+    if (n != 2)
+        return false;
+
+    if (strcmp(cmd->op, "upload") == 0) {
+        n = sscanf(line, "%*s %*s %d %15s %d %u %u %u %u %u %u %u %d",
+            &cmd->id, cmd->type, &e->level, &e->length, &e->delay,
+            &e->attack_length, &e->attack_level, &e->fade_length,
+            &e->fade_level, &e->period, &e->offset);
+        if (n != 11)
+            return false;
+
+        if (strcmp(cmd->type, "constant") == 0)
+            e->type = SIM_EFFECT_CONSTANT;
+        else if (strcmp(cmd->type, "square") == 0)
+            e->type = SIM_EFFECT_SQUARE;
+        else if (strcmp(cmd->type, "custom") == 0)
+            e->type = SIM_EFFECT_CUSTOM;
+        else
+            e->type = SIM_EFFECT_PERIODIC;
+    } else if (strcmp(cmd->op, "play") == 0) {
+        if (sscanf(line, "%*s %*s %d %d", &cmd->id, &cmd->value) != 2)
+            return false;
+    } else if (strcmp(cmd->op, "gain") == 0) {
+        if (sscanf(line, "%*s %*s %d", &cmd->value) != 1)
+            return false;
+    } else if (strcmp(cmd->op, "remove") == 0) {
+        if (sscanf(line, "%*s %*s %d", &cmd->id) != 1)
+            return false;
+    } else {
+        return false;
+    }
+
+    return cmd->id >= 0 && cmd->id < VIBRATOR_SIM_EFFECTS;
+}
+
+/****************************************************************************
+ * Name: sim_apply_cmd()
+ *
+ * Description:
+ *   apply a command to the simulated force feedback device
+ *
+ ****************************************************************************/
+
+static void sim_apply_cmd(struct sim_state_s* state,
+    const struct sim_cmd_s* cmd)
+{
+    struct sim_effect_s* e = &state->effects[cmd->id];
+
+    if (strcmp(cmd->op, "upload") == 0) {
+
+        /* updating an effect keeps it playing, like the input core does */
+
+        bool playing = e->valid && e->playing;
+        uint64_t start = e->start;
+
+        *e = cmd->effect;
+        e->valid = true;
+        e->playing = playing;
+        e->start = start;
+    } else if (strcmp(cmd->op, "play") == 0) {
+        if (e->valid) {
+            e->playing = cmd->value > 0;
+            e->start = cmd->time;
+        }
+    } else if (strcmp(cmd->op, "gain") == 0) {
+        state->gain = cmd->value / VIBRATOR_SIM_GAIN_MAX;
+    } else {
+        e->valid = false;
+        e->playing = false;
+    }
+}
+
+/****************************************************************************
+ * Name: sim_envelope()
+ *
+ * Description:
+ *   apply the attack and fade envelope to the magnitude of an effect
+ *
+ ****************************************************************************/
+
+static double sim_envelope(const struct sim_effect_s* e, double magnitude,
+    double tau)
+{
+    double level;
+
+    if (e->attack_length && tau < e->attack_length) {
+        level = e->attack_level / VIBRATOR_SIM_LEVEL_MAX;
+        return level + (magnitude - level) * tau / e->attack_length;
+    }
+
+    if (e->length && e->fade_length && tau > e->length - e->fade_length) {
+        level = e->fade_level / VIBRATOR_SIM_LEVEL_MAX;
+        return level + (magnitude - level) * (e->length - tau) / e->fade_length;
+    }
+
+    return magnitude;
+}
+
+/****************************************************************************
+ * Name: sim_drive()
+ *
+ * Description:
+ *   compute the normalized drive of all effects playing at a time
+ *
+ * Input Parameters:
+ *   state - the simulated device
+ *   now - the time in ms
+ *   hold - set if a zero-level brake effect is playing
+ *
+ * Returned Value:
+ *   the drive in [-1, 1], negative means reverse phase
+ *
+ ****************************************************************************/
+
+static double sim_drive(struct sim_state_s* state, uint64_t now, bool* hold)
+{
+    double drive = 0.0;
+    double magnitude;
+    double tau;
+
+    *hold = false;
+    for (int i = 0; i < VIBRATOR_SIM_EFFECTS; i++) {
+        struct sim_effect_s* e = &state->effects[i];
+
+        if (!e->playing)
+            continue;
+
+        tau = (double)now - (double)e->start - e->delay;
+        if (tau < 0)
+            continue;
+
+        if (e->length && tau >= e->length) {
+            e->playing = false;
+            continue;
+        }
+
+        magnitude = abs(e->level) / VIBRATOR_SIM_LEVEL_MAX;
+        magnitude = sim_envelope(e, magnitude, tau);
+        switch (e->type) {
+        case SIM_EFFECT_CONSTANT:
+            if (e->level == 0)
+                *hold = true;
+            drive += e->level < 0 ? -magnitude : magnitude;
+            break;
+        case SIM_EFFECT_SQUARE:
+            if (e->period && fmod(tau, e->period) >= e->period / 2.0)
+                magnitude = -magnitude;
+            drive += e->offset / VIBRATOR_SIM_LEVEL_MAX + magnitude;
+            break;
+        default:
+            drive += magnitude;
+            break;
+        }
+    }
+
+    drive *= state->gain;
+    return fmax(-1.0, fmin(1.0, drive));
+}
+
+/****************************************************************************
+ * Name: sim_step()
+ *
+ * Description:
+ *   integrate the actuator model over 1 ms
+ *
+ * Input Parameters:
+ *   param - the model parameters
+ *   state - the actuator state
+ *   drive - the normalized drive
+ *   hold - the actuator is held at zero drive for braking
+ *
+ * Returned Value:
+ *   the normalized acceleration envelope at the end of the step
+ *
+ ****************************************************************************/
+
+static double sim_step(const struct sim_param_s* param,
+    struct sim_state_s* state, double drive, bool hold)
+{
+    int steps = param->rate / 1000;
+    double dt = 1.0 / param->rate;
+
+    if (param->model == SIM_MODEL_LRA) {
+
+        /* x'' + w0/Q x' + w0^2 x = w0^2/Q u sin(w0 t): the driver follows
+           the resonance, so the steady amplitude equals the drive and a
+           negative drive opposes the velocity */
+
+        double w0 = 2 * M_PI * param->f0;
+        double damping = w0 / (hold ? param->hold_q : param->q);
+
+        for (int i = 0; i < steps; i++) {
+            double force = w0 * w0 / param->q * drive * sin(state->phase);
+
+            state->v += (force - damping * state->v - w0 * w0 * state->x) * dt;
+            state->x += state->v * dt;
+            state->phase = fmod(state->phase + w0 * dt, 2 * M_PI);
+        }
+
+        return sqrt(state->x * state->x + state->v * state->v / (w0 * w0));
+    } else {
+
+        /* critically damped second-order rotor speed, the centripetal
+           acceleration of the eccentric mass grows with the speed squared */
+
+        double wn = 1000.0 / param->tau;
+
+        for (int i = 0; i < steps; i++) {
+            state->v += (wn * wn * (drive - state->x) - 2 * wn * state->v) * dt;
+            state->x += state->v * dt;
+        }
+
+        return state->x * state->x;
+    }
+}
+
+/****************************************************************************
+ * Name: sim_segment_report()
+ *
+ * Description:
+ *   compute and print the metrics of a segment:
+ *   latency - from the first drive to 10% of the peak
+ *   rise - from 10% to 90% of the peak
+ *   ringdown - from the end of the last positive drive to below 10% of
+ *   the peak
+ *
+ ****************************************************************************/
+
+static void sim_segment_report(const struct sim_param_s* param,
+    const char* name, int index, const struct sim_segment_s* seg)
+{
+    size_t low = seg->count, high = seg->count;
+    size_t drive_end = 0, settle = 0;
+    double peak = 0.0;
+
+    for (size_t i = 0; i < seg->count; i++) {
+        peak = fmax(peak, seg->accel[i]);
+        if (seg->drive[i] > 0)
+            drive_end = i + 1;
+    }
+
+    for (size_t i = 0; i < seg->count; i++) {
+        if (low == seg->count && seg->accel[i] >= VIBRATOR_SIM_RISE_LOW * peak)
+            low = i;
+        if (high == seg->count && seg->accel[i] >= VIBRATOR_SIM_RISE_HIGH * peak)
+            high = i;
+        if (seg->accel[i] >= VIBRATOR_SIM_RISE_LOW * peak)
+            settle = i + 1;
+    }
+
+    printf("%s %d %" PRIu64 " %zu %zu %.3f %zu\n", name, index, seg->start,
+        low, high - low, peak, settle > drive_end ? settle - drive_end : 0);
+
+    if (param->csv != NULL) {
+        for (size_t i = 0; i < seg->count; i++) {
+            fprintf(param->csv, "%s,%d,%" PRIu64 ",%.4f,%.4f\n", name, index,
+                seg->start + i, seg->drive[i], seg->accel[i]);
+        }
+    }
+}
+
+static int sim_segment_append(struct sim_segment_s* seg, double drive,
+    double accel)
+{
+    if (seg->count == seg->size) {
+        size_t size = seg->size ? seg->size * 2 : 1024;
+        float* d = realloc(seg->drive, size * sizeof(float));
+        float* a;
+
+        if (d == NULL)
+            return -1;
+        seg->drive = d;
+
+        a = realloc(seg->accel, size * sizeof(float));
+        if (a == NULL)
+            return -1;
+        seg->accel = a;
+        seg->size = size;
+    }
+
+    seg->drive[seg->count] = drive;
+    seg->accel[seg->count] = accel;
+    seg->count++;
+    return 0;
+}
+
+/****************************************************************************
+ * Name: sim_run()
+ *
+ * Description:
+ *   replay a mock command log at 1 ms resolution, and report every burst
+ *   of activity separated by an idle gap as a segment
+ *
+ * Input Parameters:
+ *   param - the model parameters
+ *   name - the path of the mock command log
+ *
+ * Returned Value:
+ *   0 means success, otherwise it means failure
+ *
+ ****************************************************************************/
+
+static int sim_run(const struct sim_param_s* param, const char* name)
+{
+    char line[VIBRATOR_SIM_LINE_MAX];
+    struct sim_segment_s seg;
+    struct sim_state_s state;
+    struct sim_cmd_s cmd;
+    bool pending = false;
+    bool active = false;
+    uint64_t idle = 0;
+    uint64_t last = 0;
+    uint64_t now = 0;
+    int index = 0;
+    int ret = 0;
+    FILE* fp;
+
+    fp = fopen(name, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "open %s failed\n", name);
+        return -1;
+    }
+
+    memset(&seg, 0, sizeof(seg));
+    memset(&state, 0, sizeof(state));
+    state.gain = 1.0;
+
+    for (;;) {
+        bool playing = false;
+        bool hold;
+        double drive;
+        double accel;
+
+        /* apply every command logged up to now */
+
+        while (pending || fgets(line, sizeof(line), fp) != NULL) {
+            if (!pending && !sim_parse_cmd(line, &cmd))
+                continue;
+
+            if (now == 0)
+                now = cmd.time;
+
+            if (cmd.time > now) {
+                pending = true;
+                break;
+            }
+
+            sim_apply_cmd(&state, &cmd);
+            last = cmd.time;
+            pending = false;
+        }
+
+        for (int i = 0; i < VIBRATOR_SIM_EFFECTS; i++)
+            playing |= state.effects[i].playing;
+
+        drive = sim_drive(&state, now, &hold);
+        accel = sim_step(param, &state, drive, hold);
+
+        if (drive != 0.0 && !active) {
+            active = true;
+            seg.start = now;
+            seg.count = 0;
+        }
+
+        if (active) {
+            if (sim_segment_append(&seg, drive, accel) < 0) {
+                ret = -1;
+                break;
+            }
+
+            idle = drive == 0.0 && accel < VIBRATOR_SIM_IDLE_LEVEL ? idle + 1 : 0;
+            if (idle >= param->gap) {
+                seg.count -= idle;
+                sim_segment_report(param, name, index++, &seg);
+                active = false;
+            }
+        }
+
+        /* an effect left playing at the end of the log runs for at most
+           the longest replay length */
+
+        if (!pending && feof(fp)
+            && ((!playing && !active) || now > last + UINT16_MAX + param->gap))
+            break;
+
+        now++;
+    }
+
+    if (active && ret == 0)
+        sim_segment_report(param, name, index, &seg);
+
+    free(seg.drive);
+    free(seg.accel);
+    fclose(fp);
+    return ret;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    struct sim_param_s param;
+    const char* csv = NULL;
+    int ret = 0;
+    int ch;
+
+    param.model = SIM_MODEL_LRA;
+    param.f0 = VIBRATOR_SIM_DEFAULT_F0;
+    param.q = VIBRATOR_SIM_DEFAULT_Q;
+    param.hold_q = VIBRATOR_SIM_DEFAULT_HOLD_Q;
+    param.tau = VIBRATOR_SIM_DEFAULT_TAU;
+    param.rate = VIBRATOR_SIM_DEFAULT_RATE;
+    param.gap = VIBRATOR_SIM_DEFAULT_GAP;
+    param.csv = NULL;
+
+    while ((ch = getopt(argc, argv, "m:f:q:z:t:r:g:o:h")) != EOF) {
+        switch (ch) {
+        case 'm':
+            if (strcmp(optarg, "erm") == 0)
+                param.model = SIM_MODEL_ERM;
+            else if (strcmp(optarg, "lra") == 0)
+                param.model = SIM_MODEL_LRA;
+            else
+                goto error;
+            break;
+        case 'f':
+            param.f0 = atof(optarg);
+            break;
+        case 'q':
+            param.q = atof(optarg);
+            break;
+        case 'z':
+            param.hold_q = atof(optarg);
+            break;
+        case 't':
+            param.tau = atof(optarg);
+            break;
+        case 'r':
+            param.rate = atoi(optarg);
+            break;
+        case 'g':
+            param.gap = atoi(optarg);
+            break;
+        case 'o':
+            csv = optarg;
+            break;
+        default:
+            goto error;
+        }
+    }
+
+    if (optind >= argc || param.f0 <= 0 || param.q <= 0 || param.hold_q <= 0
+        || param.tau <= 0 || param.rate < 1000 || param.gap == 0)
+        goto error;
+
+    if (param.model == SIM_MODEL_LRA && param.rate < param.f0 * 20) {
+        printf("NOTE: rate should be at least 20 times the resonant frequency\n");
+        goto error;
+    }
+
+    if (csv != NULL) {
+        param.csv = fopen(csv, "w");
+        if (param.csv == NULL) {
+            printf("open %s failed\n", csv);
+            return 1;
+        }
+
+        fprintf(param.csv, "log,segment,time_ms,drive,accel\n");
+    }
+
+    printf("# log segment start_ms latency_ms rise_ms peak ringdown_ms\n");
+    for (int i = optind; i < argc; i++) {
+        if (sim_run(&param, argv[i]) < 0)
+            ret = 1;
+    }
+
+    if (param.csv != NULL)
+        fclose(param.csv);
+
+    return ret;
+
+error:
+    usage();
+    return 1;
+}
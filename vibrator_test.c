@@ -18,9 +18,12 @@
  * Included Files
  ****************************************************************************/
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include <vibrator_api.h>
@@ -39,6 +42,14 @@
 #define VIBRATOR_TEST_WAVEFORM_MAX 7
 #define VIBRATOR_TEST_DEFAULT_INTERVAL 1000
 #define VIBRATOR_TEST_DEFAULT_COUNT 5
+#define VIBRATOR_TEST_DEFAULT_POLICY 0
+#define VIBRATOR_TEST_DEFAULT_PRIORITY 1
+#define VIBRATOR_TEST_DEFAULT_TRIGGER 0
+#define VIBRATOR_TEST_DEFAULT_DEVICE 0
+#define VIBRATOR_TEST_DEFAULT_CATEGORY 0
+#define VIBRATOR_TEST_REGION_NAME "/vibrator_test"
+#define VIBRATOR_TEST_HISTORY_MAX 64
+#define VIBRATOR_TEST_APPS_MAX 16
 
 /****************************************************************************
  * Private Types
@@ -61,6 +72,12 @@ struct vibrator_test_s {
     int waveformid;
     int interval;
     int count;
+    int policy;
+    int priority;
+    int trigger;
+    int device;
+    int category;
+    const char* tag;
     struct waveform_arrays_s waveform_args[VIBRATOR_TEST_WAVEFORM_MAX];
 };
 
@@ -76,6 +93,17 @@ enum vibrator_test_apino_e {
     VIBRATOR_TEST_SETINTENSITY,
     VIBRATOR_TEST_GETINTENSITY,
     VIBRATOR_TEST_INTERVAL,
+    VIBRATOR_TEST_GETSTATUS,
+    VIBRATOR_TEST_GETSTATS,
+    VIBRATOR_TEST_SESSION,
+    VIBRATOR_TEST_REGION,
+    VIBRATOR_TEST_UPDATE,
+    VIBRATOR_TEST_RUMBLE,
+    VIBRATOR_TEST_ALWAYS_ON,
+    VIBRATOR_TEST_DUMP,
+    VIBRATOR_TEST_APPS,
+    VIBRATOR_TEST_RESET_APPS,
+    VIBRATOR_TEST_UPDATE_INTERVAL,
 };
 
 /****************************************************************************
@@ -98,7 +126,14 @@ static void usage(void)
            "\t[-s <val> ] The effect strength, [0, 2], default: 2\n"
            "\t[-l <val> ] The waveform array id, [0, 6], default: 0\n"
            "\t[-d <val> ] The interval of vibration in milliseconds, default: 1000\n"
-           "\t[-c <val> ] The count of vibration, default: 5\n");
+           "\t[-c <val> ] The count of vibration, default: 5\n"
+           "\t[-p <val> ] The busy policy, 0: drop, 1: wait, 2: coalesce,\n"
+           "\t            default: 0\n"
+           "\t[-q <val> ] The request priority, [0, 3], default: 1\n"
+           "\t[-g <val> ] The always-on trigger, -1 disables it, default: 0\n"
+           "\t[-v <val> ] The actuator index, 255 for all of them, default: 0\n"
+           "\t[-n <val> ] The application tag, default: none\n"
+           "\t[-k <val> ] The request category, [0, 7], default: 0\n");
 }
 
 static int test_play_predefined(uint8_t id, vibrator_effect_strength_e es)
@@ -160,13 +195,273 @@ static int test_get_capabilities(void)
     return ret;
 }
 
+static int test_get_status(void)
+{
+    vibrator_status_t status;
+    int ret;
+
+    ret = vibrator_get_status(&status);
+    if (ret < 0)
+        return ret;
+
+    printf("vibrator server reporting busy: %d, queue depth: %d, "
+           "retry after: %d ms\n",
+        status.busy, status.queue_depth, status.retry_after_ms);
+    return ret;
+}
+
+static int test_get_stats(void)
+{
+    vibrator_stats_t stats;
+    int ret;
+
+    ret = vibrator_get_stats(&stats);
+    if (ret < 0)
+        return ret;
+
+    printf("vibrator server reporting queue depth: %" PRIu32
+           ", peak: %" PRIu32 ", queued: %" PRIu32 ", coalesced: %" PRIu32
+           ", expired: %" PRIu32 ", rejected: %" PRIu32
+           ", preempted: %" PRIu32 "\n",
+        stats.queue_depth, stats.queue_peak, stats.queued, stats.coalesced,
+        stats.expired, stats.rejected, stats.preempted);
+    printf("vibrator server reporting wakeups: %" PRIu32 ", frames: %" PRIu32
+           ", batch peak: %" PRIu32 ", accept peak: %" PRIu32 "\n",
+        stats.wakeups, stats.frames, stats.batch_peak, stats.accept_peak);
+    printf("vibrator server reporting updates: %" PRIu32 ", written: %" PRIu32
+           "\n",
+        stats.updates, stats.update_writes);
+    return ret;
+}
+
+static int test_dump(void)
+{
+    vibrator_history_t history[VIBRATOR_TEST_HISTORY_MAX];
+    vibrator_state_t state;
+    int ret;
+
+    ret = vibrator_get_state(&state);
+    if (ret < 0)
+        return ret;
+
+    printf("device: capabilities 0x%" PRIx32 ", busy %" PRIu32 " ms"
+           ", amplitude %d, intensity %d, magnitude %d\n",
+        state.capabilities, state.busy_ms, state.amplitude, state.intensity,
+        state.magnitude);
+    printf("effect: id %d, type 0x%x, updatable %d, brake id %d, armed %d\n",
+        state.effect_id, state.effect_type, state.updatable, state.brake_id,
+        state.brake_armed);
+    printf("slots: double buffer %d, next %d", state.double_buffer,
+        state.slot_next);
+    for (int i = 0; i < VIBRATOR_STATE_SLOTS; i++)
+        printf(", [%d] id %d step %d", i, state.slot_id[i], state.slot_step[i]);
+    printf("\n");
+    printf("timeline: driving %d, region %d, step %" PRId32 " of %" PRId32
+           ", repeat %" PRId32 "\n",
+        state.driving, state.timeline_region, state.timeline_count,
+        state.timeline_length, state.timeline_repeat);
+    printf("queue: %d waiting, active client 0x%" PRIx32 ", token %" PRIu32
+           ", priority %d\n",
+        state.queue_count, state.active_client, state.active_token,
+        state.active_priority);
+
+    ret = vibrator_get_history(history, VIBRATOR_TEST_HISTORY_MAX);
+    if (ret < 0)
+        return ret;
+
+    printf("history, newest first:\n");
+    for (int i = 0; i < ret; i++) {
+        printf("  %" PRIu32 " ms: client 0x%" PRIx32 ", type %d, priority %d"
+               ", hash 0x%08" PRIx32 ", wait %d ms, latency %" PRIu32 " us"
+               ", result %d, preempted by %d\n",
+            history[i].time_ms, history[i].client, history[i].type,
+            history[i].priority, history[i].hash, history[i].wait_ms,
+            history[i].latency_us, history[i].result, history[i].preempted_by);
+    }
+
+    return ret;
+}
+
+static int test_apps(void)
+{
+    vibrator_app_stats_t apps[VIBRATOR_TEST_APPS_MAX];
+    int ret;
+
+    ret = vibrator_get_app_stats(apps, VIBRATOR_TEST_APPS_MAX);
+    if (ret < 0)
+        return ret;
+
+    printf("applications:\n");
+    for (int i = 0; i < ret; i++) {
+        printf("  %-16s requests %" PRIu32 ", errors %" PRIu32
+               ", on %" PRIu32 " ms, energy %" PRIu32 " ms\n",
+            apps[i].tag, apps[i].requests, apps[i].errors, apps[i].on_ms,
+            apps[i].energy);
+    }
+
+    return ret;
+}
+
+static int test_session(int repeat, int time,
+    struct waveform_arrays_s waveform_args)
+{
+    uint32_t token;
+    int session;
+    int handle;
+    int ret;
+
+    session = vibrator_session_open();
+    if (session < 0)
+        return session;
+
+    handle = vibrator_session_register_waveform(session, waveform_args.timings,
+        waveform_args.amplitudes, repeat, waveform_args.length);
+    if (handle < 0) {
+        ret = handle;
+        goto out;
+    }
+
+    printf("registered waveform handle: %d\n", handle);
+    ret = vibrator_session_play(session, handle, &token);
+    if (ret < 0)
+        goto out;
+
+    printf("playing token: %" PRIu32 ", cancel after %d ms\n", token, time);
+    usleep(time * 1000);
+    ret = vibrator_session_cancel(session, token);
+
+out:
+    vibrator_session_close(session);
+    return ret;
+}
+
+static int test_update(int time, uint8_t amplitude)
+{
+    int session;
+    int ret;
+    int i;
+
+    session = vibrator_session_open();
+    if (session < 0)
+        return session;
+
+    ret = vibrator_start_amplitude(time, amplitude);
+    if (ret < 0)
+        goto out;
+
+    /* ramp the amplitude down once per 60 Hz frame */
+
+    for (i = 0; i < time / 16; i++) {
+        ret = vibrator_session_update(session,
+            amplitude - amplitude * i * 16 / time);
+        if (ret < 0)
+            break;
+
+        usleep(16 * 1000);
+    }
+
+out:
+    vibrator_session_close(session);
+    return ret;
+}
+
+static int test_update_interval(int duration, int interval, int count)
+{
+    vibrator_state_t state;
+    int ret;
+
+    ret = vibrator_play_interval(duration, interval, count);
+    if (ret < 0)
+        return ret;
+
+    /* in the middle of the first pulse the server must refuse updates,
+       vibrator_session_update() is validated against this flag */
+
+    usleep(duration * 500);
+    ret = vibrator_get_state(&state);
+    if (ret < 0)
+        return ret;
+
+    if (state.updatable) {
+        printf("interval accepts updates\n");
+        return -EINVAL;
+    }
+
+    return vibrator_cancel();
+}
+
+static int test_region(int repeat, int time,
+    struct waveform_arrays_s waveform_args)
+{
+    size_t size = waveform_args.length * sizeof(vibrator_step_t);
+    vibrator_step_t* steps;
+    uint32_t token;
+    int session;
+    int region;
+    int ret;
+    int fd;
+
+    fd = shm_open(VIBRATOR_TEST_REGION_NAME, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+        return -errno;
+
+    if (ftruncate(fd, size) < 0) {
+        ret = -errno;
+        close(fd);
+        goto unlink;
+    }
+
+    steps = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (steps == MAP_FAILED) {
+        ret = -errno;
+        goto unlink;
+    }
+
+    for (int i = 0; i < waveform_args.length; i++) {
+        steps[i].timing = waveform_args.timings[i];
+        steps[i].amplitude = waveform_args.amplitudes[i];
+    }
+
+    session = vibrator_session_open();
+    if (session < 0) {
+        ret = session;
+        goto unmap;
+    }
+
+    region = vibrator_session_register_region(session,
+        VIBRATOR_TEST_REGION_NAME, size);
+    if (region < 0) {
+        ret = region;
+        goto out;
+    }
+
+    printf("registered region handle: %d\n", region);
+    ret = vibrator_session_play_region(session, region, 0,
+        waveform_args.length, repeat, &token);
+    if (ret < 0)
+        goto out;
+
+    printf("playing token: %" PRIu32 ", release after %d ms\n", token, time);
+    usleep(time * 1000);
+    ret = vibrator_session_release_region(session, region);
+
+out:
+    vibrator_session_close(session);
+unmap:
+    munmap(steps, size);
+unlink:
+    shm_unlink(VIBRATOR_TEST_REGION_NAME);
+    return ret;
+}
+
 static int param_parse(int argc, char* argv[],
     struct vibrator_test_s* test_data)
 {
     const char* apino;
     int ch;
 
-    while ((ch = getopt(argc, argv, "t:a:e:r:i:s:l:d:c:h")) != EOF) {
+    while ((ch = getopt(argc, argv, "t:a:e:r:i:s:l:d:c:p:q:g:v:n:k:h")) != EOF) {
         switch (ch) {
         case 't': {
             printf("%s\n", optarg);
@@ -236,6 +531,42 @@ static int param_parse(int argc, char* argv[],
             }
             break;
         }
+        case 'p': {
+            test_data->policy = atoi(optarg);
+            if (test_data->policy < VIBRATOR_BUSY_DROP
+                || test_data->policy > VIBRATOR_BUSY_COALESCE)
+                printf("NOTE: Invalid busy policy, use 0, 1, 2\n");
+            break;
+        }
+        case 'q': {
+            test_data->priority = atoi(optarg);
+            if (test_data->priority < VIBRATOR_PRIORITY_LOW
+                || test_data->priority > VIBRATOR_PRIORITY_URGENT)
+                printf("NOTE: Invalid priority, use 0, 1, 2, 3\n");
+            break;
+        }
+        case 'g': {
+            test_data->trigger = atoi(optarg);
+            break;
+        }
+        case 'v': {
+            test_data->device = atoi(optarg);
+            if (test_data->device < 0
+                || test_data->device > VIBRATOR_DEVICE_ALL)
+                printf("NOTE: Invalid device, use an index or 255\n");
+            break;
+        }
+        case 'n': {
+            test_data->tag = optarg;
+            break;
+        }
+        case 'k': {
+            test_data->category = atoi(optarg);
+            if (test_data->category < VIBRATOR_CATEGORY_UNKNOWN
+                || test_data->category > VIBRATOR_CATEGORY_ACCESSIBILITY)
+                printf("NOTE: Invalid category, use 0 to 7\n");
+            break;
+        }
         case 'h':
         default: {
             return -1;
@@ -256,6 +587,18 @@ static int do_vibrator_test(struct vibrator_test_s* test_data)
 {
     int ret;
 
+    vibrator_set_busy_policy(test_data->policy);
+    vibrator_set_priority(test_data->priority);
+    vibrator_set_device(test_data->device);
+    vibrator_set_category(test_data->category);
+    if (test_data->tag != NULL) {
+        ret = vibrator_set_app_tag(test_data->tag);
+        if (ret < 0) {
+            printf("set app tag failed: %d\n", ret);
+            return ret;
+        }
+    }
+
     switch (test_data->api) {
     case VIBRATOR_TEST_OENSHOT:
         printf("API TEST: vibrator_play_oneshot\n");
@@ -345,6 +688,107 @@ static int do_vibrator_test(struct vibrator_test_s* test_data)
             return ret;
         }
         break;
+    case VIBRATOR_TEST_GETSTATUS:
+        printf("API TEST: vibrator_get_status\n");
+        ret = test_get_status();
+        if (ret < 0) {
+            printf("get_status failed: %d\n", ret);
+            return ret;
+        }
+        break;
+    case VIBRATOR_TEST_GETSTATS:
+        printf("API TEST: vibrator_get_stats\n");
+        ret = test_get_stats();
+        if (ret < 0) {
+            printf("get_stats failed: %d\n", ret);
+            return ret;
+        }
+        break;
+    case VIBRATOR_TEST_SESSION:
+        printf("API TEST: vibrator_session_play, id = %d\n", test_data->waveformid);
+        ret = test_session(test_data->repeat, test_data->time,
+            test_data->waveform_args[test_data->waveformid]);
+        if (ret < 0) {
+            printf("session_play failed: %d\n", ret);
+            return ret;
+        }
+        break;
+    case VIBRATOR_TEST_REGION:
+        printf("API TEST: vibrator_session_play_region, id = %d\n",
+            test_data->waveformid);
+        ret = test_region(test_data->repeat, test_data->time,
+            test_data->waveform_args[test_data->waveformid]);
+        if (ret < 0) {
+            printf("play_region failed: %d\n", ret);
+            return ret;
+        }
+        break;
+    case VIBRATOR_TEST_UPDATE:
+        printf("API TEST: vibrator_session_update, time = %d\n", test_data->time);
+        ret = test_update(test_data->time, test_data->amplitude);
+        if (ret < 0) {
+            printf("session_update failed: %d\n", ret);
+            return ret;
+        }
+        break;
+    case VIBRATOR_TEST_RUMBLE:
+        printf("API TEST: vibrator_play_rumble, time = %d, strong = %d, weak = %d\n",
+            test_data->time, test_data->amplitude, test_data->amplitude / 2);
+        ret = vibrator_play_rumble(test_data->time, test_data->amplitude,
+            test_data->amplitude / 2);
+        if (ret < 0) {
+            printf("play_rumble failed: %d\n", ret);
+            return ret;
+        }
+        break;
+    case VIBRATOR_TEST_ALWAYS_ON:
+        if (test_data->trigger < 0) {
+            printf("API TEST: vibrator_always_on_disable\n");
+            ret = vibrator_always_on_disable(0);
+        } else {
+            printf("API TEST: vibrator_always_on_enable, trigger = %d, id = %d\n",
+                test_data->trigger, test_data->effectid);
+            ret = vibrator_always_on_enable(0, test_data->trigger,
+                test_data->effectid, test_data->es);
+        }
+        if (ret < 0) {
+            printf("always_on failed: %d\n", ret);
+            return ret;
+        }
+        break;
+    case VIBRATOR_TEST_DUMP:
+        printf("API TEST: vibrator_get_state, vibrator_get_history\n");
+        ret = test_dump();
+        if (ret < 0) {
+            printf("dump failed: %d\n", ret);
+            return ret;
+        }
+        break;
+    case VIBRATOR_TEST_APPS:
+        printf("API TEST: vibrator_get_app_stats\n");
+        ret = test_apps();
+        if (ret < 0) {
+            printf("get app stats failed: %d\n", ret);
+            return ret;
+        }
+        break;
+    case VIBRATOR_TEST_RESET_APPS:
+        printf("API TEST: vibrator_reset_app_stats\n");
+        ret = vibrator_reset_app_stats();
+        if (ret < 0) {
+            printf("reset app stats failed: %d\n", ret);
+            return ret;
+        }
+        break;
+    case VIBRATOR_TEST_UPDATE_INTERVAL:
+        printf("API TEST: vibrator_session_update during an interval\n");
+        ret = test_update_interval(test_data->time, test_data->interval,
+            test_data->count);
+        if (ret < 0) {
+            printf("update_interval failed: %d\n", ret);
+            return ret;
+        }
+        break;
     default:
         printf("arg out of range\n");
         break;
@@ -413,6 +857,12 @@ int main(int argc, char* argv[])
     test_data.api = VIBRATOR_TEST_DEFAULT_API;
     test_data.interval = VIBRATOR_TEST_DEFAULT_TIME;
     test_data.count = VIBRATOR_TEST_DEFAULT_COUNT;
+    test_data.policy = VIBRATOR_TEST_DEFAULT_POLICY;
+    test_data.priority = VIBRATOR_TEST_DEFAULT_PRIORITY;
+    test_data.trigger = VIBRATOR_TEST_DEFAULT_TRIGGER;
+    test_data.device = VIBRATOR_TEST_DEFAULT_DEVICE;
+    test_data.category = VIBRATOR_TEST_DEFAULT_CATEGORY;
+    test_data.tag = NULL;
 
     /*Init waveform test arrays*/
     waveform_args_init(&test_data);